@@ -0,0 +1,275 @@
+#define _TEST_ENV
+
+#include "../test/mocks.h"
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "Map.h"
+#include "HashIndex.h"
+#include "SerialMap.h"
+#include "SerialMapView.h"
+#include "ActionParser.h"
+
+/**
+ * @brief Prevents the compiler from optimizing away a benchmarked result
+ */
+template <typename T>
+void doNotOptimize(const T &value)
+{
+    asm volatile(""
+                 :
+                 : "r,m"(value)
+                 : "memory");
+}
+
+// Every heap allocation of the process goes through the replaced operator new below
+static unsigned long allocations = 0;
+static unsigned long allocatedBytes = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    allocatedBytes += size;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+static bool json = false;
+static const char *filter = nullptr;
+
+/**
+ * @brief A Stream discarding what is written, counting the bytes
+ */
+class NullStream : public Stream
+{
+public:
+    using Stream::write;
+    size_t write(uint8_t c) override
+    {
+        written++;
+        return 1;
+    }
+    size_t write(const uint8_t *data, size_t sz) override
+    {
+        written += sz;
+        return sz;
+    }
+    size_t written = 0;
+};
+
+/**
+ * @brief Runs the given function the given number of times and prints the average time,
+ *  heap allocations and allocated bytes per call, either as a table row or as a JSON line
+ *
+ * @param name The benchmark name
+ * @param iterations The number of calls
+ * @param fn The benchmarked function
+ */
+template <typename F>
+void benchmark(const char *name, long iterations, F fn)
+{
+    if (filter != nullptr && strstr(name, filter) == nullptr)
+    {
+        return;
+    }
+    unsigned long allocationsBefore = allocations, bytesBefore = allocatedBytes;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++)
+    {
+        fn(i);
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start);
+    double ns = elapsed.count() / iterations;
+    double allocs = (double)(allocations - allocationsBefore) / iterations;
+    double bytes = (double)(allocatedBytes - bytesBefore) / iterations;
+
+    if (json)
+    {
+        printf("{\"name\":\"%s\",\"iterations\":%ld,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f,\"bytes_per_op\":%.1f}\n",
+               name, iterations, ns, allocs, bytes);
+    }
+    else
+    {
+        printf("%-44s %10.1f ns/op %8.2f allocs/op %10.1f B/op\n", name, ns, allocs, bytes);
+    }
+}
+
+template <class M, int S>
+void bench_map_lookup(const char *name)
+{
+    M map;
+    std::string keys[S];
+    for (int i = 0; i < S; i++)
+    {
+        keys[i] = "field_" + std::to_string(i);
+        map.put(keys[i], keys[i]);
+    }
+    const std::string missing = "field_missing";
+
+    char label[64];
+    snprintf(label, sizeof(label), "%s<%d>::get hit", name, S);
+    benchmark(label, 2000000, [&](long i)
+              { doNotOptimize(map.get(keys[i % S])); });
+    snprintf(label, sizeof(label), "%s<%d>::has miss", name, S);
+    benchmark(label, 2000000, [&](long i)
+              { doNotOptimize(map.has(missing)); });
+    snprintf(label, sizeof(label), "%s<%d>::put fill", name, S);
+    benchmark(label, 200000, [&](long i)
+              {
+                  M filled;
+                  for (int k = 0; k < S; k++)
+                  {
+                      filled.put(keys[k], keys[k]);
+                  }
+                  doNotOptimize(filled.getSize()); });
+}
+
+template <int S>
+void bench_maps()
+{
+    bench_map_lookup<Map<std::string, std::string, S>, S>("Map");
+    bench_map_lookup<HashMap<std::string, std::string, S>, S>("HashMap");
+}
+
+template <int N>
+void bench_dispatch()
+{
+    ActionParser<N> parser;
+    ActionMap requests[N];
+    int calls = 0;
+    for (int i = 0; i < N; i++)
+    {
+        std::string name = "action_" + std::to_string(i);
+        parser.with(name, [&calls](ActionMap &map, Stream &output)
+                    {
+                        calls++;
+                        return false; });
+        requests[i].put("action", name);
+    }
+    Stream output;
+
+    char label[64];
+    snprintf(label, sizeof(label), "ActionParser<%d>::execute linear", N);
+    benchmark(label, 1000000, [&](long i)
+              { doNotOptimize(parser.execute(requests[i % N], output)); });
+    parser.freeze();
+    snprintf(label, sizeof(label), "ActionParser<%d>::execute frozen", N);
+    benchmark(label, 1000000, [&](long i)
+              { doNotOptimize(parser.execute(requests[i % N], output)); });
+    doNotOptimize(calls);
+}
+
+template <int L>
+void bench_serial_map()
+{
+    typedef SerialMap<std::string, 8> Serial;
+    Serial map;
+    for (int i = 0; i < 4; i++)
+    {
+        map.put("field_" + std::to_string(i), std::string(L, 'v'));
+    }
+    char frame[SerialFrame::BUFFER_SIZE * 2];
+    size_t len = map.serialize(frame, sizeof(frame));
+    NullStream output;
+
+    char label[64];
+    snprintf(label, sizeof(label), "SerialMap 4x%dB serialize", L);
+    benchmark(label, 500000, [&](long i)
+              { doNotOptimize(map.serialize(frame, sizeof(frame))); });
+    snprintf(label, sizeof(label), "SerialMap 4x%dB deserialize", L);
+    benchmark(label, 200000, [&](long i)
+              {
+                  Serial parsed(frame, len);
+                  doNotOptimize(parsed.getSize()); });
+    snprintf(label, sizeof(label), "SerialMap 4x%dB write", L);
+    benchmark(label, 500000, [&](long i)
+              {
+                  map.write(output);
+                  doNotOptimize(output.written); });
+    snprintf(label, sizeof(label), "SerialMapView 4x%dB parse", L);
+    benchmark(label, 500000, [&](long i)
+              {
+                  SerialMapView<8> parsed(frame, len - 1);
+                  doNotOptimize(parsed.getSize()); });
+}
+
+void bench_parse()
+{
+    ActionMap fields;
+    for (int i = 0; i < 8; i++)
+    {
+        fields.put("field_" + std::to_string(i), "a value long enough to skip the small string buffer");
+    }
+    char frame[SerialFrame::BUFFER_SIZE];
+    size_t len = fields.serialize(frame, sizeof(frame));
+
+    benchmark("ActionMap parse 8 fields", 200000, [&](long i)
+              {
+                  ActionMap parsed(frame, len);
+                  doNotOptimize(parsed.getSize()); });
+    benchmark("ActionView parse 8 fields", 200000, [&](long i)
+              {
+                  ActionView parsed(frame, len);
+                  doNotOptimize(parsed.getSize()); });
+}
+
+/**
+ * @brief Usage: program [--json] [name filter]
+ */
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+        {
+            json = true;
+        }
+        else
+        {
+            filter = argv[i];
+        }
+    }
+
+    bench_maps<10>();
+    bench_maps<24>();
+    bench_maps<64>();
+
+    bench_dispatch<4>();
+    bench_dispatch<16>();
+    bench_dispatch<48>();
+
+    bench_serial_map<8>();
+    bench_serial_map<64>();
+    bench_serial_map<200>();
+
+    bench_parse();
+
+    return 0;
+}
@@ -11,35 +11,46 @@
 #include "SerialMap.h"
 #include "Common.h"
 #include "Optional.h"
+#include "InplaceFunction.h"
 #include "RemoteControlSettings.h"
+#include "ServerCredentials.h"
+#include "BufferedWriter.h"
+#include "BufferPool.h"
 
 class AccessPointOperations
 {
 public:
+  /**
+   * @brief Construct a new Access Point Operations object
+   *
+   * @param pool The pool the buffers of the connections are drawn from, shared with the command server
+   */
   AccessPointOperations(Configuration &configuration,
                         StateManager &stateManager,
-                        AccessPointSettings settings);
+                        AccessPointSettings settings,
+                        BufferPool &pool);
   void startServer();
   /**
    * @brief Set a callback to be executed in loop while the AP server is awaiting for connections
    * 
    * @param callback 
    */
-  void setOnServerLoopCallback(std::function<void(void)> callback);
+  void setOnServerLoopCallback(InplaceFunction<void(void)> callback);
+  const ServerCredentials &getCredentials() const;
 
 private:
   Configuration &configuration;
   StateManager &stateManager;
   AccessPointSettings settings;
+  BufferPool &pool;
   AuthenticationHandler authHandler;
   ActionParser<10> actionParser;
-  BearSSL::X509List serverCert;
-  BearSSL::PrivateKey privateKey;
-  Optional<std::function<void(void)>> onServerLoopCallback;
+  ServerCredentials credentials;
+  Optional<InplaceFunction<void(void)>> onServerLoopCallback;
 
   bool serverRunning = true;
 
-  bool setWifiPassword(ActionMap &action, Stream &output);
+  bool setWifiPassword(ActionView &action, Stream &output);
 };
 
 #endif
@@ -2,14 +2,35 @@
 #define ACTION_PARSER_H
 
 #include "Map.h"
+#include "HashIndex.h"
 #include "SerialMap.h"
+#include "BufferStream.h"
+#include "Response.h"
+#include "LatencyHistogram.h"
+#include "InplaceFunction.h"
+#include "Async.h"
+#include "Upload.h"
+#include "BufferPool.h"
 #include "Common.h"
 #include <functional>
+#include <memory>
 #include <string>
 
 /**
  * @brief A class that stores an amount of action names associated with a
- * callback function to be executed when requested
+ * callback function to be executed when requested.
+ * The reserved action `__batch` carries several actions in a single frame: every other
+ * field holds a serialized action frame (without its terminator). They are executed in
+ * order and a single frame is written back, holding under the same keys the response
+ * frame written by each action.
+ * An asynchronous action (see Async.h) can wait for timers and conditions; the server keeps
+ * serving the other clients meanwhile, through startAsync(). Elsewhere, e.g. within a batch,
+ * it is run to completion.
+ * An upload action (see Upload.h) receives the payload following its frame through an
+ * UploadHandler, started by the server through startUpload(). It can't be executed without
+ * its payload, e.g. within a batch, and is answered with an error there.
+ * The buffers of a batch and of the frame serialized again for a view callback are drawn from
+ * the BufferPool given to usePool(), or from the heap without one, rather than from the stack
  *
  * @tparam N The maximum number of actions to store
  */
@@ -17,37 +38,545 @@ template <int N>
 class ActionParser
 {
 public:
+	typedef InplaceFunction<bool(ActionMap &, Stream &)> Callback;
+	/**
+	 * @brief A callback reading the action through a view over the received frame,
+	 * so that no String gets allocated to parse it
+	 */
+	typedef InplaceFunction<bool(ActionView &, Stream &)> ViewCallback;
+	typedef AsyncTask::Callback AsyncCallback;
+	/**
+	 * @brief The name of the action carrying a batch of actions
+	 */
+	static constexpr const char *BATCH_ACTION = "__batch";
+	/**
+	 * @brief The size of the buffer collecting the response of each action in a batch.
+	 * A response that doesn't fit in a frame field is replaced by an error response
+	 */
+	static constexpr size_t BATCH_RESPONSE_SIZE = 256;
+
 	ActionParser() = default;
-	ActionParser &with(const String &action,
-					   std::function<bool(ActionMap &, Stream &)> callback)
+	// The dispatch table points into the registered actions
+	ActionParser(const ActionParser &) = delete;
+	ActionParser &operator=(const ActionParser &) = delete;
+	ActionParser &with(const String &action, Callback callback)
 	{
-		actions.put(action, callback);
-		return *this;
+		return add(action, Handler(callback));
 	}
-	ActionParser &with(const char *action,
-					   std::function<bool(ActionMap &, Stream &)> callback)
+	ActionParser &with(const char *action, Callback callback)
 	{
-		actions.put(String(action), callback);
-		return *this;
+		return add(String(action), Handler(callback));
+	}
+	ActionParser &with(const String &action, ViewCallback callback)
+	{
+		return add(action, Handler(callback));
+	}
+	ActionParser &with(const char *action, ViewCallback callback)
+	{
+		return add(String(action), Handler(callback));
+	}
+	ActionParser &with(const String &action, AsyncCallback callback)
+	{
+		return add(action, Handler(callback));
+	}
+	ActionParser &with(const char *action, AsyncCallback callback)
+	{
+		return add(String(action), Handler(callback));
+	}
+	/**
+	 * @brief Registers an upload action, whose handler has to outlive the parser
+	 */
+	ActionParser &with(const String &action, UploadHandler &handler)
+	{
+		return add(action, Handler(&handler));
+	}
+	ActionParser &with(const char *action, UploadHandler &handler)
+	{
+		return add(String(action), Handler(&handler));
+	}
+	/**
+	 * @brief Draws the buffers of the batches from the given pool, which has to outlive the parser.
+	 * A batch finding no room in the pool is answered with an error
+	 */
+	void usePool(BufferPool &pool)
+	{
+		this->pool = &pool;
+	}
+	/**
+	 * @brief Freezes the registered actions into a dispatch table sorted by the hash
+	 * of their names. From now on an action is found through a binary search over
+	 * the hashes and a single name comparison. Registering a new action unfreezes
+	 * the parser, which falls back to the linear search until frozen again
+	 */
+	void freeze()
+	{
+		int count = 0;
+		for (auto it = actions.begin(); it != actions.end(); it++)
+		{
+			Entry entry = {hash((*it).key()), &(*it).key(), &(*it).value()};
+			// Insertion sort, the table is small and built once
+			int i = count++;
+			for (; i > 0 && table[i - 1].hash > entry.hash; i--)
+			{
+				table[i] = table[i - 1];
+			}
+			table[i] = entry;
+		}
+		frozen = true;
+	}
+	/**
+	 * @brief Whether the dispatch table is frozen
+	 */
+	bool isFrozen() const
+	{
+		return frozen;
 	}
 	bool execute(ActionMap &data, Stream &output)
 	{
-		if (data.has("action"))
+		if (isBatch(data))
 		{
-			String action = *data.get("action");
-			for (auto it = actions.begin(); it != actions.end(); it++)
+			Scratch buffer(pool, SerialFrame::BUFFER_SIZE);
+			if (!buffer)
 			{
-				if (action == (*it).key())
-				{
-					return (*it).value()(data, output);
-				}
+				Response::errorResponse().write(output);
+				return false;
 			}
+			size_t len = data.serialize(buffer.data(), buffer.size());
+			if (len == (size_t)-1)
+			{
+				return false;
+			}
+			return executeBatch(ActionView(buffer.data(), len), output);
+		}
+		Handler *handler = find(data);
+		if (handler == nullptr)
+		{
+			return false;
+		}
+		return invoke(*handler, data, output);
+	}
+	bool execute(ActionView &data, Stream &output)
+	{
+		if (isBatch(data))
+		{
+			return executeBatch(data, output);
+		}
+		Handler *handler = find(data);
+		if (handler == nullptr)
+		{
+			return false;
+		}
+		return invoke(*handler, data, output);
+	}
+	/**
+	 * @brief Whether the given action is asynchronous, i.e. startAsync() would start it
+	 */
+	bool isAsync(ActionView &data)
+	{
+		Handler *handler = isBatch(data) ? nullptr : find(data);
+		return handler != nullptr && handler->kind == HANDLER_ASYNC;
+	}
+	/**
+	 * @brief Starts the given action in the task if it is asynchronous, leaving the task to be
+	 * polled until done. Its latency is recorded on completion
+	 *
+	 * @param data The action, whose frame has to outlive the task
+	 * @param output The response stream, which has to outlive the task
+	 * @param task The task
+	 * @return false If the action is not asynchronous, and has to be executed
+	 */
+	bool startAsync(ActionView &data, Stream &output, AsyncTask &task)
+	{
+		Handler *handler = isBatch(data) ? nullptr : find(data);
+		if (handler == nullptr || handler->kind != HANDLER_ASYNC)
+		{
+			return false;
+		}
+		task.start(handler->asyncCallback, data, output, &handler->latency);
+		return true;
+	}
+	/**
+	 * @brief Starts the given action in the task if it is an upload, leaving the task to read
+	 * its payload. Its latency is recorded on commit
+	 *
+	 * @param data The action
+	 * @param task The task, which is left stopped if the upload is refused
+	 * @return false If the action is not an upload, and has to be executed
+	 */
+	bool startUpload(ActionView &data, UploadTask &task)
+	{
+		Handler *handler = isBatch(data) ? nullptr : find(data);
+		if (handler == nullptr || handler->kind != HANDLER_UPLOAD)
+		{
+			return false;
+		}
+		task.start(*handler->upload, data, &handler->latency);
+		return true;
+	}
+	/**
+	 * @brief Calls the given function with the name of each action and the histogram of
+	 * its execution times, response included
+	 */
+	template <typename F>
+	void forEachLatency(F callback)
+	{
+		for (auto it = actions.begin(); it != actions.end(); it++)
+		{
+			callback((*it).key(), (*it).value().latency);
+		}
+	}
+	void clearLatencies()
+	{
+		for (auto it = actions.begin(); it != actions.end(); it++)
+		{
+			(*it).value().latency.clear();
 		}
-		return false;
 	}
 
 private:
-	Map<String, std::function<bool(ActionMap &, Stream &)>, N> actions;
+	enum HANDLER_KIND
+	{
+		HANDLER_NONE,
+		HANDLER_MAP,
+		HANDLER_VIEW,
+		HANDLER_ASYNC,
+		HANDLER_UPLOAD
+	};
+
+	/**
+	 * @brief The callback of an action, of whichever kind it was registered with. The kinds
+	 * share the same storage
+	 */
+	struct Handler
+	{
+		Handler() : kind(HANDLER_NONE), upload(nullptr) {}
+		explicit Handler(const Callback &callback) : kind(HANDLER_MAP), callback(callback) {}
+		explicit Handler(const ViewCallback &callback) : kind(HANDLER_VIEW), viewCallback(callback) {}
+		explicit Handler(const AsyncCallback &callback) : kind(HANDLER_ASYNC), asyncCallback(callback) {}
+		explicit Handler(UploadHandler *upload) : kind(HANDLER_UPLOAD), upload(upload) {}
+		Handler(const Handler &copy) : kind(HANDLER_NONE), upload(nullptr)
+		{
+			*this = copy;
+		}
+		Handler &operator=(const Handler &copy)
+		{
+			if (this == &copy)
+			{
+				return *this;
+			}
+			destroy();
+			kind = copy.kind;
+			switch (kind)
+			{
+			case HANDLER_MAP:
+				new (&callback) Callback(copy.callback);
+				break;
+			case HANDLER_VIEW:
+				new (&viewCallback) ViewCallback(copy.viewCallback);
+				break;
+			case HANDLER_ASYNC:
+				new (&asyncCallback) AsyncCallback(copy.asyncCallback);
+				break;
+			default:
+				upload = copy.upload;
+				break;
+			}
+			latency = copy.latency;
+			return *this;
+		}
+		~Handler()
+		{
+			destroy();
+		}
+
+		HANDLER_KIND kind;
+		union
+		{
+			Callback callback;
+			ViewCallback viewCallback;
+			AsyncCallback asyncCallback;
+			UploadHandler *upload;
+		};
+		LatencyHistogram latency;
+
+	private:
+		void destroy()
+		{
+			switch (kind)
+			{
+			case HANDLER_MAP:
+				callback.~Callback();
+				break;
+			case HANDLER_VIEW:
+				viewCallback.~ViewCallback();
+				break;
+			case HANDLER_ASYNC:
+				asyncCallback.~AsyncCallback();
+				break;
+			default:
+				break;
+			}
+			kind = HANDLER_NONE;
+		}
+	};
+
+	struct Entry
+	{
+		uint32_t hash;
+		const String *name;
+		Handler *handler;
+	};
+
+	/**
+	 * @brief A buffer drawn from the pool, or from the heap without one
+	 */
+	class Scratch
+	{
+	public:
+		Scratch(BufferPool *pool, size_t size)
+		{
+			if (pool != nullptr)
+			{
+				pooled = pool->acquire(size);
+				buffer = pooled.data();
+			}
+			else
+			{
+				owned.reset(new (std::nothrow) char[size]);
+				buffer = owned.get();
+			}
+			length = buffer != nullptr ? size : 0;
+		}
+		char *data() const
+		{
+			return buffer;
+		}
+		size_t size() const
+		{
+			return length;
+		}
+		explicit operator bool() const
+		{
+			return buffer != nullptr;
+		}
+
+	private:
+		PoolBuffer pooled;
+		std::unique_ptr<char[]> owned;
+		char *buffer;
+		size_t length;
+	};
+
+	Map<String, Handler, N> actions;
+	Entry table[N];
+	bool frozen = false;
+	BufferPool *pool = nullptr;
+
+	ActionParser &add(const String &action, const Handler &handler)
+	{
+		actions.put(action, handler);
+		frozen = false;
+		return *this;
+	}
+
+	template <class M>
+	static bool isBatch(M &data)
+	{
+		auto action = data.get("action");
+		return action != nullptr && *action == BATCH_ACTION;
+	}
+
+	/**
+	 * @brief Executes the actions of a batch in order, writing their responses as a single frame
+	 *
+	 * @return true If any of the actions asked to terminate the server, once the whole batch is done
+	 */
+	bool executeBatch(const ActionView &batch, Stream &output)
+	{
+		bool result = false;
+		Scratch buffer(pool, BATCH_RESPONSE_SIZE);
+		if (!buffer)
+		{
+			Response::errorResponse().write(output);
+			return false;
+		}
+		char *captured = buffer.data();
+		// The responses are written in the version of the batch, a v2 one nesting them whole
+		FRAME_VERSION version = batch.getVersion();
+		if (version == FRAME_V2)
+		{
+			output.write(SerialFrame::VERSION_2);
+		}
+
+		for (int i = 0; i < batch.getSize(); i++)
+		{
+			const SerialSlice &key = batch.keyAt(i);
+			if (key == "action")
+			{
+				continue;
+			}
+
+			ActionView action(batch.valueAt(i).data(), batch.valueAt(i).length());
+			BufferStream response(captured, buffer.size());
+			// Nested batches are refused, as well as unknown actions
+			Handler *handler = isBatch(action) ? nullptr : find(action);
+			if (handler == nullptr)
+			{
+				Response::errorResponse().write(response);
+			}
+			else
+			{
+				result |= invoke(*handler, action, response);
+			}
+
+			// The response frame is nested without its terminator, as the actions are
+			size_t len = response.getLength();
+			if (len > 0 && captured[len - 1] == '\0')
+			{
+				len--;
+			}
+			if (response.hasOverflown() || (version == FRAME_V1 && len > 255))
+			{
+				response.clear();
+				Response::errorResponse().write(response);
+				len = response.getLength() - 1;
+			}
+
+			uint8_t header[SerialFrame::MAX_HEADER_SIZE];
+			output.write(header, SerialFrame::encodeHeader(header, SerialFrame::KEY_TYPE, key.length(), version));
+			output.write(key.data(), key.length());
+			output.write(header, SerialFrame::encodeHeader(header, SerialFrame::VALUE_TYPE, len, version));
+			output.write(captured, len);
+		}
+		output.write('\0');
+		return result;
+	}
+
+	bool invoke(Handler &handler, ActionMap &data, Stream &output)
+	{
+		if (handler.kind == HANDLER_UPLOAD)
+		{
+			Response::errorResponse().write(output);
+			return false;
+		}
+		unsigned long start = micros();
+		bool result;
+		if (handler.kind == HANDLER_MAP)
+		{
+			result = handler.callback(data, output);
+		}
+		else
+		{
+			// A view callback gets a view over the map serialized again
+			Scratch buffer(pool, SerialFrame::BUFFER_SIZE);
+			if (!buffer)
+			{
+				Response::errorResponse().write(output);
+				return false;
+			}
+			size_t len = data.serialize(buffer.data(), buffer.size());
+			if (len == (size_t)-1)
+			{
+				return false;
+			}
+			ActionView view(buffer.data(), len);
+			result = handler.kind == HANDLER_VIEW ? handler.viewCallback(view, output) : run(handler, view, output);
+		}
+		handler.latency.record(micros() - start);
+		return result;
+	}
+
+	bool invoke(Handler &handler, ActionView &data, Stream &output)
+	{
+		if (handler.kind == HANDLER_UPLOAD)
+		{
+			Response::errorResponse().write(output);
+			return false;
+		}
+		unsigned long start = micros();
+		bool result;
+		if (handler.kind == HANDLER_VIEW)
+		{
+			result = handler.viewCallback(data, output);
+		}
+		else if (handler.kind == HANDLER_ASYNC)
+		{
+			result = run(handler, data, output);
+		}
+		else
+		{
+			// Only the callbacks taking an ActionMap pay for its allocations
+			ActionMap map(data.data(), data.length());
+			result = handler.callback(map, output);
+		}
+		handler.latency.record(micros() - start);
+		return result;
+	}
+
+	static bool run(Handler &handler, ActionView &data, Stream &output)
+	{
+		AsyncTask task;
+		task.start(handler.asyncCallback, data, output);
+		return task.run();
+	}
+
+	template <typename K>
+	static uint32_t hash(const K &name)
+	{
+		return MapHash<K>()(name);
+	}
+
+	template <class M>
+	Handler *find(M &data)
+	{
+		auto action = data.get("action");
+		if (action == nullptr)
+		{
+			return nullptr;
+		}
+		return frozen ? findFrozen(*action) : findLinear(*action);
+	}
+
+	template <typename K>
+	Handler *findLinear(const K &action)
+	{
+		for (auto it = actions.begin(); it != actions.end(); it++)
+		{
+			if (action == (*it).key())
+			{
+				return &(*it).value();
+			}
+		}
+		return nullptr;
+	}
+
+	template <typename K>
+	Handler *findFrozen(const K &action)
+	{
+		uint32_t h = hash(action);
+		int low = 0, high = actions.getSize();
+		while (low < high)
+		{
+			int mid = (low + high) / 2;
+			if (table[mid].hash < h)
+			{
+				low = mid + 1;
+			}
+			else
+			{
+				high = mid;
+			}
+		}
+		// Names only get compared on a hash match, colliding names sit next to each other
+		for (; low < actions.getSize() && table[low].hash == h; low++)
+		{
+			if (action == *table[low].name)
+			{
+				return table[low].handler;
+			}
+		}
+		return nullptr;
+	}
 };
 
-#endif
\ No newline at end of file
+#endif
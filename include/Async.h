@@ -0,0 +1,384 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include "InplaceFunction.h"
+#include "LatencyHistogram.h"
+#include "Common.h"
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include) && !defined(ASYNC_COOPERATIVE)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#define ASYNC_COROUTINES 1
+#endif
+#endif
+
+/**
+ * @brief What an asynchronous action is waiting for: a timer or a condition. The server
+ *  resumes the action once it is satisfied, serving the other clients in the meantime
+ */
+class AsyncContext
+{
+public:
+  /**
+   * @brief Whether the action can go on
+   */
+  bool ready()
+  {
+    if (sleeping)
+    {
+      return millis() - since >= duration;
+    }
+    return !condition || condition();
+  }
+  /**
+   * @brief Makes the action wait for the given time, wrapping millis() safely
+   */
+  AsyncContext &sleep(unsigned long ms)
+  {
+    sleeping = true;
+    since = millis();
+    duration = ms;
+    condition = nullptr;
+    return *this;
+  }
+  /**
+   * @brief Makes the action wait until the condition holds, checked at every server loop
+   */
+  AsyncContext &until(InplaceFunction<bool(void)> ready)
+  {
+    sleeping = false;
+    condition = ready;
+    return *this;
+  }
+  void reset()
+  {
+    sleeping = false;
+    condition = nullptr;
+#ifndef ASYNC_COROUTINES
+    line = 0;
+#endif
+  }
+
+#ifdef ASYNC_COROUTINES
+  // The context is awaited by the coroutines, suspending them unless already ready
+  bool await_ready()
+  {
+    return ready();
+  }
+  void await_suspend(std::coroutine_handle<>) {}
+  void await_resume()
+  {
+    sleeping = false;
+    condition = nullptr;
+  }
+#else
+  /** @brief Where the cooperative action resumes, see ASYNC_BEGIN */
+  int line = 0;
+#endif
+
+private:
+  bool sleeping = false;
+  unsigned long since = 0, duration = 0;
+  InplaceFunction<bool(void)> condition;
+};
+
+#ifdef ASYNC_COROUTINES
+
+/**
+ * @brief The result of an asynchronous action: a C++20 coroutine, started and resumed by
+ *  the server, whose co_return value tells whether to terminate the server
+ */
+class Async
+{
+public:
+  struct promise_type
+  {
+    bool result = false;
+
+    Async get_return_object()
+    {
+      return Async(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    // The server runs the coroutine from its first poll
+    std::suspend_always initial_suspend() noexcept
+    {
+      return {};
+    }
+    std::suspend_always final_suspend() noexcept
+    {
+      return {};
+    }
+    void return_value(bool value)
+    {
+      result = value;
+    }
+    void unhandled_exception()
+    {
+      std::terminate();
+    }
+  };
+
+  Async() = default;
+  Async(const Async &) = delete;
+  Async(Async &&move) : handle(move.handle)
+  {
+    move.handle = nullptr;
+  }
+  Async &operator=(Async &&move)
+  {
+    if (this != &move)
+    {
+      destroy();
+      handle = move.handle;
+      move.handle = nullptr;
+    }
+    return *this;
+  }
+  ~Async()
+  {
+    destroy();
+  }
+  bool isDone() const
+  {
+    return !handle || handle.done();
+  }
+  bool getResult() const
+  {
+    return handle && handle.promise().result;
+  }
+  void resume()
+  {
+    if (!isDone())
+    {
+      handle.resume();
+    }
+  }
+  void destroy()
+  {
+    if (handle)
+    {
+      handle.destroy();
+      handle = nullptr;
+    }
+  }
+
+private:
+  std::coroutine_handle<promise_type> handle;
+
+  explicit Async(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+};
+
+// The waits are set up before the co_await, as GCC 12 evaluates both arms of a conditional
+// expression within its operand
+#define ASYNC_BEGIN(context)
+#define ASYNC_SLEEP(context, ms) \
+  do                             \
+  {                              \
+    (context).sleep(ms);         \
+    co_await(context);           \
+  } while (0)
+#define ASYNC_UNTIL(context, condition)                     \
+  do                                                        \
+  {                                                         \
+    (context).until([&]() { return (bool)(condition); });   \
+    co_await(context);                                      \
+  } while (0)
+#define ASYNC_RETURN(context, result) co_return (result)
+#define ASYNC_END(context)
+
+#else
+
+/**
+ * @brief The result of a step of a cooperative asynchronous action, i.e. a function called
+ *  again by the server at every loop until it returns done()
+ */
+class Async
+{
+public:
+  static Async pending()
+  {
+    return Async(false, false);
+  }
+  static Async done(bool result)
+  {
+    return Async(true, result);
+  }
+  bool isDone() const
+  {
+    return finished;
+  }
+  bool getResult() const
+  {
+    return result;
+  }
+
+private:
+  bool finished, result;
+
+  Async(bool finished, bool result) : finished(finished), result(result) {}
+};
+
+// A protothread: the action returns at every wait and jumps back to it on the next call,
+// so the local variables don't survive a wait and the waits can't sit in a nested switch
+#define ASYNC_BEGIN(context) \
+  switch ((context).line)    \
+  {                          \
+  case 0:
+#define ASYNC_SLEEP(context, ms)   \
+  do                               \
+  {                                \
+    (context).sleep(ms);           \
+    (context).line = __LINE__;     \
+  case __LINE__:                   \
+    if (!(context).ready())        \
+      return Async::pending();     \
+  } while (0)
+#define ASYNC_UNTIL(context, condition) \
+  do                                    \
+  {                                     \
+    (context).line = __LINE__;          \
+  case __LINE__:                        \
+    if (!(condition))                   \
+      return Async::pending();          \
+  } while (0)
+#define ASYNC_RETURN(context, result) return Async::done(result)
+#define ASYNC_END(context) \
+  }                        \
+  return Async::done(false)
+
+#endif
+
+/**
+ * @brief An asynchronous action running on behalf of a client. The action gets a copy of the
+ *  view over the frame and the response stream, both of which have to outlive the task
+ */
+class AsyncTask
+{
+public:
+  /**
+   * @brief An asynchronous action, written between ASYNC_BEGIN and ASYNC_END with ASYNC_SLEEP,
+   *  ASYNC_UNTIL and ASYNC_RETURN, so that it builds as a coroutine on the C++20 toolchains and
+   *  as a cooperative function elsewhere. It has to end with ASYNC_RETURN
+   */
+  typedef InplaceFunction<Async(ActionView &, Stream &, AsyncContext &)> Callback;
+
+  AsyncTask() = default;
+  AsyncTask(const AsyncTask &) = delete;
+  /**
+   * @brief Starts the action, which runs from the first poll()
+   *
+   * @param callback The action, which has to outlive the task
+   * @param action The action frame
+   * @param output The response stream
+   * @param latency If not null, receives the time taken by the action
+   */
+  void start(Callback &callback, const ActionView &action, Stream &output, LatencyHistogram *latency = nullptr)
+  {
+    this->action = action;
+    this->output = &output;
+    this->latency = latency;
+    context.reset();
+    started = micros();
+    running = true;
+#ifdef ASYNC_COROUTINES
+    coroutine = callback(this->action, output, context);
+#else
+    this->callback = &callback;
+#endif
+  }
+  /**
+   * @brief Runs the action until its next wait, if what it waits for is ready
+   *
+   * @return true Once the action is done
+   */
+  bool poll()
+  {
+    if (!running)
+    {
+      return true;
+    }
+#ifdef ASYNC_COROUTINES
+    if (context.ready())
+    {
+      coroutine.resume();
+    }
+    if (!coroutine.isDone())
+    {
+      return false;
+    }
+    result = coroutine.getResult();
+    coroutine.destroy();
+#else
+    if (!context.ready())
+    {
+      return false;
+    }
+    Async step = (*callback)(action, *output, context);
+    if (!step.isDone())
+    {
+      return false;
+    }
+    result = step.getResult();
+#endif
+    running = false;
+    if (latency != nullptr)
+    {
+      latency->record(micros() - started);
+    }
+    return true;
+  }
+  /**
+   * @brief Runs the action to completion, for the callers that can't wait for it
+   *
+   * @return bool The action result
+   */
+  bool run()
+  {
+    while (!poll())
+    {
+      delay(1);
+    }
+    return result;
+  }
+  /**
+   * @brief Drops the action, e.g. when its client is gone
+   */
+  void cancel()
+  {
+#ifdef ASYNC_COROUTINES
+    coroutine.destroy();
+#endif
+    running = false;
+  }
+  bool isRunning() const
+  {
+    return running;
+  }
+  /**
+   * @brief Whether the server has to terminate, once the action is done
+   */
+  bool getResult() const
+  {
+    return result;
+  }
+
+private:
+  ActionView action;
+  Stream *output = nullptr;
+  AsyncContext context;
+  LatencyHistogram *latency = nullptr;
+  unsigned long started = 0;
+  bool running = false, result = false;
+#ifdef ASYNC_COROUTINES
+  Async coroutine;
+#else
+  Callback *callback = nullptr;
+#endif
+};
+
+#endif // ASYNC_H
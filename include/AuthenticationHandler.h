@@ -2,9 +2,12 @@
 #define AUTHENTICATION_HANDLER_H
 
 #include <memory>
+#ifndef _TEST_ENV
 #include <Arduino.h>
+#endif
 #include "SerialMap.h"
 #include "Response.h"
+#include "FrameAuthenticator.h"
 #include "Common.h"
 
 class AuthenticationHandler
@@ -14,12 +17,38 @@ public:
   AuthenticationHandler(const String &username,
                         const String &password, int TIMEOUT_MS);
   AuthenticationHandler(const char *username, const char *password, int TIMEOUT_MS);
-  bool authenticate(Stream &client);
+  /**
+   * @brief Reads the authentication frame from the client and validates it,
+   *  writing the result back
+   *
+   * @param buffer The buffer the frame is read into
+   * @param size The buffer size
+   */
+  bool authenticate(Stream &client, char *buffer, size_t size);
+  /**
+   * @brief Validates an authentication frame already read, writing the result back to the client
+   */
+  bool authenticate(const ActionView &authentication, Stream &client);
+  /**
+   * @brief Validates the credentials carried by an action frame, i.e. a password, a session
+   *  token or an HMAC, without writing anything back
+   */
+  bool authorize(const ActionView &action);
+  /**
+   * @brief Makes the successful password logins answer with a session token in the `token` field,
+   *  valid for the given time. The tokens are signed with a random key, so a reboot revokes them
+   *
+   * @param lifetimeMs The token lifetime
+   */
+  void enableSessionTokens(unsigned long lifetimeMs);
+  /**
+   * @brief Keeps the HMAC nonces from being replayed after a reboot (see FrameAuthenticator::persistNonces)
+   */
+  void persistNonces(uint32_t floor, InplaceFunction<bool(uint32_t)> persist);
 
 private:
-  String username, password;
+  FrameAuthenticator credentials;
   int timeout;
-  char buffer[1024];
 };
 
 #endif
@@ -0,0 +1,247 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// The bytes shared by the buffers of the connections, define it in the build flags to serve more
+// clients at once: each one takes SerialFrame::BUFFER_SIZE bytes, plus 128 while an asynchronous
+// action runs, the command server 512 more for its responses and 256 while a batch runs
+#ifndef BUFFER_POOL_SIZE
+#define BUFFER_POOL_SIZE 2048
+#endif
+
+class BufferPool;
+
+/**
+ * @brief A buffer drawn from a BufferPool, given back when destroyed. It can be moved, not copied
+ */
+class PoolBuffer
+{
+public:
+  PoolBuffer() = default;
+  PoolBuffer(const PoolBuffer &) = delete;
+  PoolBuffer(PoolBuffer &&move) : pool(move.pool), buffer(move.buffer), length(move.length)
+  {
+    move.pool = nullptr;
+    move.buffer = nullptr;
+    move.length = 0;
+  }
+  PoolBuffer &operator=(PoolBuffer &&move);
+  ~PoolBuffer()
+  {
+    release();
+  }
+  /**
+   * @brief Gives the buffer back to the pool
+   */
+  void release();
+  char *data() const
+  {
+    return buffer;
+  }
+  size_t size() const
+  {
+    return length;
+  }
+  /**
+   * @brief Whether the buffer has been drawn, i.e. the pool had room for it
+   */
+  explicit operator bool() const
+  {
+    return buffer != nullptr;
+  }
+
+private:
+  friend class BufferPool;
+
+  BufferPool *pool = nullptr;
+  char *buffer = nullptr;
+  size_t length = 0;
+
+  PoolBuffer(BufferPool *pool, char *buffer, size_t length) : pool(pool), buffer(buffer), length(length) {}
+};
+
+/**
+ * @brief A fixed budget of memory the servers draw the buffers of their connections from, so that
+ *  the buffers that are never live at the same time, e.g. those of the AP server and those of the
+ *  command server, share the same bytes. The buffers are placed first-fit, and the peak usage is
+ *  kept to size the budget
+ */
+class BufferPool
+{
+public:
+  static constexpr size_t BUDGET = BUFFER_POOL_SIZE;
+  /** @brief The buffers drawn at the same time */
+  static constexpr int MAX_BUFFERS = 24;
+
+  BufferPool() = default;
+  BufferPool(const BufferPool &) = delete;
+  /**
+   * @brief Draws a buffer
+   *
+   * @param size The buffer size
+   * @return PoolBuffer The buffer, empty if the budget is used up
+   */
+  PoolBuffer acquire(size_t size)
+  {
+    size_t needed = rounded(size);
+    size_t offset;
+    int i = find(needed, offset);
+    if (i < 0)
+    {
+      failures++;
+      return PoolBuffer();
+    }
+
+    for (int j = count; j > i; j--)
+    {
+      blocks[j] = blocks[j - 1];
+    }
+    blocks[i] = {offset, needed};
+    count++;
+    used += needed;
+    if (used > highWater)
+    {
+      highWater = used;
+    }
+    return PoolBuffer(this, storage + offset, size);
+  }
+  /**
+   * @brief Whether a buffer of the given size can be drawn right now, without counting a failure
+   */
+  bool fits(size_t size) const
+  {
+    size_t offset;
+    return find(rounded(size), offset) >= 0;
+  }
+  /**
+   * @brief The bytes drawn right now
+   */
+  size_t getUsed() const
+  {
+    return used;
+  }
+  /**
+   * @brief The most bytes drawn at the same time, to size BUFFER_POOL_SIZE
+   */
+  size_t getHighWater() const
+  {
+    return highWater;
+  }
+  /**
+   * @brief The buffers refused as the budget was used up
+   */
+  unsigned long getFailures() const
+  {
+    return failures;
+  }
+  /**
+   * @brief Writes the summary `used,high water,budget,failures`
+   */
+  void summary(char *out, size_t size) const
+  {
+    snprintf(out, size, "%lu,%lu,%lu,%lu", (unsigned long)used, (unsigned long)highWater, (unsigned long)BUDGET, failures);
+  }
+
+private:
+  friend class PoolBuffer;
+
+  static constexpr size_t ALIGNMENT = 4;
+
+  struct Block
+  {
+    size_t offset, size;
+  };
+
+  alignas(ALIGNMENT) char storage[BUDGET];
+  // The buffers drawn, by offset
+  Block blocks[MAX_BUFFERS];
+  int count = 0;
+  size_t used = 0, highWater = 0;
+  unsigned long failures = 0;
+
+  static size_t rounded(size_t size)
+  {
+    // Keeps the buffers word aligned
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+  }
+
+  /**
+   * @brief Finds the first gap holding the given bytes
+   *
+   * @return int The index the block goes to, -1 if none fits
+   */
+  int find(size_t needed, size_t &offset) const
+  {
+    offset = 0;
+    if (count >= MAX_BUFFERS || needed == 0)
+    {
+      return -1;
+    }
+    for (int i = 0; i <= count; i++)
+    {
+      size_t end = i < count ? blocks[i].offset : BUDGET;
+      if (end - offset >= needed)
+      {
+        return i;
+      }
+      if (i < count)
+      {
+        offset = blocks[i].offset + blocks[i].size;
+      }
+    }
+    return -1;
+  }
+
+  void release(char *buffer)
+  {
+    size_t offset = buffer - storage;
+    for (int i = 0; i < count; i++)
+    {
+      if (blocks[i].offset == offset)
+      {
+        used -= blocks[i].size;
+        for (int j = i; j < count - 1; j++)
+        {
+          blocks[j] = blocks[j + 1];
+        }
+        count--;
+        return;
+      }
+    }
+  }
+};
+
+inline PoolBuffer &PoolBuffer::operator=(PoolBuffer &&move)
+{
+  if (this != &move)
+  {
+    release();
+    pool = move.pool;
+    buffer = move.buffer;
+    length = move.length;
+    move.pool = nullptr;
+    move.buffer = nullptr;
+    move.length = 0;
+  }
+  return *this;
+}
+
+inline void PoolBuffer::release()
+{
+  if (pool != nullptr)
+  {
+    pool->release(buffer);
+    pool = nullptr;
+    buffer = nullptr;
+    length = 0;
+  }
+}
+
+#endif // BUFFER_POOL_H
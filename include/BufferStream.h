@@ -0,0 +1,93 @@
+#ifndef BUFFER_STREAM_H
+#define BUFFER_STREAM_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief A write-only Stream collecting the data in a fixed-size buffer, e.g. to capture
+ *  what an action writes. The data exceeding the buffer is dropped and flagged
+ */
+class BufferStream : public Stream
+{
+public:
+  BufferStream() = delete;
+  /**
+   * @brief Construct a new Buffer Stream
+   *
+   * @param buffer The buffer collecting the data
+   * @param size The buffer size
+   */
+  BufferStream(char *buffer, size_t size) : buffer(buffer), size(size) {}
+
+  using Stream::write;
+  size_t write(uint8_t c) override
+  {
+    return write(&c, 1);
+  }
+  size_t write(const uint8_t *data, size_t len) override
+  {
+    if (len > size - length)
+    {
+      len = size - length;
+      overflow = true;
+    }
+    memcpy(buffer + length, data, len);
+    length += len;
+    return len;
+  }
+  /**
+   * @brief The room left in the buffer
+   */
+  int availableForWrite() override
+  {
+    return size - length;
+  }
+  int available() override
+  {
+    return 0;
+  }
+  int read() override
+  {
+    return -1;
+  }
+  int peek() override
+  {
+    return -1;
+  }
+  /**
+   * @brief Discards the data collected so far
+   */
+  void clear()
+  {
+    length = 0;
+    overflow = false;
+  }
+  const char *data() const
+  {
+    return buffer;
+  }
+  size_t getLength() const
+  {
+    return length;
+  }
+  /**
+   * @brief Whether some data has been dropped because the buffer was full
+   */
+  bool hasOverflown() const
+  {
+    return overflow;
+  }
+
+private:
+  char *buffer;
+  size_t size;
+  size_t length = 0;
+  bool overflow = false;
+};
+
+#endif // BUFFER_STREAM_H
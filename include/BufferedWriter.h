@@ -0,0 +1,133 @@
+#ifndef BUFFERED_WRITER_H
+#define BUFFERED_WRITER_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+enum FLUSH_POLICY
+{
+  /** @brief The data is sent when the buffer is full, when flush() is called and on destruction */
+  FLUSH_WHEN_FULL,
+  /** @brief Every write is sent straight away, as if there was no buffer */
+  FLUSH_EACH_WRITE
+};
+
+/**
+ * @brief A Stream collecting the writes in a buffer and sending them to the underlying stream
+ *  in a single write, so that a whole response goes out as one TLS record instead of one record
+ *  per field. Writes larger than the buffer are sent straight through, after the buffered data.
+ *  Reads are forwarded to the underlying stream
+ */
+class BufferedWriter : public Stream
+{
+public:
+  BufferedWriter() = delete;
+  BufferedWriter(const BufferedWriter &) = delete;
+  /**
+   * @brief Construct a new Buffered Writer
+   *
+   * @param output The stream the data is sent to
+   * @param buffer The buffer collecting the data
+   * @param size The buffer size
+   * @param policy When the buffered data is sent
+   */
+  BufferedWriter(Stream &output, char *buffer, size_t size, FLUSH_POLICY policy = FLUSH_WHEN_FULL)
+      : output(output), buffer(buffer), size(size), policy(policy) {}
+  ~BufferedWriter()
+  {
+    flush();
+  }
+
+  using Stream::write;
+  size_t write(uint8_t c) override
+  {
+    return write(&c, 1);
+  }
+  size_t write(const uint8_t *data, size_t len) override
+  {
+    if (policy == FLUSH_EACH_WRITE)
+    {
+      return output.write(data, len);
+    }
+    if (len > size - length)
+    {
+      flush();
+      if (len >= size)
+      {
+        return output.write(data, len);
+      }
+    }
+    memcpy(buffer + length, data, len);
+    length += len;
+    return len;
+  }
+  /**
+   * @brief Sends the buffered data to the underlying stream in a single write
+   */
+  void flush() override
+  {
+    if (length > 0)
+    {
+      output.write(reinterpret_cast<const uint8_t *>(buffer), length);
+      length = 0;
+    }
+  }
+  /**
+   * @brief The bytes that can be written without waiting: the room left in the buffer, or what
+   *  the underlying stream can take once the buffered data is sent, if it tells
+   */
+  int availableForWrite() override
+  {
+    int window = output.availableForWrite();
+    if (policy == FLUSH_EACH_WRITE)
+    {
+      return window;
+    }
+    int room = size - length;
+    return window - (int)length > room ? window - (int)length : room;
+  }
+  int available() override
+  {
+    return output.available();
+  }
+  int read() override
+  {
+    return output.read();
+  }
+  int peek() override
+  {
+    return output.peek();
+  }
+  using Stream::readBytes;
+  size_t readBytes(char *data, size_t len) override
+  {
+    return output.readBytes(data, len);
+  }
+  /**
+   * @brief Drops the data waiting to be sent, e.g. when the client is gone
+   */
+  void discard()
+  {
+    length = 0;
+  }
+  /**
+   * @brief The number of bytes waiting to be sent
+   */
+  size_t getBuffered() const
+  {
+    return length;
+  }
+
+private:
+  Stream &output;
+  char *buffer;
+  size_t size;
+  size_t length = 0;
+  FLUSH_POLICY policy;
+};
+
+#endif // BUFFERED_WRITER_H
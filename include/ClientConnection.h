@@ -0,0 +1,150 @@
+#ifndef CLIENT_CONNECTION_H
+#define CLIENT_CONNECTION_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <stdint.h>
+#include <utility>
+#include "SerialFrame.h"
+#include "BufferPool.h"
+#include "SerialMapView.h"
+#include "Common.h"
+
+enum CONNECTION_STATE
+{
+  CONNECTION_CLOSED,
+  CONNECTION_AUTHENTICATING,
+  CONNECTION_READING_ACTION,
+  CONNECTION_IDLE
+};
+
+/**
+ * @brief A client connection whose frames are received without ever blocking, so that
+ *  a server can advance several of them in the same loop. Each connection goes through
+ *  authentication, reading the action and closing, the state tells which frame is expected.
+ *  A persistent connection goes back to idle after each action, awaiting the next one.
+ *  The frames are received into a buffer drawn from a BufferPool while the connection is open
+ *
+ * @tparam Client The client socket type
+ */
+template <class Client>
+class ClientConnection
+{
+public:
+  ClientConnection() = default;
+  ClientConnection(const ClientConnection &) = delete;
+  /**
+   * @brief Takes over an accepted client, expecting its authentication frame
+   *
+   * @param client The client
+   * @param receive The buffer the frames are received into, held until the connection is closed
+   */
+  void open(const Client &client, PoolBuffer receive)
+  {
+    this->client = client;
+    buffer = std::move(receive);
+    parser = SerialFrameParser(buffer.data(), buffer.size());
+    setState(CONNECTION_AUTHENTICATING);
+  }
+  bool isOpen() const
+  {
+    return state != CONNECTION_CLOSED;
+  }
+  CONNECTION_STATE getState() const
+  {
+    return state;
+  }
+  /**
+   * @brief Moves to the given state, discarding the current frame and restarting the timeout
+   *
+   * @param newState The new state
+   */
+  void setState(CONNECTION_STATE newState)
+  {
+    state = newState;
+    parser.reset();
+    since = millis();
+    receiving = 0;
+  }
+  /**
+   * @brief Reads the bytes already available from the client, without waiting for more and
+   *  without reading past the end of the frame
+   *
+   * @return PARSE_RESULT Whether the frame is complete, malformed or still incomplete
+   */
+  PARSE_RESULT receive()
+  {
+    unsigned long start = micros();
+    while (parser.getResult() == PARSE_NEED_MORE)
+    {
+      int available = client.available();
+      if (available <= 0)
+      {
+        break;
+      }
+      size_t n = parser.needed();
+      if (n > (size_t)available)
+      {
+        n = available;
+      }
+      int read = client.read(reinterpret_cast<uint8_t *>(parser.tail()), n);
+      if (read <= 0)
+      {
+        break;
+      }
+      parser.advance(read);
+    }
+    receiving += micros() - start;
+    return parser.getResult();
+  }
+  /**
+   * @brief The microseconds spent in receive() for the current frame
+   */
+  unsigned long getReceiveTime() const
+  {
+    return receiving;
+  }
+  /**
+   * @brief Whether the current state has lasted longer than the given timeout
+   */
+  bool timedOut(unsigned long timeout) const
+  {
+    return millis() - since >= timeout;
+  }
+  /**
+   * @brief Whether the client is still connected or has data left to read
+   */
+  bool isConnected()
+  {
+    return client.connected() || client.available() > 0;
+  }
+  /**
+   * @brief A view over the frame received, valid until the state changes
+   */
+  ActionView frame() const
+  {
+    return ActionView(parser.data(), parser.getLength());
+  }
+  Client &getClient()
+  {
+    return client;
+  }
+  void close()
+  {
+    client.stop();
+    buffer.release();
+    state = CONNECTION_CLOSED;
+  }
+
+private:
+  Client client;
+  CONNECTION_STATE state = CONNECTION_CLOSED;
+  unsigned long since = 0;
+  unsigned long receiving = 0;
+  PoolBuffer buffer;
+  SerialFrameParser parser{nullptr, 0};
+};
+
+#endif // CLIENT_CONNECTION_H
@@ -1,97 +1,144 @@
 #ifndef COMMAND_SERVER_H
 #define COMMAND_SERVER_H
 
+#ifndef _TEST_ENV
 #include <Arduino.h>
-#include <ESP8266WiFi.h>
-#include <WiFiUdp.h>
+#endif
+
 #include <functional>
 #include "Optional.h"
-#include "Configuration.h"
+#include "InplaceFunction.h"
 #include "StateManager.h"
 #include "AuthenticationHandler.h"
 #include "ActionParser.h"
 #include "SerialMap.h"
+#include "ClientConnection.h"
 #include "Common.h"
 #include "Response.h"
+#include "Transport.h"
+#include "DiscoveryResponder.h"
+#include "LatencyHistogram.h"
+#include "BufferedWriter.h"
+#include "BufferPool.h"
+#include "MemoryStats.h"
 #include "RemoteControlSettings.h"
 #include "Logging.h"
 
 /**
- * @brief The main command-receiving server
+ * @brief The main command-receiving server. Clients are served by an event loop, where each
+ *  connection advances through authentication, reading the action, dispatching it and closing
+ *  as soon as its data is available, so that a slow client never holds back the other ones.
+ *  When KEEP_ALIVE_MS is set, an authenticated client can keep sending actions on the same
+ *  connection by adding `"connection": "keep-alive"` to each of them.
+ *  The time spent in each phase of a request and in each action is kept in latency histograms,
+ *  which the reserved `__stats` action sends back when STATS_ACTION_ENABLED is set, and the heap
+ *  is sampled around each request into the MemoryStats, sent back by the reserved `__memory`
+ *  action when MEMORY_ACTION_ENABLED is set.
+ *  Every response is collected in a buffer and sent with a single write, i.e. a single TLS record.
+ *  When INLINE_AUTH_ENABLED is set, the first frame can also be an action carrying its own
+ *  credentials, which is authenticated and dispatched in a single round trip.
+ *  The sockets, the TLS and the UDP are left to the transport (see Transport.h), so that
+ *  the same server runs on the device and on a Linux host. The clients find the server through
+ *  the DiscoveryResponder, which answers their probes and sends backed off beacons.
+ *  An asynchronous action (see Async.h) waiting for a timer or a condition holds its connection
+ *  only: the other clients, the broadcasts and the loop callback are served in the meantime, and
+ *  its response is sent once it is done. An upload action (see Upload.h) holds its connection
+ *  likewise while its payload is handed to the UploadHandler, a chunk at a time.
+ *  The buffers of the connections and the response buffer are drawn from a BufferPool while in
+ *  use, so that their memory is shared with the AP server: a client is left in the backlog
+ *  while the pool has no room for its buffer
  * 
  * @tparam N The maximum number of actions accepted
+ * @tparam C The maximum number of clients served concurrently
+ * @tparam T The transport, the WiFi one on the device
  */
-template <int N>
+template <int N, int C = 1, class T = DefaultTransport>
 class CommandServer
 {
 public:
-  CommandServer(StateManager &stateManager, CommandServerSettings settings) : stateManager(stateManager), settings(settings), authHandler(settings.AUTH_USERNAME, settings.AUTH_PASSWORD, settings.TIMEOUT_MS),
-                                                                              serverCert(settings.CERTIFICATE), privateKey(settings.PRIVATE_KEY) {}
+  /** @brief The size of the buffer collecting each response, also receiving the upload chunks */
+  static constexpr size_t OUT_BUFFER_SIZE = 512;
+  /** @brief The size of the buffer collecting the response of an asynchronous action */
+  static constexpr size_t ASYNC_BUFFER_SIZE = 128;
+
+  static_assert(BufferPool::BUDGET >= OUT_BUFFER_SIZE + SerialFrame::BUFFER_SIZE, "BUFFER_POOL_SIZE can't serve a single client");
+
+  /**
+   * @brief Construct a new Command Server
+   *
+   * @param pool The pool the buffers of the connections are drawn from, which has to outlive the server
+   */
+  CommandServer(StateManager &stateManager, CommandServerSettings settings, BufferPool &pool)
+      : stateManager(stateManager), settings(settings), authHandler(settings.AUTH_USERNAME, settings.AUTH_PASSWORD, settings.TIMEOUT_MS),
+        transport(settings), pool(pool)
+  {
+    actionParser.usePool(pool);
+  }
   /**
    * @brief Start the server
    */
   void startServer()
   {
-    BearSSL::WiFiServerSecure server(settings.PORT);
-
-    server.setRSACert(&serverCert, &privateKey);
-
-    server.begin();
-    udp.begin(settings.UDP_RATE_MS);
+    if (settings.SESSION_TOKEN_LIFETIME_MS > 0)
+    {
+      authHandler.enableSessionTokens(settings.SESSION_TOKEN_LIFETIME_MS);
+    }
 
-    broadcastIp = WiFi.localIP();
-    broadcastIp[3] = 255;
+    actionParser.freeze();
+    outBuffer = pool.acquire(OUT_BUFFER_SIZE);
+    if (!outBuffer || !transport.begin())
+    {
+      Log::println("Error starting the server");
+      outBuffer.release();
+      return;
+    }
+    discovery.begin(transport.getBroadcastIP(), millis());
 
     while (serverRunning)
     {
-      auto client = server.available();
-
-      if (client)
+      // Pending clients wait in the backlog until a connection slot and its buffer are free
+      Connection *connection = freeConnection();
+      if (connection != nullptr && pool.fits(SerialFrame::BUFFER_SIZE))
       {
-        Log::printfln("Connection received from %s", client.remoteIP().toString().c_str());
+        // The TLS handshake takes place while accepting the client
+        unsigned long start = micros();
+        Client client;
 
-        if (callbacks.onNewConnection.hasValue())
+        if (transport.accept(client))
         {
-          callbacks.onNewConnection.get()(client.remoteIP().toString(), client.remotePort());
-        }
-
-        if (authHandler.authenticate(client))
-        {
-          Log::println("Authentication OK");
-          ActionMap action = ActionMap::fromStream(client, settings.TIMEOUT_MS);
-
-          if (actionParser.execute(action, client))
-          {
-            stateManager.setState(AP_MODE);
-            serverRunning = false;
-
-            if (callbacks.onServerTermination.hasValue())
-            {
-              callbacks.onServerTermination.get()();
-            }
-          }
-        }
-        else
-        {
-          Log::println("Authentication failed");
-        }
-
-        if (callbacks.onConnectionClose.hasValue())
-        {
-          callbacks.onConnectionClose.get()();
+          phases[PHASE_HANDSHAKE].record(micros() - start);
+          accept(*connection, client, pool.acquire(SerialFrame::BUFFER_SIZE));
         }
+      }
 
-        client.stop();
+      bool busy = false;
+      for (int i = 0; i < C && serverRunning; i++)
+      {
+        busy |= serve(connections[i], tasks[i]);
       }
 
       if (callbacks.onServerLoop.hasValue())
       {
         callbacks.onServerLoop.get()();
       }
-      udpBroadcast();
-      delay(20);
+      discovery.poll(millis());
+      transport.idle(busy);
     }
-    server.stop();
+
+    for (int i = 0; i < C; i++)
+    {
+      if (tasks[i].task.isRunning())
+      {
+        cancel(tasks[i]);
+      }
+      tasks[i].upload.cancel();
+      if (connections[i].isOpen())
+      {
+        close(connections[i]);
+      }
+    }
+    transport.stop();
+    outBuffer.release();
   }
   /**
    * @brief Register an action into the server. In other words when the action `name` is sent, the `action`
@@ -101,16 +148,49 @@ public:
    * @param name The action name
    * @param callback The action callback
    */
-  void registerAction(const String &name, std::function<bool(ActionMap &, Stream &)> callback)
+  void registerAction(const String &name, typename ActionParser<N>::Callback callback)
   {
     actionParser.with(name, callback);
   }
+  /**
+   * @brief Register an action whose callback reads the request through an `ActionView`, i.e. straight
+   *  from the received frame without allocating any String
+   * 
+   * @param name The action name
+   * @param callback The action callback
+   */
+  void registerAction(const String &name, typename ActionParser<N>::ViewCallback callback)
+  {
+    actionParser.with(name, callback);
+  }
+  /**
+   * @brief Register an asynchronous action, which can wait for timers and conditions through
+   *  ASYNC_SLEEP and ASYNC_UNTIL while the server goes on serving the other clients
+   * 
+   * @param name The action name
+   * @param callback The action callback
+   */
+  void registerAction(const String &name, typename ActionParser<N>::AsyncCallback callback)
+  {
+    actionParser.with(name, callback);
+  }
+  /**
+   * @brief Register an upload action, whose payload follows the action frame and is handed to
+   *  the handler as it arrives
+   * 
+   * @param name The action name
+   * @param handler The handler, which has to outlive the server
+   */
+  void registerAction(const String &name, UploadHandler &handler)
+  {
+    actionParser.with(name, handler);
+  }
   /**
    * @brief Set a callback to be executed when a new connection is accepted
    * 
    * @param callback The callback, to which will be passed the client IP address and port
    */
-  void setOnNewConnectionCallback(std::function<void(const String &, int)> callback)
+  void setOnNewConnectionCallback(InplaceFunction<void(const String &, int)> callback)
   {
     callbacks.onNewConnection = callback;
   }
@@ -119,7 +199,7 @@ public:
    * 
    * @param callback The callback
    */
-  void setOnConnectionCloseCallback(std::function<void(void)> callback)
+  void setOnConnectionCloseCallback(InplaceFunction<void(void)> callback)
   {
     callbacks.onConnectionClose = callback;
   }
@@ -129,7 +209,7 @@ public:
    * 
    * @param callback The callback
    */
-  void setOnServerLoopCallback(std::function<void(void)> callback)
+  void setOnServerLoopCallback(InplaceFunction<void(void)> callback)
   {
     callbacks.onServerLoop = callback;
   }
@@ -138,44 +218,463 @@ public:
    * 
    * @param callback The callback
    */
-  void setOnServerTerminationCallback(std::function<void(void)> callback)
+  void setOnServerTerminationCallback(InplaceFunction<void(void)> callback)
   {
     callbacks.onServerTermination = callback;
   }
+  /**
+   * @brief Keeps the nonces of the HMAC frames from being replayed after a reboot, by persisting
+   *  a floor below which they are refused (see FrameAuthenticator::persistNonces)
+   *
+   * @param floor The floor persisted before the reboot
+   * @param persist The callback persisting a new floor
+   */
+  void persistNonces(uint32_t floor, InplaceFunction<bool(uint32_t)> persist)
+  {
+    authHandler.persistNonces(floor, persist);
+  }
+  /**
+   * @brief The name of the reserved action sending the latency histograms back
+   */
+  static constexpr const char *STATS_ACTION = "__stats";
+  /**
+   * @brief The name of the reserved action sending the memory stats back
+   */
+  static constexpr const char *MEMORY_ACTION = "__memory";
+  /**
+   * @brief The memory stats, e.g. to register the footprint of the components or an allocation counter
+   */
+  MemoryStats &getMemoryStats()
+  {
+    return memory;
+  }
+  /**
+   * @brief The pool the buffers are drawn from, e.g. to size BUFFER_POOL_SIZE from its high water mark
+   */
+  const BufferPool &getPool() const
+  {
+    return pool;
+  }
+  /**
+   * @brief The transport, e.g. to find out the port picked by the PosixTransport
+   */
+  T &getTransport()
+  {
+    return transport;
+  }
+  DiscoveryResponder<typename T::Udp> &getDiscovery()
+  {
+    return discovery;
+  }
 
 private:
   struct CALLBACKS
   {
-    Optional<std::function<void(const String &, int)>> onNewConnection;
-    Optional<std::function<void(void)>> onConnectionClose;
-    Optional<std::function<void(void)>> onServerLoop;
-    Optional<std::function<void(void)>> onServerTermination;
+    Optional<InplaceFunction<void(const String &, int)>> onNewConnection;
+    Optional<InplaceFunction<void(void)>> onConnectionClose;
+    Optional<InplaceFunction<void(void)>> onServerLoop;
+    Optional<InplaceFunction<void(void)>> onServerTermination;
+  };
+
+  typedef typename T::Client Client;
+  typedef ClientConnection<Client> Connection;
+
+  enum DISPATCH_RESULT
+  {
+    DISPATCH_CLOSE,
+    DISPATCH_KEEP_ALIVE,
+    /** @brief An asynchronous action is running, the connection waits for it */
+    DISPATCH_PENDING
+  };
+
+  /**
+   * @brief The asynchronous action or the upload running for a connection. The action has its
+   *  own response buffer, drawn from the pool while it runs, as the shared one is reused by the
+   *  other connections in the meantime, while the upload reads its chunks into the shared one
+   */
+  struct PendingTask
+  {
+    AsyncTask task;
+    UploadTask upload;
+    Optional<BufferedWriter> output;
+    bool keepAlive = false;
+    PoolBuffer buffer;
+  };
+
+  enum PHASE
+  {
+    PHASE_HANDSHAKE,
+    PHASE_AUTHENTICATION,
+    PHASE_RECEIVE,
+    PHASE_EXECUTE,
+    PHASE_WRITE,
+    PHASE_COUNT
   };
 
   StateManager &stateManager;
   CommandServerSettings settings;
   AuthenticationHandler authHandler;
   ActionParser<N> actionParser;
-  BearSSL::X509List serverCert;
-  BearSSL::PrivateKey privateKey;
+  T transport;
+  BufferPool &pool;
+  DiscoveryResponder<typename T::Udp> discovery{transport.getUdp(), settings};
   CALLBACKS callbacks = {{}, {}, {}};
+  Connection connections[C];
+  PendingTask tasks[C];
+  LatencyHistogram phases[PHASE_COUNT];
+  MemoryStats memory;
+
+  Connection *freeConnection()
+  {
+    for (int i = 0; i < C; i++)
+    {
+      if (!connections[i].isOpen())
+      {
+        return &connections[i];
+      }
+    }
+    return nullptr;
+  }
+
+  void accept(Connection &connection, Client &client, PoolBuffer receive)
+  {
+    Log::printfln("Connection received from %s", client.remoteIP().toString().c_str());
+
+    if (callbacks.onNewConnection.hasValue())
+    {
+      callbacks.onNewConnection.get()(client.remoteIP().toString(), client.remotePort());
+    }
+
+    connection.open(client, std::move(receive));
+  }
+
+  /**
+   * @brief Advances the given connection as far as the data received so far allows
+   * 
+   * @return true If the connection is open
+   * @return false If the connection slot is free
+   */
+  bool serve(Connection &connection, PendingTask &pending)
+  {
+    if (!connection.isOpen())
+    {
+      return false;
+    }
+    if (pending.task.isRunning())
+    {
+      // The frame is left in the connection buffer until the action is done
+      return resume(connection, pending);
+    }
+    if (pending.upload.isRunning())
+    {
+      return upload(connection, pending);
+    }
+
+    PARSE_RESULT received = connection.receive();
 
-  void udpBroadcast()
+    if (received == PARSE_COMPLETE)
+    {
+      ActionView frame = connection.frame();
+      phases[PHASE_RECEIVE].record(connection.getReceiveTime());
+
+      if (connection.getState() == CONNECTION_AUTHENTICATING && settings.INLINE_AUTH_ENABLED && frame.has("action"))
+      {
+        unsigned long start = micros();
+        bool authorized = authHandler.authorize(frame);
+        phases[PHASE_AUTHENTICATION].record(micros() - start);
+
+        if (!authorized)
+        {
+          Log::println("Authentication failed");
+          BufferedWriter output(connection.getClient(), outBuffer.data(), outBuffer.size());
+          Response::errorResponse().write(output);
+          output.flush();
+        }
+        else
+        {
+          return settle(connection, dispatch(frame, connection.getClient(), pending));
+        }
+      }
+      else if (connection.getState() == CONNECTION_AUTHENTICATING)
+      {
+        unsigned long start = micros();
+        BufferedWriter output(connection.getClient(), outBuffer.data(), outBuffer.size());
+        bool authenticated = authHandler.authenticate(frame, output);
+        output.flush();
+        phases[PHASE_AUTHENTICATION].record(micros() - start);
+
+        if (authenticated)
+        {
+          Log::println("Authentication OK");
+          connection.setState(CONNECTION_READING_ACTION);
+          return true;
+        }
+        Log::println("Authentication failed");
+      }
+      else
+      {
+        return settle(connection, dispatch(frame, connection.getClient(), pending));
+      }
+      close(connection);
+    }
+    else if (received == PARSE_ERROR)
+    {
+      Log::println("Malformed or too large frame");
+      BufferedWriter output(connection.getClient(), outBuffer.data(), outBuffer.size());
+      Response::errorResponse().write(output);
+      output.flush();
+      close(connection);
+    }
+    else if (connection.timedOut(connection.getState() == CONNECTION_IDLE ? settings.KEEP_ALIVE_MS : settings.TIMEOUT_MS))
+    {
+      if (connection.getState() == CONNECTION_AUTHENTICATING)
+      {
+        // An empty frame fails the authentication and sends the error back
+        BufferedWriter output(connection.getClient(), outBuffer.data(), outBuffer.size());
+        authHandler.authenticate(ActionView(), output);
+        output.flush();
+        Log::println("Authentication failed");
+      }
+      close(connection);
+    }
+    else if (!connection.isConnected())
+    {
+      close(connection);
+    }
+    return true;
+  }
+
+  /**
+   * @brief Moves the connection on after dispatching an action
+   * 
+   * @return true As the connection is left open, or closed by the server right now
+   */
+  bool settle(Connection &connection, DISPATCH_RESULT result)
   {
-    if (lastUdpBroadcast == 0 || millis() > lastUdpBroadcast + settings.UDP_RATE_MS)
+    if (result == DISPATCH_KEEP_ALIVE)
+    {
+      connection.setState(CONNECTION_IDLE);
+    }
+    else if (result == DISPATCH_CLOSE)
     {
-      udp.beginPacket(broadcastIp, settings.UDP_PORT);
-      udp.write(settings.UDP_PACKET, settings.UDP_PACKET_SIZE);
-      udp.endPacket();
-      lastUdpBroadcast = millis();
+      close(connection);
     }
+    return true;
+  }
+
+  /**
+   * @brief Runs the asynchronous action of the connection until its next wait, sending its
+   *  response once it is done
+   */
+  bool resume(Connection &connection, PendingTask &pending)
+  {
+    if (!connection.isConnected())
+    {
+      Log::println("Client gone during an asynchronous action");
+      cancel(pending);
+      close(connection);
+      return true;
+    }
+    if (!pending.task.poll())
+    {
+      return true;
+    }
+
+    unsigned long start = micros();
+    pending.output.get().flush();
+    phases[PHASE_WRITE].record(micros() - start);
+    pending.output.reset();
+    pending.buffer.release();
+    return settle(connection, complete(pending.task.getResult(), pending.keepAlive));
+  }
+
+  /**
+   * @brief Hands the payload received so far to the upload of the connection, committing it
+   *  once complete
+   */
+  bool upload(Connection &connection, PendingTask &pending)
+  {
+    UPLOAD_RESULT result = pending.upload.poll(connection.getClient(), reinterpret_cast<uint8_t *>(outBuffer.data()), outBuffer.size());
+    if (result == UPLOAD_NEED_MORE)
+    {
+      if (!connection.isConnected() || pending.upload.timedOut(settings.TIMEOUT_MS))
+      {
+        Log::println("Upload interrupted");
+        pending.upload.cancel();
+        close(connection);
+      }
+      return true;
+    }
+
+    BufferedWriter output(connection.getClient(), outBuffer.data(), outBuffer.size());
+    if (result == UPLOAD_FAILED)
+    {
+      // Part of the payload may be left unread, the connection can't be kept
+      Log::println("Upload failed");
+      Response::errorResponse().write(output);
+      output.flush();
+      close(connection);
+      return true;
+    }
+
+    unsigned long start = micros();
+    bool terminate = pending.upload.commit(output);
+    phases[PHASE_EXECUTE].record(micros() - start);
+    output.flush();
+    return settle(connection, complete(terminate, pending.keepAlive));
+  }
+
+  void cancel(PendingTask &pending)
+  {
+    pending.task.cancel();
+    if (pending.output.hasValue())
+    {
+      pending.output.get().discard();
+      pending.output.reset();
+    }
+    pending.buffer.release();
+  }
+
+  /**
+   * @brief Executes the action, or starts it if asynchronous, recording the heap it took
+   */
+  DISPATCH_RESULT dispatch(ActionView &action, Stream &client, PendingTask &pending)
+  {
+    MemoryStats::Sample before = memory.sample();
+    DISPATCH_RESULT result = route(action, client, pending);
+    memory.record(before);
+    return result;
+  }
+
+  DISPATCH_RESULT route(ActionView &action, Stream &client, PendingTask &pending)
+  {
+    const SerialSlice *connection = action.get("connection");
+    bool keepAlive = settings.KEEP_ALIVE_MS > 0 && connection != nullptr && *connection == "keep-alive";
+
+    // The response is sent as a whole once the action is done, the time spent sending it
+    // is told apart from the action itself
+    TimedStream timed(client);
+    BufferedWriter output(timed, outBuffer.data(), outBuffer.size());
+
+    const SerialSlice *name = action.get("action");
+    if (settings.STATS_ACTION_ENABLED && name != nullptr && *name == STATS_ACTION)
+    {
+      writeStats(action, output);
+      output.flush();
+      return keepAlive ? DISPATCH_KEEP_ALIVE : DISPATCH_CLOSE;
+    }
+    if (settings.MEMORY_ACTION_ENABLED && name != nullptr && *name == MEMORY_ACTION)
+    {
+      memory.write(output);
+      output.flush();
+      const SerialSlice *reset = action.get("reset");
+      if (reset != nullptr && *reset == "true")
+      {
+        memory.clear();
+      }
+      return keepAlive ? DISPATCH_KEEP_ALIVE : DISPATCH_CLOSE;
+    }
+
+    if (actionParser.startUpload(action, pending.upload))
+    {
+      if (pending.upload.isRunning())
+      {
+        pending.keepAlive = keepAlive;
+        return DISPATCH_PENDING;
+      }
+      // The payload is left unread, the connection can't be kept
+      Response::errorResponse().write(output);
+      output.flush();
+      return DISPATCH_CLOSE;
+    }
+
+    if (actionParser.isAsync(action))
+    {
+      // Without a buffer left in the pool, the response of an asynchronous action is written
+      // straight to the client
+      pending.buffer = pool.acquire(ASYNC_BUFFER_SIZE);
+      BufferedWriter &asyncOutput = pending.output.emplace(client, pending.buffer.data(), pending.buffer.size(),
+                                                           pending.buffer ? FLUSH_WHEN_FULL : FLUSH_EACH_WRITE);
+      actionParser.startAsync(action, asyncOutput, pending.task);
+      pending.keepAlive = keepAlive;
+      return DISPATCH_PENDING;
+    }
+
+    unsigned long start = micros();
+    bool terminate = actionParser.execute(action, output);
+    output.flush();
+    unsigned long elapsed = micros() - start;
+    phases[PHASE_EXECUTE].record(elapsed - timed.getElapsed());
+    phases[PHASE_WRITE].record(timed.getElapsed());
+    return complete(terminate, keepAlive);
+  }
+
+  /**
+   * @brief Terminates the server if the action asked to
+   */
+  DISPATCH_RESULT complete(bool terminate, bool keepAlive)
+  {
+    if (terminate)
+    {
+      stateManager.setState(AP_MODE);
+      serverRunning = false;
+
+      if (callbacks.onServerTermination.hasValue())
+      {
+        callbacks.onServerTermination.get()();
+      }
+      return DISPATCH_CLOSE;
+    }
+    return keepAlive ? DISPATCH_KEEP_ALIVE : DISPATCH_CLOSE;
+  }
+
+  /**
+   * @brief Writes the latency histograms as a map from the phase or `action.<name>` to the
+   *  summary `count,mean,p50,p90,p99,max` in microseconds, along with the `pool` usage as
+   *  `used,high water,budget,failures` in bytes. The histograms are cleared afterwards if the
+   *  action has `"reset": "true"`
+   */
+  void writeStats(ActionView &action, Stream &client)
+  {
+    static const char *const names[PHASE_COUNT] = {"handshake", "authentication", "receive", "execute", "write"};
+
+    // The summaries are written as they are made, rather than collected in a map first
+    SerialFrameWriter stats(client);
+    for (int i = 0; i < PHASE_COUNT; i++)
+    {
+      stats.put(names[i], phases[i].toString());
+    }
+    actionParser.forEachLatency([&stats](const String &name, const LatencyHistogram &latency)
+                                { stats.put((String("action.") + name).c_str(), latency.toString()); });
+    char usage[48];
+    pool.summary(usage, sizeof(usage));
+    stats.put("pool", usage);
+    stats.end();
+
+    const SerialSlice *reset = action.get("reset");
+    if (reset != nullptr && *reset == "true")
+    {
+      for (int i = 0; i < PHASE_COUNT; i++)
+      {
+        phases[i].clear();
+      }
+      actionParser.clearLatencies();
+    }
+  }
+
+  void close(Connection &connection)
+  {
+    if (callbacks.onConnectionClose.hasValue())
+    {
+      callbacks.onConnectionClose.get()();
+    }
+
+    connection.close();
   }
 
-  unsigned long lastUdpBroadcast = 0;
-  WiFiUDP udp;
-  IPAddress broadcastIp;
   bool serverRunning = true;
-  char outBuffer[512] = {};
+  // Collects each response before sending it, the connections are served one at a time
+  PoolBuffer outBuffer;
 };
 
 #endif
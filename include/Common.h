@@ -1,8 +1,12 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include "HashIndex.h"
+#include "SerialMapView.h"
+
 #define CALLBACK(class, method) std::bind(&class ::method, this, std::placeholders::_1, std::placeholders::_2)
-typedef SerialMap<String, 10> ActionMap;
+typedef SerialMap<String, 10, HashMap<String, String, 10>> ActionMap;
 typedef SerialMap<String, 1> ResponseMap;
+typedef SerialMapView<10> ActionView;
 
 #endif
\ No newline at end of file
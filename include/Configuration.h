@@ -3,20 +3,26 @@
 
 #include <Arduino.h>
 #include <EEPROM.h>
+#include "SettingsStore.h"
+#include "WifiConnector.h"
 
-// We read and write the whole configuration data at once, to avoid 
-// reducing the read/write cycles
-// Structure:
-// <BSSID:fixed char[256]><PASS:fixed char[256]><CHECKSUM: uint16_t>
-// char[256] are null terminated, so the max string length is 255
-// the 16-bit checksum is a very tiny layer of validation, should be improved
-// using better methods
+// The configuration is kept in a SettingsStore, a log of key/value records
+// with a CRC32 each, which the WiFi credentials share with the application
+// settings. The updates are appended to the log and written to flash by
+// a single commit
 
 // The EEPROM size (it's emulated so we define here how much Flash memory
 // we reserve for permanent storage)
-#define EEPROM_TOTAL_SIZE 514
-// The max string length
-#define EEPROM_STR_SIZE 256
+#define EEPROM_TOTAL_SIZE 1024
+// The maximum number of settings, the WiFi credentials included
+#define SETTINGS_MAX_KEYS 16
+
+// The layout written by the previous versions, migrated on the first boot:
+// <BSSID:fixed char[256]><PASS:fixed char[256]><CHECKSUM: uint16_t>
+#define LEGACY_TOTAL_SIZE 514
+#define LEGACY_STR_SIZE 256
+
+typedef SettingsStore<EEPROMClass, SETTINGS_MAX_KEYS> Settings;
 
 class Configuration
 {
@@ -27,10 +33,35 @@ public:
   bool isValid() const;
   bool updateConfig(String WLAN_BSSID, String PASS);
   void reload();
+  /**
+   * @brief Gets the channel and access point of the last successful connection
+   *
+   * @return false If no connection succeeded since the credentials were updated
+   */
+  bool getWifiHint(WifiHint &hint) const;
+  /**
+   * @brief Saves the channel and access point of a successful connection, writing nothing
+   *  if they didn't change
+   */
+  bool updateWifiHint(const WifiHint &hint);
+  /**
+   * @brief Gets the floor of the nonces of the HMAC frames, 0 if none was saved
+   */
+  uint32_t getNonceFloor() const;
+  /**
+   * @brief Saves the floor of the nonces of the HMAC frames, so that a reboot doesn't let
+   *  the frames already accepted be replayed
+   */
+  bool updateNonceFloor(uint32_t floor);
+  /**
+   * @brief The settings store, which the application can use for its own settings.
+   *  The "wifi." and "auth." keys are reserved
+   */
+  Settings &getSettings();
 private:
-  String WLAN_BSSID, PASS;
+  Settings settings;
   bool valid = false;
-  bool writeStringToEEPROM(String str, size_t baseAddr);
+  bool migrateLegacy();
 };
 
 #endif
@@ -0,0 +1,28 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief CRC-32 (IEEE 802.3), computed bitwise to spare the 1KB table
+ *
+ * @param data The data
+ * @param len The data length
+ * @param crc The CRC of the data preceding this one, to compute it in parts
+ */
+inline uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc = 0)
+{
+  crc = ~crc;
+  while (len--)
+  {
+    crc ^= *data++;
+    for (int i = 0; i < 8; i++)
+    {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+#endif // CRC32_H
@@ -0,0 +1,151 @@
+#ifndef DISCOVERY_RESPONDER_H
+#define DISCOVERY_RESPONDER_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include "RemoteControlSettings.h"
+
+/**
+ * @brief Lets the clients find the server on the local network. A client sending the probe
+ *  datagram to the discovery port, either to the device or as a broadcast, is answered
+ *  straight away with the server packet. The server also broadcasts the packet as a beacon,
+ *  for the clients that only listen: the interval between the beacons doubles from
+ *  UDP_RATE_MS up to UDP_RATE_MAX_MS while nobody probes, and goes back to UDP_RATE_MS
+ *  after a probe, so that an idle server stays quiet on a busy network
+ *
+ * @tparam U The UDP socket, such as WiFiUDP, already bound to the discovery port
+ */
+template <class U>
+class DiscoveryResponder
+{
+public:
+  /** @brief The longest probe */
+  static constexpr size_t MAX_PROBE_SIZE = 32;
+  /** @brief The datagrams read at every poll, so that a flood of them can't stall the server */
+  static constexpr int MAX_DATAGRAMS_PER_POLL = 4;
+
+  DiscoveryResponder() = delete;
+  DiscoveryResponder(const DiscoveryResponder &) = delete;
+  /**
+   * @brief Construct a new Discovery Responder
+   *
+   * @param udp The UDP socket, which has to outlive the responder
+   * @param settings The settings, giving the port, the packet, the probe and the beacon intervals
+   */
+  DiscoveryResponder(U &udp, const CommandServerSettings &settings)
+      : udp(udp), port(settings.UDP_PORT), packet(settings.UDP_PACKET), packetSize(settings.UDP_PACKET_SIZE),
+        probe(settings.UDP_PROBE_PACKET), probeSize(settings.UDP_PROBE_PACKET != nullptr ? strlen(settings.UDP_PROBE_PACKET) : 0),
+        minInterval(settings.UDP_RATE_MS), maxInterval(settings.UDP_RATE_MAX_MS > settings.UDP_RATE_MS ? settings.UDP_RATE_MAX_MS : settings.UDP_RATE_MS)
+  {
+    if (probeSize > MAX_PROBE_SIZE)
+    {
+      probe = nullptr;
+      probeSize = 0;
+    }
+  }
+  /**
+   * @brief Starts the beacons, the first one being sent by the next poll
+   *
+   * @param broadcast The address the beacons are sent to
+   * @param now The current millis()
+   */
+  void begin(const IPAddress &broadcast, unsigned long now)
+  {
+    this->broadcast = broadcast;
+    interval = minInterval;
+    lastBeacon = now;
+    beaconDue = true;
+  }
+  /**
+   * @brief Answers the probes received so far and sends the beacon when due
+   *
+   * @param now The current millis(), the intervals are wrap-safe
+   */
+  void poll(unsigned long now)
+  {
+    for (int i = 0; i < MAX_DATAGRAMS_PER_POLL; i++)
+    {
+      int size = udp.parsePacket();
+      if (size <= 0)
+      {
+        break;
+      }
+      // The unread part of a datagram is dropped by the next parsePacket()
+      if (probe == nullptr || (size_t)size != probeSize)
+      {
+        continue;
+      }
+      char received[MAX_PROBE_SIZE];
+      if ((size_t)udp.read(received, probeSize) != probeSize || memcmp(received, probe, probeSize) != 0)
+      {
+        continue;
+      }
+      send(udp.remoteIP(), udp.remotePort());
+      probes++;
+      // Someone is looking for servers, the beacons start over at the highest rate
+      interval = minInterval;
+      lastBeacon = now;
+      beaconDue = false;
+    }
+
+    if (beaconDue || now - lastBeacon >= interval)
+    {
+      send(broadcast, port);
+      beacons++;
+      if (!beaconDue)
+      {
+        interval = interval > maxInterval / 2 ? maxInterval : interval * 2;
+      }
+      lastBeacon = now;
+      beaconDue = false;
+    }
+  }
+  /**
+   * @brief The current interval between the beacons
+   */
+  unsigned long getInterval() const
+  {
+    return interval;
+  }
+  unsigned long getBeacons() const
+  {
+    return beacons;
+  }
+  /**
+   * @brief The number of probes answered
+   */
+  unsigned long getProbes() const
+  {
+    return probes;
+  }
+
+private:
+  U &udp;
+  int port;
+  const char *packet;
+  size_t packetSize;
+  const char *probe;
+  size_t probeSize;
+  unsigned long minInterval, maxInterval;
+  unsigned long interval = 0, lastBeacon = 0;
+  bool beaconDue = false;
+  unsigned long beacons = 0, probes = 0;
+  IPAddress broadcast;
+
+  void send(const IPAddress &address, uint16_t to)
+  {
+    if (packet == nullptr || packetSize == 0)
+    {
+      return;
+    }
+    udp.beginPacket(address, to);
+    udp.write(reinterpret_cast<const uint8_t *>(packet), packetSize);
+    udp.endPacket();
+  }
+};
+
+#endif // DISCOVERY_RESPONDER_H
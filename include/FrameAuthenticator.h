@@ -0,0 +1,288 @@
+#ifndef FRAME_AUTHENTICATOR_H
+#define FRAME_AUTHENTICATOR_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include "Sha256.h"
+#include "Common.h"
+#include "InplaceFunction.h"
+
+/**
+ * @brief Checks the credentials carried by a frame, so that an action can be authenticated
+ *  without an exchange of its own. A frame is accepted when it holds either:
+ *  - `username` and `password`;
+ *  - a `token` issued by issueToken() after a password login, until its lifetime expires;
+ *  - a `nonce` greater than the last one accepted and an `hmac`, the lowercase hex HMAC-SHA256
+ *    keyed by the password of every other field serialized in order. A frame with more fields
+ *    than the view indexes or with a repeated key is refused, as the action could read a field
+ *    left out of the MAC. The last nonce is kept across reboots once persistNonces() is called
+ */
+class FrameAuthenticator
+{
+public:
+  static constexpr size_t KEY_SIZE = 32;
+  /**
+   * @brief A token is the issue time and the first half of its MAC, in hex
+   */
+  static constexpr size_t TOKEN_LENGTH = 8 + Sha256::DIGEST_SIZE;
+  /**
+   * @brief The nonces accepted between two writes of the persisted floor
+   */
+  static constexpr uint32_t NONCE_RESERVATION = 256;
+
+  FrameAuthenticator() = delete;
+  FrameAuthenticator(const String &username, const String &password) : username(username), password(password) {}
+  /**
+   * @brief Enables the session tokens
+   *
+   * @param tokenKey The secret key signing the tokens, the tokens issued with a different
+   *  key are refused, e.g. after a reboot when the key is random
+   * @param lifetimeMs How long a token is valid once issued
+   */
+  void enableTokens(const uint8_t tokenKey[KEY_SIZE], unsigned long lifetimeMs)
+  {
+    memcpy(key, tokenKey, KEY_SIZE);
+    tokenLifetime = lifetimeMs;
+  }
+  bool tokensEnabled() const
+  {
+    return tokenLifetime > 0;
+  }
+  /**
+   * @brief Keeps the nonces from being replayed after a reboot. Rather than writing every nonce
+   *  accepted, a floor NONCE_RESERVATION above it is persisted whenever a nonce reaches the last
+   *  floor persisted, so the clients shall count their nonces up by one
+   *
+   * @param floor The floor persisted before the reboot, every nonce up to it is refused
+   * @param persist Persists a new floor, returning false if it couldn't, in which case the frame
+   *  is refused
+   */
+  void persistNonces(uint32_t floor, InplaceFunction<bool(uint32_t)> persist)
+  {
+    if (floor > lastNonce)
+    {
+      lastNonce = floor;
+    }
+    persistedNonce = lastNonce;
+    persistNonce = persist;
+  }
+  bool checkPassword(const SerialSlice *user, const SerialSlice *pass) const
+  {
+    return user != nullptr && pass != nullptr && *user == username && *pass == password;
+  }
+  /**
+   * @brief Issues a session token
+   *
+   * @param now The current millis()
+   * @param token Receives the token, null terminated
+   * @return false If the tokens are disabled
+   */
+  bool issueToken(unsigned long now, char token[TOKEN_LENGTH + 1]) const
+  {
+    if (!tokensEnabled())
+    {
+      return false;
+    }
+    uint8_t issued[4] = {(uint8_t)(now >> 24), (uint8_t)(now >> 16), (uint8_t)(now >> 8), (uint8_t)now};
+    toHex(issued, sizeof(issued), token);
+    sign(token, token + 8);
+    token[TOKEN_LENGTH] = '\0';
+    return true;
+  }
+  bool checkToken(const SerialSlice &token, unsigned long now) const
+  {
+    if (!tokensEnabled() || token.length() != TOKEN_LENGTH)
+    {
+      return false;
+    }
+    unsigned long issued = 0;
+    for (int i = 0; i < 8; i++)
+    {
+      int digit = fromHex(token.data()[i]);
+      if (digit < 0)
+      {
+        return false;
+      }
+      issued = issued << 4 | digit;
+    }
+    char expected[TOKEN_LENGTH - 8];
+    sign(token.data(), expected);
+    return equalsConstantTime(expected, token.data() + 8, sizeof(expected)) && (uint32_t)(now - issued) < tokenLifetime;
+  }
+  /**
+   * @brief Checks the HMAC of the frame, accepting every nonce only once
+   */
+  bool checkHmac(const ActionView &frame)
+  {
+    const SerialSlice *mac = frame.get("hmac");
+    const SerialSlice *nonce = frame.get("nonce");
+    uint32_t value = 0;
+    if (mac == nullptr || mac->length() != 2 * Sha256::DIGEST_SIZE || nonce == nullptr || !parseNonce(*nonce, value) || value <= lastNonce ||
+        frame.isTruncated() || hasRepeatedKeys(frame))
+    {
+      return false;
+    }
+
+    HmacSha256 hmac(password.c_str(), password.length());
+    for (int i = 0; i < frame.getSize(); i++)
+    {
+      const SerialSlice &field = frame.keyAt(i);
+      const SerialSlice &content = frame.valueAt(i);
+      if (field == "hmac")
+      {
+        continue;
+      }
+      // Each field is signed as it is encoded in the frame
+      uint8_t header[SerialFrame::MAX_HEADER_SIZE];
+      hmac.update(header, SerialFrame::encodeHeader(header, SerialFrame::KEY_TYPE, field.length(), frame.getVersion()));
+      hmac.update(field.data(), field.length());
+      hmac.update(header, SerialFrame::encodeHeader(header, content.getType(), content.length(), frame.getVersion()));
+      hmac.update(content.data(), content.length());
+    }
+    uint8_t digest[Sha256::DIGEST_SIZE];
+    hmac.finish(digest);
+    char expected[2 * Sha256::DIGEST_SIZE];
+    toHex(digest, sizeof(digest), expected);
+
+    if (!equalsConstantTime(expected, mac->data(), sizeof(expected)))
+    {
+      return false;
+    }
+    if (persistNonce && value >= persistedNonce)
+    {
+      uint32_t floor = value <= UINT32_MAX - NONCE_RESERVATION ? value + NONCE_RESERVATION : UINT32_MAX;
+      if (!persistNonce(floor))
+      {
+        return false;
+      }
+      persistedNonce = floor;
+    }
+    lastNonce = value;
+    return true;
+  }
+  /**
+   * @brief Checks whichever credentials the frame carries
+   *
+   * @param frame The frame
+   * @param now The current millis()
+   */
+  bool authorize(const ActionView &frame, unsigned long now)
+  {
+    const SerialSlice *token = frame.get("token");
+    if (token != nullptr)
+    {
+      return checkToken(*token, now);
+    }
+    if (frame.has("hmac"))
+    {
+      return checkHmac(frame);
+    }
+    return checkPassword(frame.get("username"), frame.get("password"));
+  }
+
+private:
+  String username, password;
+  uint8_t key[KEY_SIZE] = {};
+  unsigned long tokenLifetime = 0;
+  uint32_t lastNonce = 0;
+  // The floor persisted, the nonces below it are accepted without writing
+  uint32_t persistedNonce = 0;
+  InplaceFunction<bool(uint32_t)> persistNonce;
+
+  /**
+   * @brief Writes the hex MAC of the issue time and the username, truncated to 16 bytes
+   */
+  void sign(const char issued[8], char mac[TOKEN_LENGTH - 8]) const
+  {
+    HmacSha256 hmac(key, sizeof(key));
+    hmac.update(issued, 8);
+    hmac.update(username.c_str(), username.length());
+    uint8_t digest[Sha256::DIGEST_SIZE];
+    hmac.finish(digest);
+    toHex(digest, (TOKEN_LENGTH - 8) / 2, mac);
+  }
+
+  static bool parseNonce(const SerialSlice &slice, uint32_t &value)
+  {
+    if (slice.getType() == SerialFrame::INT_TYPE)
+    {
+      // Up to 2^31 - 1 in a v2 frame
+      long parsed = slice.toInt();
+      value = (uint32_t)parsed;
+      return parsed >= 0;
+    }
+    if (slice.length() == 0 || slice.length() > 10)
+    {
+      return false;
+    }
+    uint64_t parsed = 0;
+    for (size_t i = 0; i < slice.length(); i++)
+    {
+      char c = slice.data()[i];
+      if (c < '0' || c > '9')
+      {
+        return false;
+      }
+      parsed = parsed * 10 + (c - '0');
+    }
+    value = (uint32_t)parsed;
+    return parsed <= 0xffffffffUL;
+  }
+
+  static bool hasRepeatedKeys(const ActionView &frame)
+  {
+    for (int i = 1; i < frame.getSize(); i++)
+    {
+      for (int j = 0; j < i; j++)
+      {
+        if (frame.keyAt(i) == frame.keyAt(j))
+        {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  static void toHex(const uint8_t *data, size_t len, char *hex)
+  {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++)
+    {
+      hex[2 * i] = digits[data[i] >> 4];
+      hex[2 * i + 1] = digits[data[i] & 0x0f];
+    }
+  }
+
+  static int fromHex(char c)
+  {
+    if (c >= '0' && c <= '9')
+    {
+      return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+      return c - 'a' + 10;
+    }
+    return -1;
+  }
+
+  /**
+   * @brief Compares without an early exit, so that the time taken tells nothing about the MAC
+   */
+  static bool equalsConstantTime(const char *a, const char *b, size_t len)
+  {
+    uint8_t difference = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+      difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+  }
+};
+
+#endif // FRAME_AUTHENTICATOR_H
@@ -0,0 +1,162 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <utility>
+#include <type_traits>
+#include "Map.h"
+
+/**
+ * @brief Computes the 32-bit FNV-1a hash of the given bytes
+ *
+ * @param data The bytes to hash
+ * @param len The number of bytes
+ * @return uint32_t The hash
+ */
+inline uint32_t fnv1a(const char *data, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++)
+	{
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/**
+ * @brief The smallest power of two at least twice as big as n, to keep the
+ * load factor of the hash table under 0.5 and the probe sequences short
+ */
+constexpr int hashBucketsFor(int n, int b = 1)
+{
+	return b >= 2 * n ? b : hashBucketsFor(n, b * 2);
+}
+
+/**
+ * @brief The default hash functor of the HashIndex. Integral and enum keys are
+ * scrambled with a multiplicative hash
+ *
+ * @tparam T The type of the keys
+ */
+template <typename T, typename = void>
+struct MapHash
+{
+	uint32_t operator()(const T &key) const
+	{
+		return static_cast<uint32_t>(key) * 2654435761u;
+	}
+};
+
+/**
+ * @brief The hash functor for string-like keys (String, std::string), i.e. any type
+ * exposing the c_str() and length() methods
+ */
+template <typename T>
+struct MapHash<T, decltype((void)std::declval<const T &>().c_str(), (void)std::declval<const T &>().length())>
+{
+	uint32_t operator()(const T &key) const
+	{
+		return fnv1a(key.c_str(), key.length());
+	}
+};
+
+/**
+ * @brief A lookup policy for the Map that keeps an open-addressing hash table of
+ * the slots next to the cached hash of every key. Lookups take a single probe
+ * in the common case, and a key with a different hash is rejected without
+ * calling the equals functor. Everything is statically sized, no heap is used.
+ *
+ * @tparam T The type of the keys
+ * @tparam S The max-number of elements of the map
+ * @tparam hash The functor class used to hash the keys
+ * @tparam equals The functor class used for equalness check
+ */
+template <typename T, int S, class hash = MapHash<T>, class equals = std::equal_to<T>>
+class HashIndex
+{
+public:
+	HashIndex()
+	{
+		clear();
+	}
+	/**
+	 * @brief Finds the slot holding the given key
+	 *
+	 * @param keys The keys array of the map
+	 * @param size The number of keys in the array
+	 * @param key The key to find
+	 * @return int The slot index
+	 * @retval -1 When the key has not been found
+	 */
+	int find(const T *keys, int size, const T &key) const
+	{
+		uint32_t h = hash()(key);
+		for (int i = h & (BUCKETS - 1);; i = (i + 1) & (BUCKETS - 1))
+		{
+			int slot = buckets[i];
+			if (slot < 0)
+			{
+				return -1;
+			}
+			if (hashes[slot] == h && equals()(keys[slot], key))
+			{
+				return slot;
+			}
+		}
+	}
+	/**
+	 * @brief Indexes the key just stored in the given slot
+	 */
+	void insert(const T *keys, int slot)
+	{
+		hashes[slot] = hash()(keys[slot]);
+		int i = hashes[slot] & (BUCKETS - 1);
+		while (buckets[i] >= 0)
+		{
+			i = (i + 1) & (BUCKETS - 1);
+		}
+		buckets[i] = slot;
+	}
+	/**
+	 * @brief Indexes again the whole keys array, after it has been rearranged
+	 */
+	void rebuild(const T *keys, int size)
+	{
+		clear();
+		for (int i = 0; i < size; i++)
+		{
+			insert(keys, i);
+		}
+	}
+
+private:
+	static constexpr int BUCKETS = hashBucketsFor(S);
+	static_assert(S < 0x7FFF, "HashIndex supports up to 32766 elements");
+
+	int16_t buckets[BUCKETS];
+	uint32_t hashes[S];
+
+	void clear()
+	{
+		for (int i = 0; i < BUCKETS; i++)
+		{
+			buckets[i] = -1;
+		}
+	}
+};
+
+/**
+ * @brief A fixed-size map with a hashed lookup, sharing the interface of Map
+ *
+ * @tparam T The type of the keys
+ * @tparam E The type of the values
+ * @tparam S The pre-allocated max-number of elements the map is allowed to have
+ * @tparam hash The functor class used to hash the keys
+ * @tparam equals The functor class used for equalness check
+ */
+template <typename T, typename E, int S = 24, class hash = MapHash<T>, class equals = std::equal_to<T>>
+using HashMap = Map<T, E, S, equals, HashIndex<T, S, hash, equals>>;
+
+#endif // HASH_INDEX_H
@@ -0,0 +1,167 @@
+#ifndef INPLACE_FUNCTION_H
+#define INPLACE_FUNCTION_H
+
+#include <stddef.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef INPLACE_FUNCTION_CAPACITY
+/**
+ * @brief The default number of bytes an InplaceFunction reserves for its callable, enough for a
+ *  `CALLBACK` bound member function along with a String or a few references captured
+ */
+#define INPLACE_FUNCTION_CAPACITY (6 * sizeof(void *))
+#endif
+
+template <typename Signature, size_t Capacity = INPLACE_FUNCTION_CAPACITY>
+class InplaceFunction;
+
+/**
+ * @brief A replacement for std::function storing the callable within itself, so that it never
+ *  allocates and calling it costs a single indirect call. A callable larger than the capacity
+ *  is refused at compile time
+ *
+ * @tparam R The return type
+ * @tparam Args The argument types
+ * @tparam Capacity The bytes reserved for the callable
+ */
+template <typename R, typename... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity>
+{
+  template <typename F>
+  using Callable = typename std::enable_if<
+      !std::is_same<typename std::decay<F>::type, InplaceFunction>::value &&
+      (std::is_void<R>::value || std::is_convertible<decltype(std::declval<typename std::decay<F>::type &>()(std::declval<Args>()...)), R>::value)>::type;
+
+public:
+  InplaceFunction() = default;
+  InplaceFunction(std::nullptr_t) {}
+  template <typename F, typename = Callable<F>>
+  InplaceFunction(F &&f)
+  {
+    typedef typename std::decay<F>::type Functor;
+    static_assert(sizeof(Functor) <= Capacity, "The callable doesn't fit in the InplaceFunction, raise its capacity");
+    static_assert(alignof(Functor) <= alignof(Storage), "The callable alignment is not supported by InplaceFunction");
+
+    new (&storage) Functor(std::forward<F>(f));
+    invoker = &invoke<Functor>;
+    manager = &manage<Functor>;
+  }
+  InplaceFunction(const InplaceFunction &copy) : invoker(copy.invoker), manager(copy.manager)
+  {
+    if (manager != nullptr)
+    {
+      manager(COPY, &storage, const_cast<Storage *>(&copy.storage));
+    }
+  }
+  InplaceFunction(InplaceFunction &&move) : invoker(move.invoker), manager(move.manager)
+  {
+    if (manager != nullptr)
+    {
+      manager(MOVE, &storage, &move.storage);
+    }
+  }
+  ~InplaceFunction()
+  {
+    reset();
+  }
+
+  InplaceFunction &operator=(const InplaceFunction &assign)
+  {
+    if (this != &assign)
+    {
+      reset();
+      if (assign.manager != nullptr)
+      {
+        assign.manager(COPY, &storage, const_cast<Storage *>(&assign.storage));
+      }
+      invoker = assign.invoker;
+      manager = assign.manager;
+    }
+    return *this;
+  }
+  InplaceFunction &operator=(InplaceFunction &&assign)
+  {
+    if (this != &assign)
+    {
+      reset();
+      if (assign.manager != nullptr)
+      {
+        assign.manager(MOVE, &storage, &assign.storage);
+      }
+      invoker = assign.invoker;
+      manager = assign.manager;
+    }
+    return *this;
+  }
+  InplaceFunction &operator=(std::nullptr_t)
+  {
+    reset();
+    return *this;
+  }
+
+  R operator()(Args... args) const
+  {
+    return invoker(const_cast<Storage *>(&storage), std::forward<Args>(args)...);
+  }
+  /**
+   * @brief Whether a callable is set
+   */
+  explicit operator bool() const
+  {
+    return invoker != nullptr;
+  }
+
+private:
+  typedef typename std::aligned_storage<Capacity, alignof(max_align_t)>::type Storage;
+
+  enum OPERATION
+  {
+    COPY,
+    MOVE,
+    DESTROY
+  };
+
+  Storage storage;
+  R (*invoker)(Storage *, Args &&...) = nullptr;
+  void (*manager)(OPERATION, Storage *, Storage *) = nullptr;
+
+  void reset()
+  {
+    if (manager != nullptr)
+    {
+      manager(DESTROY, &storage, nullptr);
+    }
+    invoker = nullptr;
+    manager = nullptr;
+  }
+
+  template <typename Functor>
+  static R invoke(Storage *storage, Args &&...args)
+  {
+    return (*reinterpret_cast<Functor *>(storage))(std::forward<Args>(args)...);
+  }
+
+  /**
+   * @brief Copies, moves or destroys the callable stored in a storage of the given type
+   */
+  template <typename Functor>
+  static void manage(OPERATION operation, Storage *destination, Storage *source)
+  {
+    switch (operation)
+    {
+    case COPY:
+      new (destination) Functor(*reinterpret_cast<const Functor *>(source));
+      break;
+    case MOVE:
+      new (destination) Functor(std::move(*reinterpret_cast<Functor *>(source)));
+      break;
+    case DESTROY:
+      reinterpret_cast<Functor *>(destination)->~Functor();
+      break;
+    }
+  }
+};
+
+#endif // INPLACE_FUNCTION_H
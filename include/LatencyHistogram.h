@@ -0,0 +1,169 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief A fixed-memory histogram of durations in microseconds. Bucket `i` counts the durations
+ *  whose highest bit is bit `i - 1`, i.e. in [2^(i-1), 2^i) us, and the last bucket everything
+ *  from about 4 seconds on, so the percentiles are exact within a factor of two
+ */
+class LatencyHistogram
+{
+public:
+  static constexpr int BUCKETS = 24;
+
+  /**
+   * @brief Adds a duration to the histogram
+   *
+   * @param us The duration in microseconds
+   */
+  void record(unsigned long us)
+  {
+    int bucket = 0;
+    for (unsigned long v = us; v != 0 && bucket < BUCKETS - 1; v >>= 1)
+    {
+      bucket++;
+    }
+    buckets[bucket]++;
+    count++;
+    total += us;
+    if (us > max)
+    {
+      max = us;
+    }
+  }
+  void clear()
+  {
+    for (int i = 0; i < BUCKETS; i++)
+    {
+      buckets[i] = 0;
+    }
+    count = 0;
+    total = 0;
+    max = 0;
+  }
+  uint32_t getCount() const
+  {
+    return count;
+  }
+  unsigned long getMax() const
+  {
+    return max;
+  }
+  unsigned long getMean() const
+  {
+    return count == 0 ? 0 : total / count;
+  }
+  uint32_t getBucket(int index) const
+  {
+    return buckets[index];
+  }
+  /**
+   * @brief The upper bound of the bucket holding the given percentile, never above the maximum
+   *
+   * @param percent The percentile, from 0 to 100
+   */
+  unsigned long percentile(float percent) const
+  {
+    uint32_t rank = (uint32_t)(count * percent / 100.0f + 0.5f);
+    if (rank == 0)
+    {
+      rank = 1;
+    }
+    uint32_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+      seen += buckets[i];
+      if (seen >= rank)
+      {
+        unsigned long bound = i == 0 ? 0 : (1UL << i) - 1;
+        return i == BUCKETS - 1 || bound > max ? max : bound;
+      }
+    }
+    return max;
+  }
+  /**
+   * @brief The summary sent by the `__stats` action, in microseconds:
+   *  `count,mean,p50,p90,p99,max`
+   */
+  String toString() const
+  {
+    char summary[80];
+    snprintf(summary, sizeof(summary), "%lu,%lu,%lu,%lu,%lu,%lu", (unsigned long)count, getMean(),
+             percentile(50), percentile(90), percentile(99), max);
+    return String(summary);
+  }
+
+private:
+  uint32_t buckets[BUCKETS] = {};
+  uint32_t count = 0;
+  uint64_t total = 0;
+  unsigned long max = 0;
+};
+
+/**
+ * @brief A Stream forwarding everything to another one and measuring the time spent writing
+ */
+class TimedStream : public Stream
+{
+public:
+  TimedStream() = delete;
+  TimedStream(Stream &stream) : stream(stream) {}
+
+  using Stream::write;
+  size_t write(uint8_t c) override
+  {
+    unsigned long start = micros();
+    size_t written = stream.write(c);
+    elapsed += micros() - start;
+    return written;
+  }
+  size_t write(const uint8_t *data, size_t len) override
+  {
+    unsigned long start = micros();
+    size_t written = stream.write(data, len);
+    elapsed += micros() - start;
+    return written;
+  }
+  void flush() override
+  {
+    unsigned long start = micros();
+    stream.flush();
+    elapsed += micros() - start;
+  }
+  int availableForWrite() override
+  {
+    return stream.availableForWrite();
+  }
+  int available() override
+  {
+    return stream.available();
+  }
+  int read() override
+  {
+    return stream.read();
+  }
+  int peek() override
+  {
+    return stream.peek();
+  }
+  /**
+   * @brief The microseconds spent writing so far
+   */
+  unsigned long getElapsed() const
+  {
+    return elapsed;
+  }
+
+private:
+  Stream &stream;
+  unsigned long elapsed = 0;
+};
+
+#endif // LATENCY_HISTOGRAM_H
@@ -3,6 +3,48 @@
 
 #include <functional>
 
+/**
+ * @brief The default lookup policy of the Map, a linear scan comparing every stored
+ * key with the equals functor. It holds no state, so it costs nothing in memory
+ *
+ * @tparam T The type of the keys
+ * @tparam S The max-number of elements of the map
+ * @tparam equals The functor class used for equalness check
+ */
+template <typename T, int S, class equals = std::equal_to<T>>
+class LinearIndex
+{
+public:
+	/**
+	 * @brief Finds the slot holding the given key
+	 *
+	 * @param keys The keys array of the map
+	 * @param size The number of keys in the array
+	 * @param key The key to find
+	 * @return int The slot index
+	 * @retval -1 When the key has not been found
+	 */
+	int find(const T *keys, int size, const T &key) const
+	{
+		for (int i = 0; i < size; i++)
+		{
+			if (equals()(keys[i], key))
+			{
+				return i;
+			}
+		}
+		return -1;
+	}
+	/**
+	 * @brief Notifies that a new key has been stored in the given slot
+	 */
+	void insert(const T *keys, int slot) {}
+	/**
+	 * @brief Notifies that the keys array has been rearranged
+	 */
+	void rebuild(const T *keys, int size) {}
+};
+
 /**
  * @brief A (bad) fixed-size implementation of a map/dictionary
  *
@@ -10,8 +52,9 @@
  * @tparam E The type of the values
  * @tparam S The pre-allocated max-number of elements the map is allowed to have. Defaults to 24 to spare device memory.
  * @tparam equals The functor class used for equalness check. It defaults to using the == operator
+ * @tparam indexer The lookup policy. It defaults to a linear scan, see HashIndex.h for the hashed one
  */
-template <typename T, typename E, int S = 24, class equals = std::equal_to<T>>
+template <typename T, typename E, int S = 24, class equals = std::equal_to<T>, class indexer = LinearIndex<T, S, equals>>
 class Map
 {
 public:
@@ -20,7 +63,7 @@ public:
 	{
 	public:
 		MapEntry() = delete;
-		MapEntry(Map<T, E, S, equals> &parent, int index)
+		MapEntry(Map<T, E, S, equals, indexer> &parent, int index)
 			: parent(parent), index(index)
 		{
 		}
@@ -34,7 +77,7 @@ public:
 		}
 
 	private:
-		Map<T, E, S, equals> &parent;
+		Map<T, E, S, equals, indexer> &parent;
 		int index;
 	};
 
@@ -59,11 +102,11 @@ public:
 			return index != rhs.index;
 		}
 
-		iterator(Map<T, E, S, equals> &parent) : parent(parent) {}
-		iterator(Map<T, E, S, equals> &parent, int index) : parent(parent), index(index) {}
+		iterator(Map<T, E, S, equals, indexer> &parent) : parent(parent) {}
+		iterator(Map<T, E, S, equals, indexer> &parent, int index) : parent(parent), index(index) {}
 
 	private:
-		Map<T, E, S, equals> &parent;
+		Map<T, E, S, equals, indexer> &parent;
 		int index = 0;
 	};
 
@@ -89,6 +132,7 @@ public:
 			{
 				keys[cursor] = key;
 				values[cursor] = value;
+				lookup.insert(keys, cursor);
 				size++;
 				cursor++;
 			}
@@ -134,6 +178,7 @@ public:
 			shiftLeft(vindex + 1);
 			size--;
 			cursor--;
+			lookup.rebuild(keys, size);
 			return true;
 		}
 		return false;
@@ -169,6 +214,15 @@ public:
 	{
 		return size;
 	}
+	/**
+	 * @brief Removes every key-value pair
+	 */
+	void clear()
+	{
+		size = 0;
+		cursor = 0;
+		lookup.rebuild(keys, 0);
+	}
 
 	iterator begin()
 	{
@@ -187,6 +241,7 @@ protected:
 
 private:
 	int cursor = 0;
+	indexer lookup;
 
 	/**
 	 * @brief Construct a new Map object from the given key-value arrays
@@ -204,6 +259,7 @@ private:
 				keys[i] = k[i];
 				values[i] = v[i];
 			}
+			lookup.rebuild(keys, size);
 		}
 		this->size = cursor = size;
 	}
@@ -222,8 +278,8 @@ private:
 	}
 	/**
 	 * @brief Returns the internal index of a given key.
-	 * The comparison is either done based on the == operator of E
-	 * or equals can be specified as a custom equalness comparator
+	 * The lookup is delegated to the indexer policy, which by default compares
+	 * the keys based on the == operator of T or the custom equals comparator
 	 *
 	 * @param key The key to find
 	 * @return int The index
@@ -231,14 +287,7 @@ private:
 	 */
 	int indexOf(const T &key) const
 	{
-		for (int i = 0; i < size; i++)
-		{
-			if (equals()(keys[i], key))
-			{
-				return i;
-			}
-		}
-		return -1;
+		return lookup.find(keys, size, key);
 	}
 };
 
@@ -0,0 +1,193 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include "SerialFrame.h"
+#include "LatencyHistogram.h"
+
+/**
+ * @brief The memory accounting of the server: the static footprint of its components, as
+ *  registered by their owner, and the heap as the requests see it. Around each request the free
+ *  heap is sampled, so that the bytes a request leaves allocated show up, along with the number
+ *  of allocations it makes when an allocation counter is installed, e.g. by a native build
+ *  overriding `operator new`. The lowest free heap seen and the fragmentation point at the
+ *  component to blame for an out of memory reset
+ */
+class MemoryStats
+{
+public:
+  /** @brief The components registered */
+  static constexpr int MAX_COMPONENTS = 12;
+
+  struct Component
+  {
+    const char *name;
+    /** @brief The bytes of the object itself, i.e. its sizeof */
+    size_t staticBytes;
+    /** @brief The heap it took when constructed */
+    size_t heapBytes;
+  };
+
+  /**
+   * @brief The state of the heap before a request
+   */
+  struct Sample
+  {
+    uint32_t freeHeap;
+    unsigned long allocations;
+  };
+
+  /**
+   * @brief Registers a component
+   *
+   * @param name The component name, which has to outlive the stats
+   * @param staticBytes Its static footprint
+   * @param heapBytes The heap it holds
+   * @return false If there's no room for the component
+   */
+  bool addComponent(const char *name, size_t staticBytes, size_t heapBytes = 0)
+  {
+    if (count >= MAX_COMPONENTS)
+    {
+      return false;
+    }
+    components[count++] = {name, staticBytes, heapBytes};
+    return true;
+  }
+  int getComponentCount() const
+  {
+    return count;
+  }
+  const Component &getComponent(int index) const
+  {
+    return components[index];
+  }
+  /**
+   * @brief Installs the function counting the allocations made so far, without which the
+   *  allocations per request aren't recorded
+   */
+  void setAllocationCounter(unsigned long (*counter)())
+  {
+    allocationCounter = counter;
+  }
+  /**
+   * @brief Samples the heap before a request
+   */
+  Sample sample()
+  {
+    uint32_t freeHeap = ESP.getFreeHeap();
+    track(freeHeap);
+    return {freeHeap, allocationCounter != nullptr ? allocationCounter() : 0};
+  }
+  /**
+   * @brief Records the heap a request took, given the sample taken before it
+   */
+  void record(const Sample &before)
+  {
+    uint32_t freeHeap = ESP.getFreeHeap();
+    track(freeHeap);
+    retained.record(before.freeHeap > freeHeap ? before.freeHeap - freeHeap : 0);
+    if (allocationCounter != nullptr)
+    {
+      allocations.record(allocationCounter() - before.allocations);
+    }
+  }
+  /**
+   * @brief The heap bytes left allocated by each request, e.g. by a leak or a growing cache
+   */
+  const LatencyHistogram &getRetained() const
+  {
+    return retained;
+  }
+  /**
+   * @brief The allocations made by each request, if counted
+   */
+  const LatencyHistogram &getAllocations() const
+  {
+    return allocations;
+  }
+  /**
+   * @brief The lowest free heap seen around the requests
+   */
+  uint32_t getMinFreeHeap() const
+  {
+    return minFreeHeap;
+  }
+  /**
+   * @brief Clears the histograms and the lowest free heap
+   */
+  void clear()
+  {
+    retained.clear();
+    allocations.clear();
+    minFreeHeap = UINT32_MAX;
+  }
+  /**
+   * @brief Writes the stats as a map with:
+   *  - `heap`: `free,largest free block,fragmentation %,lowest free` in bytes;
+   *  - `request.heap`: the bytes left allocated by each request, as `count,mean,p50,p90,p99,max`;
+   *  - `request.allocations`: the allocations of each request likewise, if counted;
+   *  - `static.<component>`: `static,heap` in bytes
+   */
+  void write(Stream &client)
+  {
+    char value[64], key[48];
+    SerialFrameWriter stats(client);
+    uint32_t freeHeap = ESP.getFreeHeap();
+    track(freeHeap);
+    snprintf(value, sizeof(value), "%lu,%lu,%u,%lu", (unsigned long)freeHeap, (unsigned long)ESP.getMaxFreeBlockSize(),
+             (unsigned)ESP.getHeapFragmentation(), (unsigned long)minFreeHeap);
+    stats.put("heap", value);
+    stats.put("request.heap", retained.toString());
+    if (allocationCounter != nullptr)
+    {
+      stats.put("request.allocations", allocations.toString());
+    }
+    for (int i = 0; i < count; i++)
+    {
+      snprintf(key, sizeof(key), "static.%s", components[i].name);
+      snprintf(value, sizeof(value), "%lu,%lu", (unsigned long)components[i].staticBytes, (unsigned long)components[i].heapBytes);
+      stats.put(key, value);
+    }
+    stats.end();
+  }
+  /**
+   * @brief Prints the footprint of the components as a table, e.g. to the serial port or the
+   *  standard output of a native build, so that it can be compared between two builds. A
+   *  component may hold another one, so the rows don't add up
+   */
+  void printTo(Stream &out) const
+  {
+    char line[80];
+    snprintf(line, sizeof(line), "%-32s %9s %9s", "component", "static", "heap");
+    out.println(line);
+    for (int i = 0; i < count; i++)
+    {
+      snprintf(line, sizeof(line), "%-32s %9lu %9lu", components[i].name, (unsigned long)components[i].staticBytes,
+               (unsigned long)components[i].heapBytes);
+      out.println(line);
+    }
+  }
+
+private:
+  Component components[MAX_COMPONENTS];
+  int count = 0;
+  unsigned long (*allocationCounter)() = nullptr;
+  LatencyHistogram retained, allocations;
+  uint32_t minFreeHeap = UINT32_MAX;
+
+  void track(uint32_t freeHeap)
+  {
+    if (freeHeap < minFreeHeap)
+    {
+      minFreeHeap = freeHeap;
+    }
+  }
+};
+
+#endif // MEMORY_STATS_H
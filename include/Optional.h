@@ -2,76 +2,153 @@
 #define OPTIONAL_H
 
 #include <initializer_list>
+#include <new>
+#include <utility>
 
+/**
+ * @brief An optional value, stored in place within the Optional itself so that setting
+ *  and resetting it never touches the heap
+ *
+ * @tparam T The value type
+ */
 template <typename T>
 class Optional
 {
 public:
     Optional() {}
-    Optional(const T &copy)
-        : has_value(copy.has_value), value(copy.value != nullptr ? new T(*(copy.value)) : nullptr)
+    Optional(const T &value)
     {
+        emplace(value);
     }
-    ~Optional()
+    Optional(T &&value)
+    {
+        emplace(std::move(value));
+    }
+    Optional(const Optional<T> &copy)
+    {
+        if (copy.has_value)
+        {
+            emplace(copy.get());
+        }
+    }
+    Optional(Optional<T> &&move)
     {
-        if (value != nullptr)
+        if (move.has_value)
         {
-            delete value;
-            value = nullptr;
+            emplace(std::move(move.get()));
         }
     }
+    ~Optional()
+    {
+        reset();
+    }
 
-    bool hasValue()
+    bool hasValue() const
     {
         return has_value;
     }
     T &get()
     {
-        return *value;
+        return *reinterpret_cast<T *>(storage);
+    }
+    const T &get() const
+    {
+        return *reinterpret_cast<const T *>(storage);
     }
     void set(const T &value)
     {
         *this = value;
     }
+    void set(T &&value)
+    {
+        *this = std::move(value);
+    }
+    /**
+     * @brief Constructs the value in place from the given arguments, replacing the current one
+     *
+     * @return T& The new value
+     */
+    template <typename... Args>
+    T &emplace(Args &&...args)
+    {
+        reset();
+        new (storage) T(std::forward<Args>(args)...);
+        has_value = true;
+        return get();
+    }
+    /**
+     * @brief Destroys the value, if any
+     */
+    void reset()
+    {
+        if (has_value)
+        {
+            get().~T();
+            has_value = false;
+        }
+    }
 
     Optional<T> &operator=(const T &assign)
     {
-        if (value != nullptr)
+        if (has_value)
         {
-            delete value;
+            get() = assign;
+        }
+        else
+        {
+            emplace(assign);
+        }
+        return *this;
+    }
+    Optional<T> &operator=(T &&assign)
+    {
+        if (has_value)
+        {
+            get() = std::move(assign);
+        }
+        else
+        {
+            emplace(std::move(assign));
         }
-        has_value = true;
-        value = new T(assign);
         return *this;
     }
     Optional<T> &operator=(const Optional<T> &assign)
     {
-        if (value != nullptr)
+        if (this == &assign)
         {
-            delete value;
+            return *this;
         }
         if (!assign.has_value)
         {
-            has_value = false;
-            value = nullptr;
+            reset();
         }
         else
         {
-            has_value = true;
-            value = new T(*(assign.value));
+            *this = assign.get();
         }
         return *this;
     }
-    Optional<T> &operator=(std::initializer_list<T> l)
+    Optional<T> &operator=(Optional<T> &&assign)
     {
-        if (value != nullptr)
+        if (this == &assign)
         {
-            delete value;
+            return *this;
         }
+        if (!assign.has_value)
+        {
+            reset();
+        }
+        else
+        {
+            *this = std::move(assign.get());
+        }
+        return *this;
+    }
+    Optional<T> &operator=(std::initializer_list<T> l)
+    {
         if (l.size() == 0)
         {
-            has_value = false;
-            value = nullptr;
+            reset();
         }
         else
         {
@@ -81,8 +158,8 @@ public:
     }
 
 private:
+    alignas(T) unsigned char storage[sizeof(T)];
     bool has_value = false;
-    T *value = nullptr;
 };
 
 #endif // OPTIONAL_H
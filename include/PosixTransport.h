@@ -0,0 +1,692 @@
+#ifndef POSIX_TRANSPORT_H
+#define POSIX_TRANSPORT_H
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "RemoteControlSettings.h"
+
+#ifdef POSIX_TRANSPORT_TLS
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+#endif
+
+/**
+ * @brief The address of a socket peer, standing for the IPAddress of the device
+ */
+struct SocketAddress
+{
+  String address;
+
+  String toString() const
+  {
+    return address;
+  }
+};
+
+/**
+ * @brief A connection accepted by the PosixTransport: a non-blocking socket, optionally
+ *  wrapped in TLS. Like the WiFi clients, the copies share the same connection, which
+ *  is closed by stop() or when the last copy goes away
+ */
+class SocketClient : public Stream
+{
+public:
+  /** @brief How long a write waits for the socket to drain before giving up */
+  static constexpr int WRITE_TIMEOUT_MS = 5000;
+
+  struct Socket
+  {
+    int fd = -1;
+    String address;
+    int port = 0;
+#ifdef POSIX_TRANSPORT_TLS
+    SSL *ssl = nullptr;
+#endif
+
+    Socket() = default;
+    Socket(const Socket &) = delete;
+    ~Socket()
+    {
+      close();
+    }
+    void close()
+    {
+#ifdef POSIX_TRANSPORT_TLS
+      if (ssl != nullptr)
+      {
+        SSL_shutdown(ssl);
+        SSL_free(ssl);
+        ssl = nullptr;
+      }
+#endif
+      if (fd >= 0)
+      {
+        ::close(fd);
+        fd = -1;
+      }
+    }
+    /**
+     * @brief The plaintext bytes already decrypted and waiting to be read
+     */
+    int pending() const
+    {
+#ifdef POSIX_TRANSPORT_TLS
+      return ssl != nullptr ? SSL_pending(ssl) : 0;
+#else
+      return 0;
+#endif
+    }
+  };
+
+  SocketClient() = default;
+  SocketClient(std::shared_ptr<Socket> socket) : socket(socket) {}
+
+  explicit operator bool() const
+  {
+    return socket && socket->fd >= 0;
+  }
+  int available() override
+  {
+    if (!*this)
+    {
+      return 0;
+    }
+#ifdef POSIX_TRANSPORT_TLS
+    if (socket->ssl != nullptr)
+    {
+      // Peeking processes the records received, which SSL_pending() alone doesn't
+      char c;
+      return SSL_peek(socket->ssl, &c, 1) > 0 ? SSL_pending(socket->ssl) : 0;
+    }
+#endif
+    int available = 0;
+    return ioctl(socket->fd, FIONREAD, &available) == 0 ? available : 0;
+  }
+  int read() override
+  {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+  }
+  /**
+   * @brief Reads the bytes available, without waiting
+   *
+   * @return int The bytes read, 0 if the peer closed the connection, -1 if there is no data
+   */
+  int read(uint8_t *data, size_t len)
+  {
+    if (!*this)
+    {
+      return -1;
+    }
+#ifdef POSIX_TRANSPORT_TLS
+    if (socket->ssl != nullptr)
+    {
+      int n = SSL_read(socket->ssl, data, len);
+      if (n > 0)
+      {
+        return n;
+      }
+      return SSL_get_error(socket->ssl, n) == SSL_ERROR_ZERO_RETURN ? 0 : -1;
+    }
+#endif
+    ssize_t n = recv(socket->fd, data, len, MSG_DONTWAIT);
+    return n >= 0 ? (int)n : -1;
+  }
+  int peek() override
+  {
+    if (!*this)
+    {
+      return -1;
+    }
+    uint8_t c;
+#ifdef POSIX_TRANSPORT_TLS
+    if (socket->ssl != nullptr)
+    {
+      return SSL_peek(socket->ssl, &c, 1) == 1 ? c : -1;
+    }
+#endif
+    return recv(socket->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 1 ? c : -1;
+  }
+  /**
+   * @brief Reads up to len bytes, waiting at most a second for each of them as Stream does
+   */
+  size_t readBytes(char *data, size_t len) override
+  {
+    size_t total = 0;
+    while (total < len && *this)
+    {
+      int n = read(reinterpret_cast<uint8_t *>(data) + total, len - total);
+      if (n > 0)
+      {
+        total += n;
+      }
+      else if (n == 0 || !waitFor(POLLIN, 1000))
+      {
+        break;
+      }
+    }
+    return total;
+  }
+  using Stream::write;
+  size_t write(uint8_t c) override
+  {
+    return write(&c, 1);
+  }
+  /**
+   * @brief Writes all the data, waiting for the socket to drain when its buffer is full
+   */
+  size_t write(const uint8_t *data, size_t len) override
+  {
+    size_t total = 0;
+    while (total < len && *this)
+    {
+#ifdef POSIX_TRANSPORT_TLS
+      if (socket->ssl != nullptr)
+      {
+        int n = SSL_write(socket->ssl, data + total, len - total);
+        if (n > 0)
+        {
+          total += n;
+          continue;
+        }
+        int error = SSL_get_error(socket->ssl, n);
+        if ((error != SSL_ERROR_WANT_WRITE && error != SSL_ERROR_WANT_READ) ||
+            !waitFor(error == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN, WRITE_TIMEOUT_MS))
+        {
+          break;
+        }
+        continue;
+      }
+#endif
+      ssize_t n = send(socket->fd, data + total, len - total, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n > 0)
+      {
+        total += n;
+      }
+      else if ((errno != EAGAIN && errno != EWOULDBLOCK) || !waitFor(POLLOUT, WRITE_TIMEOUT_MS))
+      {
+        break;
+      }
+    }
+    return total;
+  }
+  /**
+   * @brief The room left in the socket send buffer, which the TLS records share
+   */
+  int availableForWrite() override
+  {
+    int queued = 0, capacity = 0;
+    socklen_t length = sizeof(capacity);
+    if (!*this || ioctl(socket->fd, TIOCOUTQ, &queued) != 0 ||
+        getsockopt(socket->fd, SOL_SOCKET, SO_SNDBUF, &capacity, &length) != 0)
+    {
+      return 0;
+    }
+    return capacity > queued ? capacity - queued : 0;
+  }
+  bool connected()
+  {
+    if (!*this)
+    {
+      return false;
+    }
+    char c;
+    ssize_t n = recv(socket->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n > 0 || (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+  }
+  void stop()
+  {
+    if (socket)
+    {
+      socket->close();
+    }
+  }
+  SocketAddress remoteIP() const
+  {
+    return SocketAddress{socket ? socket->address : String()};
+  }
+  int remotePort() const
+  {
+    return socket ? socket->port : 0;
+  }
+
+private:
+  std::shared_ptr<Socket> socket;
+
+  bool waitFor(short events, int timeoutMs)
+  {
+    pollfd descriptor = {socket->fd, events, 0};
+    return poll(&descriptor, 1, timeoutMs) > 0;
+  }
+};
+
+/**
+ * @brief A non-blocking UDP socket with the methods of WiFiUDP used by the discovery
+ */
+class PosixUdp
+{
+public:
+  /** @brief The longest datagram received or sent, the longer ones are truncated */
+  static constexpr size_t MAX_DATAGRAM_SIZE = 512;
+
+  PosixUdp() = default;
+  PosixUdp(const PosixUdp &) = delete;
+  ~PosixUdp()
+  {
+    stop();
+  }
+  /**
+   * @brief Binds the socket to the given port on every interface, 0 picking a free one
+   *
+   * @return uint8_t 1 on success, as WiFiUDP
+   */
+  uint8_t begin(uint16_t port)
+  {
+    stop();
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+      return 0;
+    }
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    socklen_t length = sizeof(address);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+    {
+      stop();
+      return 0;
+    }
+    localPort = ntohs(address.sin_port);
+    return 1;
+  }
+  /**
+   * @brief Receives the next datagram, dropping what is left of the current one
+   *
+   * @return int The datagram size, 0 if none is waiting
+   */
+  int parsePacket()
+  {
+    received = position = 0;
+    if (fd < 0)
+    {
+      return 0;
+    }
+    socklen_t length = sizeof(sender);
+    ssize_t n = recvfrom(fd, incoming, sizeof(incoming), MSG_DONTWAIT, reinterpret_cast<sockaddr *>(&sender), &length);
+    if (n <= 0)
+    {
+      return 0;
+    }
+    received = n;
+    return n;
+  }
+  int read(char *data, size_t len)
+  {
+    size_t n = std::min(len, received - position);
+    memcpy(data, incoming + position, n);
+    position += n;
+    return n;
+  }
+  IPAddress remoteIP() const
+  {
+    return toIP(sender.sin_addr);
+  }
+  uint16_t remotePort() const
+  {
+    return ntohs(sender.sin_port);
+  }
+  int beginPacket(const IPAddress &ip, uint16_t port)
+  {
+    destination = {};
+    destination.sin_family = AF_INET;
+    uint8_t *address = reinterpret_cast<uint8_t *>(&destination.sin_addr.s_addr);
+    for (int i = 0; i < 4; i++)
+    {
+      address[i] = ip[i];
+    }
+    destination.sin_port = htons(port);
+    sending = 0;
+    return 1;
+  }
+  size_t write(const uint8_t *data, size_t len)
+  {
+    size_t n = std::min(len, MAX_DATAGRAM_SIZE - sending);
+    memcpy(outgoing + sending, data, n);
+    sending += n;
+    return n;
+  }
+  /**
+   * @brief Sends the datagram written since beginPacket()
+   *
+   * @return int 1 on success, as WiFiUDP
+   */
+  int endPacket()
+  {
+    if (fd < 0)
+    {
+      return 0;
+    }
+    return sendto(fd, outgoing, sending, MSG_DONTWAIT, reinterpret_cast<sockaddr *>(&destination), sizeof(destination)) == (ssize_t)sending;
+  }
+  void stop()
+  {
+    if (fd >= 0)
+    {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  int getFd() const
+  {
+    return fd;
+  }
+  /**
+   * @brief The port the socket is bound to, once begun
+   */
+  uint16_t getPort() const
+  {
+    return localPort;
+  }
+
+  static IPAddress toIP(in_addr address)
+  {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&address.s_addr);
+    return IPAddress(bytes[0], bytes[1], bytes[2], bytes[3]);
+  }
+
+private:
+  int fd = -1;
+  uint16_t localPort = 0;
+  sockaddr_in sender = {}, destination = {};
+  char incoming[MAX_DATAGRAM_SIZE], outgoing[MAX_DATAGRAM_SIZE];
+  size_t received = 0, position = 0, sending = 0;
+};
+
+/**
+ * @brief The transport of the native environment: non-blocking POSIX sockets, with the server
+ *  loop sleeping in epoll until a connection has data, so that the command server can serve
+ *  real traffic on a Linux host and be profiled with the usual tools.
+ *  When built with POSIX_TRANSPORT_TLS (linking OpenSSL) and given a certificate and a private
+ *  key in the settings, the connections are wrapped in TLS as on the device
+ */
+class PosixTransport
+{
+public:
+  typedef SocketClient Client;
+  typedef PosixUdp Udp;
+
+  /** @brief How long the server loop sleeps when no socket is ready */
+  static constexpr int IDLE_MS = 20;
+  /** @brief How long an accepted client is given to complete the TLS handshake */
+  static constexpr int HANDSHAKE_TIMEOUT_MS = 5000;
+
+  PosixTransport() = delete;
+  PosixTransport(const PosixTransport &) = delete;
+  /**
+   * @brief Construct a new Posix Transport listening on the PORT of the settings, 0 picking
+   *  a free port which getPort() returns once begun
+   */
+  PosixTransport(const CommandServerSettings &settings) : port(settings.PORT), udpPort(settings.UDP_PORT)
+  {
+#ifdef POSIX_TRANSPORT_TLS
+    if (settings.CERTIFICATE != nullptr && settings.PRIVATE_KEY != nullptr)
+    {
+      context = createContext(settings.CERTIFICATE, settings.PRIVATE_KEY, settings.TLS_SESSION_CACHE_SIZE);
+    }
+#endif
+  }
+  ~PosixTransport()
+  {
+    stop();
+#ifdef POSIX_TRANSPORT_TLS
+    if (context != nullptr)
+    {
+      SSL_CTX_free(context);
+    }
+#endif
+  }
+  bool begin()
+  {
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+    {
+      return false;
+    }
+    int enable = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    socklen_t length = sizeof(address);
+    if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0 ||
+        getsockname(listener, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+    {
+      stop();
+      return false;
+    }
+    port = ntohs(address.sin_port);
+
+    events = epoll_create1(EPOLL_CLOEXEC);
+    watch(listener);
+
+    // The probes wake the server loop as the connections do
+    if (udp.begin(udpPort))
+    {
+      watch(udp.getFd());
+    }
+    return events >= 0;
+  }
+  bool accept(Client &client)
+  {
+    if (listener < 0)
+    {
+      return false;
+    }
+    sockaddr_in address = {};
+    socklen_t length = sizeof(address);
+    int fd = accept4(listener, reinterpret_cast<sockaddr *>(&address), &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+    {
+      return false;
+    }
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    std::shared_ptr<SocketClient::Socket> socket = std::make_shared<SocketClient::Socket>();
+    socket->fd = fd;
+    char ip[INET_ADDRSTRLEN] = {};
+    inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+    socket->address = ip;
+    socket->port = ntohs(address.sin_port);
+
+#ifdef POSIX_TRANSPORT_TLS
+    if (context != nullptr)
+    {
+      socket->ssl = SSL_new(context);
+      SSL_set_fd(socket->ssl, fd);
+      if (!handshake(socket->ssl, fd))
+      {
+        return false;
+      }
+      encrypted.push_back(socket);
+    }
+#endif
+
+    watch(fd);
+    client = SocketClient(socket);
+    return true;
+  }
+  /**
+   * @brief Sets the address the broadcasts are sent to, the limited broadcast address by default
+   */
+  void setBroadcastAddress(const char *address)
+  {
+    inet_pton(AF_INET, address, &broadcastAddress);
+  }
+  IPAddress getBroadcastIP() const
+  {
+    return PosixUdp::toIP(broadcastAddress);
+  }
+  Udp &getUdp()
+  {
+    return udp;
+  }
+  /**
+   * @brief Sleeps until a connection is pending, a client sends data or closes, or IDLE_MS elapse.
+   *  Unlike the device, it sleeps with open connections as well, as epoll wakes it when they
+   *  have something to read
+   */
+  void idle(bool busy)
+  {
+    if (events < 0 || hasPending())
+    {
+      return;
+    }
+    epoll_event ready[16];
+    epoll_wait(events, ready, 16, IDLE_MS);
+  }
+  void stop()
+  {
+    for (int *fd : {&listener, &events})
+    {
+      if (*fd >= 0)
+      {
+        close(*fd);
+        *fd = -1;
+      }
+    }
+    udp.stop();
+  }
+  int getPort() const
+  {
+    return port;
+  }
+  bool isSecure() const
+  {
+#ifdef POSIX_TRANSPORT_TLS
+    return context != nullptr;
+#else
+    return false;
+#endif
+  }
+
+private:
+  int port, udpPort;
+  int listener = -1, events = -1;
+  PosixUdp udp;
+  in_addr broadcastAddress = {htonl(INADDR_BROADCAST)};
+
+  void watch(int fd)
+  {
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    // The closed sockets leave the epoll set on their own
+    epoll_ctl(events, EPOLL_CTL_ADD, fd, &event);
+  }
+
+#ifdef POSIX_TRANSPORT_TLS
+  SSL_CTX *context = nullptr;
+  // The TLS connections, whose decrypted data epoll can't see
+  std::vector<std::weak_ptr<SocketClient::Socket>> encrypted;
+
+  bool hasPending()
+  {
+    bool pending = false;
+    for (size_t i = 0; i < encrypted.size();)
+    {
+      std::shared_ptr<SocketClient::Socket> socket = encrypted[i].lock();
+      if (!socket || socket->fd < 0)
+      {
+        encrypted[i] = encrypted.back();
+        encrypted.pop_back();
+        continue;
+      }
+      pending |= socket->pending() > 0;
+      i++;
+    }
+    return pending;
+  }
+
+  static bool handshake(SSL *ssl, int fd)
+  {
+    while (true)
+    {
+      int result = SSL_accept(ssl);
+      if (result == 1)
+      {
+        return true;
+      }
+      int error = SSL_get_error(ssl, result);
+      pollfd descriptor = {fd, (short)(error == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN), 0};
+      if ((error != SSL_ERROR_WANT_READ && error != SSL_ERROR_WANT_WRITE) || poll(&descriptor, 1, HANDSHAKE_TIMEOUT_MS) <= 0)
+      {
+        return false;
+      }
+    }
+  }
+
+  static SSL_CTX *createContext(const char *certificate, const char *privateKey, uint32_t sessionCacheSize)
+  {
+    SSL_CTX *context = SSL_CTX_new(TLS_server_method());
+    BIO *bio = BIO_new_mem_buf(certificate, -1);
+    X509 *x509 = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+    BIO_free(bio);
+    bio = BIO_new_mem_buf(privateKey, -1);
+    EVP_PKEY *key = PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
+    BIO_free(bio);
+
+    bool valid = x509 != nullptr && key != nullptr && SSL_CTX_use_certificate(context, x509) == 1 &&
+                 SSL_CTX_use_PrivateKey(context, key) == 1;
+    X509_free(x509);
+    EVP_PKEY_free(key);
+    if (!valid)
+    {
+      SSL_CTX_free(context);
+      return nullptr;
+    }
+
+    if (sessionCacheSize > 0)
+    {
+      static const unsigned char id[] = "RemoteControlServer";
+      SSL_CTX_set_session_id_context(context, id, sizeof(id) - 1);
+      SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+      SSL_CTX_sess_set_cache_size(context, sessionCacheSize);
+    }
+    else
+    {
+      SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+    }
+    return context;
+  }
+#else
+  bool hasPending()
+  {
+    return false;
+  }
+#endif
+};
+
+#endif // POSIX_TRANSPORT_H
@@ -8,36 +8,59 @@
 #include "CommandServer.h"
 #include "Configuration.h"
 #include "StateManager.h"
+#include "WifiConnector.h"
 #include "Optional.h"
+#include "InplaceFunction.h"
 #include "Logging.h"
 
-typedef std::function<bool(ActionMap &, Stream &)> ActionCallback;
+typedef InplaceFunction<bool(ActionMap &, Stream &)> ActionCallback;
+typedef InplaceFunction<bool(ActionView &, Stream &)> ActionViewCallback;
+typedef AsyncTask::Callback ActionAsyncCallback;
 
 /**
  * @brief The Remote control server class
  * 
  * @tparam N The maximum number of actions handled by the server
+ * @tparam C The maximum number of clients the main server handles concurrently, as far as
+ *  BUFFER_POOL_SIZE gives each one its buffers
  */
-template <int N>
+template <int N, int C = 1>
 class RemoteControlServer
 {
 public:
     RemoteControlServer() = delete;
     RemoteControlServer(const RemoteControlServer &c) = delete;
     RemoteControlServer(const RemoteControlServer &&m) = delete;
-    RemoteControlServer(RemoteControlSettings settings) : settings(settings), accessPoint(configuration, stateManager, settings.ACCESS_POINT_SETTINGS),
-                                                          commandServer(stateManager, settings.COMMAND_SERVER_SETTINGS)
+    RemoteControlServer(RemoteControlSettings settings) : settings(settings), accessPoint(configuration, stateManager, settings.ACCESS_POINT_SETTINGS, pool),
+                                                          commandServer(stateManager, settings.COMMAND_SERVER_SETTINGS, pool), wifiConnector(WiFi)
     {
         stateManager.registerStateFunction(CONNECTING, std::bind(&RemoteControlServer::connectingCallback, this));
         stateManager.registerStateFunction(CONNECTED, std::bind(&RemoteControlServer::connectedCallback, this));
         stateManager.registerStateFunction(AP_MODE, std::bind(&RemoteControlServer::apModeCallback, this));
+
+        // The credentials are held by their server, their heap is the parsed certificate and key
+        MemoryStats &memory = commandServer.getMemoryStats();
+        memory.addComponent("Configuration", sizeof(Configuration));
+        memory.addComponent("StateManager", sizeof(StateManager));
+        memory.addComponent("AccessPointOperations", sizeof(AccessPointOperations));
+        memory.addComponent("AccessPoint.credentials", sizeof(ServerCredentials), accessPoint.getCredentials().getHeapUsed());
+        memory.addComponent("CommandServer", sizeof(CommandServer<N, C>));
+        memory.addComponent("CommandServer.credentials", sizeof(ServerCredentials), commandServer.getTransport().getCredentials().getHeapUsed());
+        memory.addComponent("BufferPool", sizeof(BufferPool));
+        memory.addComponent("WifiConnector", sizeof(WifiConnector<ESP8266WiFiClass>));
+
+        if (settings.COMMAND_SERVER_SETTINGS.INLINE_AUTH_ENABLED)
+        {
+            commandServer.persistNonces(configuration.getNonceFloor(), [this](uint32_t floor)
+                                        { return configuration.updateNonceFloor(floor); });
+        }
     }
     /**
      * @brief Set a callback to be executed when a new connection is accepted from the main server (not the AP one)
      * 
      * @param callback The callback, to which will be passed the client IP address and port
      */
-    void setOnClientConnectionCallback(std::function<void(const String &, int)> callback)
+    void setOnClientConnectionCallback(InplaceFunction<void(const String &, int)> callback)
     {
         commandServer.setOnNewConnectionCallback(callback);
     }
@@ -46,7 +69,7 @@ public:
      * 
      * @param callback The callback
      */
-    void setOnConnectionCloseCallback(std::function<void(void)> callback)
+    void setOnConnectionCloseCallback(InplaceFunction<void(void)> callback)
     {
         commandServer.setOnConnectionCloseCallback(callback);
     }
@@ -58,9 +81,9 @@ public:
    * 
    * @param callback The callback
    */
-    void setLoopCallback(std::function<void(void)> callback)
+    void setLoopCallback(InplaceFunction<void(void)> callback)
     {
-        wifiConnectingCallback = callback;
+        wifiConnector.setLoopCallback(callback);
         commandServer.setOnServerLoopCallback(callback);
         accessPoint.setOnServerLoopCallback(callback);
     }
@@ -69,7 +92,7 @@ public:
      * 
      * @param callback The callback
      */
-    void setOnServerTerminationCallback(std::function<void(void)> callback)
+    void setOnServerTerminationCallback(InplaceFunction<void(void)> callback)
     {
         commandServer.setOnServerTerminationCallback(callback);
     }
@@ -84,6 +107,67 @@ public:
     {
         commandServer.registerAction(name, callback);
     }
+    /**
+     * @brief Adds an action whose callback reads the request through an `ActionView`, which points
+     *  straight into the received data instead of copying every field into a String
+     * 
+     * @param name The action name, sent by the client in the "action" field of the map
+     * @param callback The callback, called with the action view and the client socket stream as arguments
+     */
+    void addAction(const String &name, ActionViewCallback callback)
+    {
+        commandServer.registerAction(name, callback);
+    }
+    /**
+     * @brief Adds an asynchronous action, which can wait for timers and conditions (see Async.h)
+     *  while the server keeps serving the other clients. Its response is sent once it is done
+     * 
+     * @param name The action name, sent by the client in the "action" field of the map
+     * @param callback The callback, called with the action view, the response stream and the context of its waits
+     */
+    void addAction(const String &name, ActionAsyncCallback callback)
+    {
+        commandServer.registerAction(name, callback);
+    }
+    /**
+     * @brief Adds an upload action, whose payload follows the action frame on the connection and
+     *  is handed to the handler a chunk at a time, checked against the CRC given by the action
+     * 
+     * @param name The action name, sent by the client in the "action" field of the map
+     * @param handler The handler, which has to outlive the server
+     */
+    void addAction(const String &name, UploadHandler &handler)
+    {
+        commandServer.registerAction(name, handler);
+    }
+    /**
+     * @brief The persistent settings store, shared with the WiFi configuration. The updates
+     *  are written to flash by `commit()`, so that several of them cost a single flash write
+     * 
+     * @return Settings& The settings store
+     */
+    Settings &getSettings()
+    {
+        return configuration.getSettings();
+    }
+
+    /**
+     * @brief The memory stats of the server, answering the `__memory` action, with the footprint
+     *  of its components already registered. The application can register its own, or print
+     *  them with `printTo(Serial)`
+     */
+    MemoryStats &getMemoryStats()
+    {
+        return commandServer.getMemoryStats();
+    }
+
+    /**
+     * @brief The time taken by the last connection to the WiFi, in milliseconds
+     */
+    unsigned long getWifiConnectTime() const
+    {
+        return wifiConnector.getConnectTime();
+    }
 
     /**
      * @brief Execute the current server state. It's the core function of the server, has to be executed in loop
@@ -97,39 +181,32 @@ private:
     Configuration configuration;
     StateManager stateManager;
     RemoteControlSettings settings;
+    // The AP and the command server never run at the same time, their buffers share the pool
+    BufferPool pool;
     AccessPointOperations accessPoint;
-    CommandServer<N> commandServer;
+    CommandServer<N, C> commandServer;
     unsigned long lastButtonPress = millis();
-    Optional<std::function<void(void)>> wifiConnectingCallback;
+    WifiConnector<ESP8266WiFiClass> wifiConnector;
 
     bool connectToWlan()
     {
         WiFi.mode(WIFI_STA);
         WiFi.hostname(settings.COMMAND_SERVER_SETTINGS.HOSTNAME);
-        WiFi.begin(configuration.getBSSID(), configuration.getPass());
         Log::println("Connecting...");
-        uint16_t timeout = settings.COMMAND_SERVER_SETTINGS.WIFI_TIMEOUT_S;
-        while (WiFi.status() != WL_CONNECTED)
+
+        WifiHint hint;
+        bool hinted = configuration.getWifiHint(hint);
+        if (!wifiConnector.connect(configuration.getBSSID().c_str(), configuration.getPass().c_str(), hint,
+                                   settings.COMMAND_SERVER_SETTINGS.WIFI_FAST_CONNECT_TIMEOUT_MS,
+                                   settings.COMMAND_SERVER_SETTINGS.WIFI_TIMEOUT_S * 1000UL))
         {
-            if (timeout <= 0)
-            {
-                Log::println("");
-                Log::println("Connection Timeout!");
-                return false;
-            }
-            // Divide 1s delay in 10 iterations of 100ms to allow manual overriding through button
-            for (uint8_t i = 0; i < 10; i++)
-            {
-                if (wifiConnectingCallback.hasValue())
-                {
-                    wifiConnectingCallback.get()();
-                }
-                delay(100);
-            }
-            timeout--;
-            Log::print(".");
+            Log::printfln("Connection Timeout! (%lu ms)", wifiConnector.getConnectTime());
+            return false;
         }
-        Log::println("");
+        Log::printfln("Connected in %lu ms%s", wifiConnector.getConnectTime(),
+                      wifiConnector.getPath() == WIFI_CONNECT_FAST ? " (fast connect)" : hinted ? " (fast connect failed)" : "");
+        // Saved for the next boot, the store writes nothing when the hint didn't change
+        configuration.updateWifiHint(hint);
         Log::printfln("Successfully connected to: %s, with IP: %s", configuration.getBSSID().c_str(), WiFi.localIP().toString().c_str());
         return true;
     }
@@ -1,7 +1,9 @@
 #ifndef REMOTECONTROLSETTINGS_H
 #define REMOTECONTROLSETTINGS_H
 
+#ifndef _TEST_ENV
 #include <ESP8266WiFi.h>
+#endif
 
 struct AccessPointSettings
 {
@@ -31,8 +33,14 @@ struct AccessPointSettings
     int TIMEOUT_MS;
     /** @brief The server certificate in PEM format */
     const char *CERTIFICATE;
-    /** @brief The server private key in PEM format */
+    /** @brief The server private key in PEM format, either RSA or EC */
     const char *PRIVATE_KEY;
+    /** @brief The key type of the certificate issuer (BR_KEYTYPE_RSA or BR_KEYTYPE_EC), only used
+     *  with EC keys. 0 means the same type as the private key, as in self-signed certificates */
+    unsigned CERTIFICATE_ISSUER_KEY_TYPE = 0;
+    /** @brief The number of TLS sessions cached for the clients to resume them, each one
+     *  taking about 100 bytes of RAM. 0 disables the cache */
+    uint32_t TLS_SESSION_CACHE_SIZE = 0;
 };
 
 struct CommandServerSettings
@@ -53,16 +61,54 @@ struct CommandServerSettings
     size_t UDP_PACKET_SIZE;
     /** @brief The rate at which to transmit the UDP packet */
     int UDP_RATE_MS;
+    /** @brief The longest interval between the UDP packets: while no client probes, the interval
+     *  doubles from UDP_RATE_MS up to this one. 0 keeps sending them every UDP_RATE_MS
+     * */
+    int UDP_RATE_MAX_MS = 60000;
+    /** @brief The datagram, up to 32 bytes, a client sends to UDP_PORT to discover the server,
+     *  which answers it straight away with the UDP packet. nullptr leaves the probes unanswered
+     * */
+    const char *UDP_PROBE_PACKET = "RCS_DISCOVER";
     /** @brief The server certificate in PEM format */
     const char *CERTIFICATE;
-    /** @brief The server private key in PEM format */
+    /** @brief The server private key in PEM format, either RSA or EC */
     const char *PRIVATE_KEY;
+    /** @brief The key type of the certificate issuer (BR_KEYTYPE_RSA or BR_KEYTYPE_EC), only used
+     *  with EC keys. 0 means the same type as the private key, as in self-signed certificates */
+    unsigned CERTIFICATE_ISSUER_KEY_TYPE = 0;
+    /** @brief The number of TLS sessions cached for the clients to resume them, each one
+     *  taking about 100 bytes of RAM. 0 disables the cache */
+    uint32_t TLS_SESSION_CACHE_SIZE = 0;
     /** @brief The connection timeout */
     int TIMEOUT_MS;
     /** @brief The timeout after which the device will stop trying to connect to the Wifi
      *  and switch to AP mode instead
      * */
     int WIFI_TIMEOUT_S;
+    /** @brief How long the device tries to reconnect straight to the access point and channel of
+     *  the last connection, before falling back to a full scan. 0 always scans
+     * */
+    int WIFI_FAST_CONNECT_TIMEOUT_MS = 2000;
+    /** @brief The time a persistent connection is kept open while waiting for the next action.
+     *  Clients ask for a persistent connection with `"connection": "keep-alive"` in the action,
+     *  0 disables them and closes every connection after its first action
+     * */
+    int KEEP_ALIVE_MS = 0;
+    /** @brief Whether the reserved `__stats` action answers with the latency histograms
+     *  of the server phases and of each action
+     * */
+    bool STATS_ACTION_ENABLED = false;
+    /** @brief Whether the reserved `__memory` action answers with the memory stats
+     * */
+    bool MEMORY_ACTION_ENABLED = false;
+    /** @brief Whether a client can skip the authentication exchange by sending its credentials
+     *  (a password, a session token or an HMAC) within the first action frame
+     * */
+    bool INLINE_AUTH_ENABLED = false;
+    /** @brief How long the session tokens returned by the password logins are valid,
+     *  0 disables the session tokens
+     * */
+    unsigned long SESSION_TOKEN_LIFETIME_MS = 0;
 };
 
 struct RemoteControlSettings
@@ -4,21 +4,45 @@
 #include "SerialMap.h"
 #include "Common.h"
 
+/**
+ * @brief The common responses, made of a single `result` field and written straight to the
+ *  stream by a SerialFrameWriter, without building a map. They still convert to the ResponseMap
+ *  they used to be returned as
+ */
 class Response
 {
 public:
-    static ResponseMap successResponse()
+    class Result
     {
-        ResponseMap response;
-        response.put("result", "ok");
-        return response;
+    public:
+        explicit Result(const char *value) : value(value) {}
+        /**
+         * @return false If the stream didn't take the whole response
+         */
+        bool write(Stream &stream) const
+        {
+            SerialFrameWriter writer(stream);
+            return writer.put("result", value) && writer.end();
+        }
+        operator ResponseMap() const
+        {
+            ResponseMap response;
+            response.put("result", value);
+            return response;
+        }
+
+    private:
+        const char *value;
+    };
+
+    static Result successResponse()
+    {
+        return Result("ok");
     }
 
-    static ResponseMap errorResponse()
+    static Result errorResponse()
     {
-        ResponseMap response;
-        response.put("result", "error");
-        return response;
+        return Result("error");
     }
 };
 
@@ -0,0 +1,747 @@
+#ifndef SERIAL_FRAME_H
+#define SERIAL_FRAME_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "Logging.h"
+
+enum FRAME_VERSION
+{
+    /** @brief String fields of up to 255 bytes, each length in a single byte */
+    FRAME_V1 = 1,
+    /** @brief Varint lengths and typed values, the frame starting with VERSION_2 */
+    FRAME_V2 = 2
+};
+
+/**
+ * @brief The framing shared by the serialized maps: a sequence of key/value fields, terminated
+ *  by a null byte. In a v1 frame each field is made of a type byte, a length byte and the
+ *  characters. A v2 frame starts with the VERSION_2 byte and its lengths are varints (7 bits
+ *  per byte, least significant first), so that a field can be longer than 255 bytes. Its values
+ *  are typed: a string or a binary value has a varint length, an int is a zigzag varint, a float
+ *  is 4 little-endian bytes and a bool a single byte, 0 or 1
+ */
+struct SerialFrame
+{
+    static constexpr char KEY_TYPE = 0x10;
+    static constexpr char VALUE_TYPE = 0x11;
+    /** @brief The value types of the v2 frames, strings being VALUE_TYPE as in v1 */
+    static constexpr char INT_TYPE = 0x12;
+    static constexpr char FLOAT_TYPE = 0x13;
+    static constexpr char BOOL_TYPE = 0x14;
+    static constexpr char BINARY_TYPE = 0x15;
+    /** @brief The first byte of a v2 frame, which a v1 frame never starts with */
+    static constexpr char VERSION_2 = 0x02;
+    static constexpr int BUFFER_SIZE = 512;
+    static constexpr size_t MAX_VARINT_SIZE = 5;
+    /** @brief The longest header of a field, i.e. its type and length */
+    static constexpr size_t MAX_HEADER_SIZE = 1 + MAX_VARINT_SIZE;
+
+    /**
+     * @brief The version of the serialized data, told by its first byte
+     */
+    static FRAME_VERSION versionOf(const char *buffer, size_t len)
+    {
+        return len > 0 && buffer[0] == VERSION_2 ? FRAME_V2 : FRAME_V1;
+    }
+    /**
+     * @brief Encodes the header of a field, i.e. its type and the length of its data
+     *
+     * @param out The header, at least MAX_HEADER_SIZE bytes
+     * @param type The field type
+     * @param length The data length
+     * @param version The frame version
+     * @return size_t The header size, 0 if a v1 frame can't hold the length
+     */
+    static size_t encodeHeader(uint8_t *out, char type, size_t length, FRAME_VERSION version)
+    {
+        out[0] = type;
+        // The fixed size values go without a length
+        if (type == INT_TYPE || type == FLOAT_TYPE || type == BOOL_TYPE)
+        {
+            return 1;
+        }
+        if (version == FRAME_V1)
+        {
+            if (length > 255)
+            {
+                return 0;
+            }
+            out[1] = (uint8_t)length;
+            return 2;
+        }
+        return 1 + encodeVarint(out + 1, length);
+    }
+    /**
+     * @brief The size of the header of a field whose data has the given length
+     */
+    static size_t headerSize(size_t length, FRAME_VERSION version)
+    {
+        size_t n = 2;
+        for (; version == FRAME_V2 && length >= 0x80; length >>= 7)
+        {
+            n++;
+        }
+        return n;
+    }
+    static size_t encodeVarint(uint8_t *out, uint32_t value)
+    {
+        size_t n = 0;
+        while (value >= 0x80)
+        {
+            out[n++] = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        out[n++] = (uint8_t)value;
+        return n;
+    }
+    /**
+     * @brief Decodes a varint
+     *
+     * @param buffer The data
+     * @param len The data length
+     * @param cursor The position of the varint, moved past it
+     * @param value The value
+     * @return false If the varint is truncated or longer than MAX_VARINT_SIZE
+     */
+    static bool decodeVarint(const char *buffer, size_t len, size_t &cursor, uint32_t &value)
+    {
+        value = 0;
+        for (size_t i = 0; i < MAX_VARINT_SIZE && cursor < len; i++)
+        {
+            uint8_t byte = buffer[cursor++];
+            value |= (uint32_t)(byte & 0x7F) << (7 * i);
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    static uint32_t zigzag(int32_t value)
+    {
+        return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    }
+    static int32_t unzigzag(uint32_t value)
+    {
+        return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+    }
+
+    /**
+     * @brief Reads a serialized frame from the Stream into the given buffer, returning as soon
+     *  as the terminator arrives
+     * 
+     * @param stream The stream
+     * @param timeout The timeout
+     * @param buffer The destination buffer
+     * @param size The size of the destination buffer
+     * @return size_t The size of the frame read, without the terminator. When the frame is
+     *  malformed, incomplete or too big for the buffer, the size of its well-formed part
+     */
+    static size_t read(Stream &stream, int timeout, char *buffer, size_t size);
+
+    /**
+     * @brief Walks through the fields of the serialized data, v1 or v2, stopping at the first
+     *  malformed one
+     * 
+     * @param buffer The data buffer
+     * @param len The buffer size
+     * @param onField The callback, called for every field with the key and value
+     *  slices and the value type as (key, keyLength, value, valueLength, type). The slice of
+     *  an int, float or bool value holds its encoded bytes
+     */
+    template <typename F>
+    static void parse(const char *buffer, size_t len, F onField)
+    {
+        if (versionOf(buffer, len) == FRAME_V2)
+        {
+            parseV2(buffer, len, onField);
+            return;
+        }
+
+        size_t cursor = 0;
+
+        while ((cursor + 2) < len)
+        {
+            if (buffer[cursor++] != KEY_TYPE)
+            {
+                break;
+            }
+
+            unsigned char keyLength = buffer[cursor++];
+
+            if (cursor + keyLength + 2 > len)
+            {
+                break;
+            }
+
+            const char *key = buffer + cursor;
+            cursor += keyLength;
+
+            if (buffer[cursor++] != VALUE_TYPE)
+            {
+                break;
+            }
+
+            unsigned char valueLength = buffer[cursor++];
+
+            if (cursor + valueLength > len)
+            {
+                break;
+            }
+
+            const char *value = buffer + cursor;
+            cursor += valueLength;
+
+            onField(key, keyLength, value, valueLength, VALUE_TYPE);
+        }
+    }
+
+private:
+    template <typename F>
+    static void parseV2(const char *buffer, size_t len, F onField)
+    {
+        size_t cursor = 1;
+        uint32_t keyLength, valueLength;
+
+        while (cursor < len && buffer[cursor] == KEY_TYPE)
+        {
+            cursor++;
+            if (!decodeVarint(buffer, len, cursor, keyLength) || keyLength > len - cursor)
+            {
+                break;
+            }
+            const char *key = buffer + cursor;
+            cursor += keyLength;
+
+            if (cursor >= len)
+            {
+                break;
+            }
+            char type = buffer[cursor++];
+            size_t start = cursor;
+            if (type == VALUE_TYPE || type == BINARY_TYPE)
+            {
+                if (!decodeVarint(buffer, len, cursor, valueLength) || valueLength > len - cursor)
+                {
+                    break;
+                }
+                start = cursor;
+            }
+            else if (type == INT_TYPE)
+            {
+                uint32_t number;
+                if (!decodeVarint(buffer, len, cursor, number))
+                {
+                    break;
+                }
+                valueLength = cursor - start;
+                cursor = start;
+            }
+            else if (type == FLOAT_TYPE || type == BOOL_TYPE)
+            {
+                valueLength = type == FLOAT_TYPE ? 4 : 1;
+                if (valueLength > len - cursor)
+                {
+                    break;
+                }
+            }
+            else
+            {
+                break;
+            }
+            cursor += valueLength;
+
+            onField(key, keyLength, buffer + start, valueLength, type);
+        }
+    }
+};
+
+enum PARSE_RESULT
+{
+    PARSE_NEED_MORE,
+    PARSE_COMPLETE,
+    PARSE_ERROR
+};
+
+/**
+ * @brief An incremental parser of serialized frames. It can be fed any chunk of bytes as they
+ *  are received, keeps its position between the calls and reports whether the frame is complete,
+ *  so it never has to wait for the data. The frame is accumulated in the given buffer, ready to be
+ *  indexed by a SerialMapView or copied into a SerialMap.
+ *
+ *  Both the v1 and the v2 frames are parsed.
+ *  Since the parser knows the length of every field, needed() tells how many bytes can be read
+ *  without going past the end of the frame, and the bytes can be read straight into tail() and
+ *  then parsed with advance(), without copying them around.
+ */
+class SerialFrameParser
+{
+public:
+    SerialFrameParser() = delete;
+    /**
+     * @brief Construct a new Serial Frame Parser
+     *
+     * @param buffer The buffer accumulating the frame
+     * @param size The buffer size. The terminator is read into the buffer too, so the max
+     *  size of the frame is one byte less
+     */
+    SerialFrameParser(char *buffer, size_t size) : buffer(buffer), size(size) {}
+    /**
+     * @brief Discards the current frame, to parse a new one
+     */
+    void reset()
+    {
+        length = 0;
+        state = EXPECT_KEY;
+        remaining = 0;
+        shift = 0;
+        version = FRAME_V1;
+        result = PARSE_NEED_MORE;
+    }
+    /**
+     * @brief Parses the given bytes
+     *
+     * @param data The bytes
+     * @param len The number of bytes
+     * @param consumed If not null, it receives the number of bytes parsed. The bytes following
+     *  a complete frame are not consumed
+     * @return PARSE_RESULT The result of the parsing so far
+     */
+    PARSE_RESULT feed(const char *data, size_t len, size_t *consumed = nullptr)
+    {
+        size_t used = 0;
+        while (used < len && result == PARSE_NEED_MORE)
+        {
+            size_t n = needed();
+            if (n > len - used)
+            {
+                n = len - used;
+            }
+            memcpy(tail(), data + used, n);
+            advance(n);
+            used += n;
+        }
+        if (consumed != nullptr)
+        {
+            *consumed = used;
+        }
+        return result;
+    }
+    /**
+     * @brief The number of bytes the parser can take before it has to look at them, never
+     *  going past the end of the frame nor of the buffer
+     */
+    size_t needed() const
+    {
+        if (result != PARSE_NEED_MORE)
+        {
+            return 0;
+        }
+        size_t n = (state == KEY_DATA || state == VALUE_DATA) ? remaining : 1;
+        return n < size - length ? n : size - length;
+    }
+    /**
+     * @brief Where the next bytes have to be written before calling advance()
+     */
+    char *tail()
+    {
+        return buffer + length;
+    }
+    /**
+     * @brief Parses the given number of bytes written at tail(), at most needed() of them
+     *
+     * @param n The number of bytes
+     * @return PARSE_RESULT The result of the parsing so far
+     */
+    PARSE_RESULT advance(size_t n)
+    {
+        if (result != PARSE_NEED_MORE || n == 0)
+        {
+            return result;
+        }
+        if (state == KEY_DATA || state == VALUE_DATA)
+        {
+            length += n;
+            remaining -= n;
+            if (remaining == 0)
+            {
+                state = state == KEY_DATA ? EXPECT_VALUE : EXPECT_KEY;
+            }
+        }
+        else
+        {
+            char c = buffer[length];
+            switch (state)
+            {
+            case EXPECT_KEY:
+                if (c == '\0')
+                {
+                    // The terminator is not part of the frame
+                    return result = PARSE_COMPLETE;
+                }
+                if (length == 0 && c == SerialFrame::VERSION_2)
+                {
+                    version = FRAME_V2;
+                    break;
+                }
+                if (c != SerialFrame::KEY_TYPE)
+                {
+                    return result = PARSE_ERROR;
+                }
+                state = KEY_LENGTH;
+                remaining = shift = 0;
+                break;
+            case EXPECT_VALUE:
+                remaining = shift = 0;
+                if (c == SerialFrame::VALUE_TYPE || (version == FRAME_V2 && c == SerialFrame::BINARY_TYPE))
+                {
+                    state = VALUE_LENGTH;
+                }
+                else if (version == FRAME_V2 && c == SerialFrame::INT_TYPE)
+                {
+                    state = INT_DATA;
+                }
+                else if (version == FRAME_V2 && (c == SerialFrame::FLOAT_TYPE || c == SerialFrame::BOOL_TYPE))
+                {
+                    remaining = c == SerialFrame::FLOAT_TYPE ? 4 : 1;
+                    state = VALUE_DATA;
+                }
+                else
+                {
+                    return result = PARSE_ERROR;
+                }
+                break;
+            case KEY_LENGTH:
+            case VALUE_LENGTH:
+                if (version == FRAME_V1)
+                {
+                    remaining = static_cast<unsigned char>(c);
+                }
+                else
+                {
+                    remaining |= static_cast<size_t>(c & 0x7F) << shift;
+                    if (c & 0x80)
+                    {
+                        shift += 7;
+                        if (shift >= 7 * SerialFrame::MAX_VARINT_SIZE)
+                        {
+                            return result = PARSE_ERROR;
+                        }
+                        break;
+                    }
+                    // A field longer than the room left can be refused straight away
+                    if (remaining >= size - length - 1)
+                    {
+                        return result = PARSE_ERROR;
+                    }
+                }
+                if (remaining > 0)
+                {
+                    state = state == KEY_LENGTH ? KEY_DATA : VALUE_DATA;
+                }
+                else
+                {
+                    state = state == KEY_LENGTH ? EXPECT_VALUE : EXPECT_KEY;
+                }
+                break;
+            case INT_DATA:
+                if (c & 0x80)
+                {
+                    shift += 7;
+                    if (shift >= 7 * SerialFrame::MAX_VARINT_SIZE)
+                    {
+                        return result = PARSE_ERROR;
+                    }
+                    break;
+                }
+                state = EXPECT_KEY;
+                break;
+            default:
+                break;
+            }
+            length++;
+        }
+        if (length == size)
+        {
+            // No room left for the rest of the frame, or for its terminator
+            result = PARSE_ERROR;
+        }
+        return result;
+    }
+    PARSE_RESULT getResult() const
+    {
+        return result;
+    }
+    /**
+     * @brief The frame parsed so far, without the terminator
+     */
+    const char *data() const
+    {
+        return buffer;
+    }
+    size_t getLength() const
+    {
+        return length;
+    }
+    /**
+     * @brief The version of the frame, known once its first byte is parsed
+     */
+    FRAME_VERSION getVersion() const
+    {
+        return version;
+    }
+
+private:
+    enum STATE
+    {
+        EXPECT_KEY,
+        KEY_LENGTH,
+        KEY_DATA,
+        EXPECT_VALUE,
+        VALUE_LENGTH,
+        VALUE_DATA,
+        /** @brief The bytes of an int value, a varint */
+        INT_DATA
+    };
+
+    char *buffer;
+    size_t size;
+    size_t length = 0;
+    STATE state = EXPECT_KEY;
+    size_t remaining = 0;
+    unsigned shift = 0;
+    FRAME_VERSION version = FRAME_V1;
+    PARSE_RESULT result = PARSE_NEED_MORE;
+};
+
+/**
+ * @brief Writes a frame to a Stream field by field as the fields are produced, so that a response
+ *  is never built as a map, and the values that aren't strings are sent without converting them.
+ *  In a v1 frame the typed values are written as text, and the fields longer than 255 bytes can't
+ *  be written at all.
+ *  The values are sent in pieces no larger than the send window of the stream, i.e. its
+ *  availableForWrite(), yielding in between so that the network stack can drain it. A stream
+ *  telling no window takes whole values, as its writes wait for the room themselves
+ */
+class SerialFrameWriter
+{
+public:
+    SerialFrameWriter() = delete;
+    SerialFrameWriter(const SerialFrameWriter &) = delete;
+    SerialFrameWriter(Stream &stream, FRAME_VERSION version = FRAME_V1) : stream(stream), version(version) {}
+    /**
+     * @brief Writes a string field
+     *
+     * @return false If the frame can't hold the field, or the stream didn't take it whole (see hasFailed())
+     */
+    bool put(const char *key, const char *value)
+    {
+        return put(key, strlen(key), value, strlen(value));
+    }
+    bool put(const char *key, size_t keyLength, const char *value, size_t valueLength)
+    {
+        return field(key, keyLength, SerialFrame::VALUE_TYPE, reinterpret_cast<const uint8_t *>(value), valueLength);
+    }
+    /**
+     * @brief Writes a string field from a string-like object, such as String or std::string
+     */
+    template <typename T>
+    auto put(const char *key, const T &value) -> decltype(value.c_str(), value.length(), bool())
+    {
+        return put(key, strlen(key), value.c_str(), value.length());
+    }
+    /**
+     * @brief Starts a string field whose value is then written in parts through writeValue(),
+     *  e.g. a log or a table produced on the fly, so that it is never held whole
+     *
+     * @param key The key
+     * @param length The length of the whole value, which writeValue() has to make up
+     * @return false If the frame can't hold the field, or the stream didn't take it whole (see hasFailed())
+     */
+    bool beginValue(const char *key, size_t length)
+    {
+        return field(key, strlen(key), SerialFrame::VALUE_TYPE, nullptr, length);
+    }
+    size_t writeValue(const uint8_t *data, size_t length)
+    {
+        if (failed)
+        {
+            return 0;
+        }
+        size_t sent = send(data, length);
+        failed = sent < length;
+        return sent;
+    }
+    size_t writeValue(const char *data, size_t length)
+    {
+        return writeValue(reinterpret_cast<const uint8_t *>(data), length);
+    }
+    bool putInt(const char *key, int32_t value)
+    {
+        if (version == FRAME_V1)
+        {
+            char text[12];
+            return put(key, strlen(key), text, snprintf(text, sizeof(text), "%ld", (long)value));
+        }
+        uint8_t varint[SerialFrame::MAX_VARINT_SIZE];
+        return field(key, strlen(key), SerialFrame::INT_TYPE, varint, SerialFrame::encodeVarint(varint, SerialFrame::zigzag(value)));
+    }
+    bool putFloat(const char *key, float value)
+    {
+        if (version == FRAME_V1)
+        {
+            char text[32];
+            return put(key, strlen(key), text, snprintf(text, sizeof(text), "%g", (double)value));
+        }
+        uint8_t bytes[4];
+        memcpy(bytes, &value, sizeof(bytes));
+        return field(key, strlen(key), SerialFrame::FLOAT_TYPE, bytes, sizeof(bytes));
+    }
+    bool putBool(const char *key, bool value)
+    {
+        if (version == FRAME_V1)
+        {
+            return put(key, value ? "true" : "false");
+        }
+        uint8_t byte = value ? 1 : 0;
+        return field(key, strlen(key), SerialFrame::BOOL_TYPE, &byte, 1);
+    }
+    /**
+     * @brief Writes a binary field, sent as a string in a v1 frame
+     */
+    bool putBinary(const char *key, const uint8_t *data, size_t length)
+    {
+        return field(key, strlen(key), version == FRAME_V1 ? SerialFrame::VALUE_TYPE : SerialFrame::BINARY_TYPE, data, length);
+    }
+    /**
+     * @brief Terminates the frame
+     *
+     * @return false If the frame didn't reach the stream whole
+     */
+    bool end()
+    {
+        const uint8_t terminator = 0;
+        return begin() && write(&terminator, 1);
+    }
+    /**
+     * @brief Whether the stream took less than it was given, e.g. as the client went away. The
+     *  frame is left truncated and the writes after it are dropped
+     */
+    bool hasFailed() const
+    {
+        return failed;
+    }
+    /**
+     * @brief The bytes the stream can take without waiting, 0 if it doesn't tell, so that
+     *  an asynchronous action can produce the fields as the client takes them
+     */
+    int availableForWrite()
+    {
+        return stream.availableForWrite();
+    }
+
+private:
+    Stream &stream;
+    FRAME_VERSION version;
+    bool begun = false;
+    bool failed = false;
+
+    bool begin()
+    {
+        if (!begun && version == FRAME_V2)
+        {
+            const uint8_t prefix = SerialFrame::VERSION_2;
+            write(&prefix, 1);
+        }
+        begun = true;
+        return !failed;
+    }
+    bool field(const char *key, size_t keyLength, char type, const uint8_t *data, size_t length)
+    {
+        uint8_t keyHeader[SerialFrame::MAX_HEADER_SIZE], valueHeader[SerialFrame::MAX_HEADER_SIZE];
+        size_t keyHeaderSize = SerialFrame::encodeHeader(keyHeader, SerialFrame::KEY_TYPE, keyLength, version);
+        size_t valueHeaderSize = SerialFrame::encodeHeader(valueHeader, type, length, version);
+        if (keyHeaderSize == 0 || valueHeaderSize == 0)
+        {
+            return false;
+        }
+        return begin() && write(keyHeader, keyHeaderSize) && write(reinterpret_cast<const uint8_t *>(key), keyLength) &&
+               write(valueHeader, valueHeaderSize) && (data == nullptr || write(data, length));
+    }
+    /**
+     * @brief Writes the whole data, failing the frame on a short write
+     */
+    bool write(const uint8_t *data, size_t length)
+    {
+        if (!failed && send(data, length) < length)
+        {
+            failed = true;
+        }
+        return !failed;
+    }
+    size_t send(const uint8_t *data, size_t length)
+    {
+        size_t sent = 0;
+        while (sent < length)
+        {
+            size_t n = length - sent;
+            int window = stream.availableForWrite();
+            if (window > 0 && (size_t)window < n)
+            {
+                n = window;
+            }
+            size_t written = stream.write(data + sent, n);
+            if (written == 0)
+            {
+                break;
+            }
+            sent += written;
+            if (sent < length)
+            {
+                // Lets the network stack take the data, making room in the window
+                delay(0);
+            }
+        }
+        return sent;
+    }
+};
+
+inline size_t SerialFrame::read(Stream &stream, int timeout, char *buffer, size_t size)
+{
+    SerialFrameParser parser(buffer, size);
+
+    unsigned long start = millis();
+
+    while (parser.getResult() == PARSE_NEED_MORE && millis() - start < (unsigned long)timeout)
+    {
+        int available = stream.available();
+        if (available < 0)
+        {
+            break;
+        }
+        if (available == 0)
+        {
+            // Let the network stack run while waiting
+            delay(0);
+            continue;
+        }
+        size_t n = parser.needed();
+        if (n > (size_t)available)
+        {
+            n = available;
+        }
+        parser.advance(stream.readBytes(parser.tail(), n));
+    }
+
+    Log::printfln("Read chars: %d", (int)parser.getLength());
+
+    return parser.getLength();
+}
+
+#endif // SERIAL_FRAME_H
@@ -7,18 +7,24 @@
 
 #include "Map.h"
 #include "Serializable.h"
+#include "SerialFrame.h"
+#include "SerialSlice.h"
 #include "Logging.h"
 
 /**
- * @brief A serializable map based on the existing implementation with String support
+ * @brief A serializable map based on the existing implementation with String support.
+ *  It decodes both the v1 and the v2 frames, the typed values of the latter becoming text,
+ *  and encodes them in the version of its choice, v1 by default. A v1 map holding a field longer
+ *  than 255 bytes is encoded as v2, as v1 can't hold it
  * 
  * @tparam T The data type used for keys and valued. Generally it has to be a string-like type, such as std::string,
- *  otherwise the provided type must implement a constructor that accepts a null terminated char array, a << stream operator to std::io_stream types
- *  and a length() method
+ *  otherwise the provided type must implement a constructor that accepts a null terminated char array, a << stream operator to std::io_stream types,
+ *  a += operator appending a char, and the reserve(), c_str() and length() methods
  * @tparam S The maximum size of the map in number of elements
+ * @tparam M The underlying map implementation, e.g. a HashMap for hashed lookups
  */
-template <typename T = std::string, int S = 24>
-class SerialMap : public Map<T, T, S>, public Serializable
+template <typename T = std::string, int S = 24, class M = Map<T, T, S>>
+class SerialMap : public M, public Serializable
 {
 public:
     SerialMap() = default;
@@ -31,21 +37,22 @@ public:
      */
     static SerialMap fromStream(Stream &stream, int timeout)
     {
-        int read = 0;
-        char buffer[BUFFER_SIZE];
-
-        unsigned long start = millis();
-
-        while (stream.available() <= 0 && millis() < start + timeout)
-            delay(20);
-
-        while (stream.available() > 0)
-        {
-            read += stream.readBytesUntil('\0', buffer + read, BUFFER_SIZE - read);
-            delay(10);
-        }
-
-        Log::printfln("Read chars: %d", read);
+        char buffer[SerialFrame::BUFFER_SIZE];
+        return fromStream(stream, timeout, buffer, sizeof(buffer));
+    }
+    /**
+     * @brief Construct a new Serial Map object read from a Stream through the given buffer, e.g.
+     *  one drawn from a BufferPool, which is no longer needed once the map is made
+     *
+     * @param stream The stream
+     * @param timeout The timeout
+     * @param buffer The buffer receiving the frame
+     * @param size The buffer size
+     * @return The Serial Map
+     */
+    static SerialMap fromStream(Stream &stream, int timeout, char *buffer, size_t size)
+    {
+        size_t read = SerialFrame::read(stream, timeout, buffer, size);
 
         return SerialMap(buffer, read);
     }
@@ -55,54 +62,21 @@ public:
      * @param buffer The data buffer
      * @param len The buffer size
      */
-    SerialMap(const char *buffer, size_t len)
+    SerialMap(const char *buffer, size_t len) : version(SerialFrame::versionOf(buffer, len))
     {
-        //std::stringstream sst;
-        //sst.write(buffer, len);
-        char buf[257] = {};
-
-        size_t cursor = 0;
-
-        while ((cursor + 2) < len)
-        {
-            if (buffer[cursor++] != KEY_TYPE)
-            {
-                break;
-            }
-
-            unsigned char length = buffer[cursor++];
-
-            if (cursor + length + 2 > len)
-            {
-                break;
-            }
-
-            //sst.read(buf, length);
-            memcpy(buf, buffer + cursor, length);
-            buf[length] = 0;
-            T key(buf);
-            cursor += length;
-
-            if (buffer[cursor++] != VALUE_TYPE)
-            {
-                break;
-            }
-
-            length = buffer[cursor++];
-
-            if (cursor + length > len)
-            {
-                break;
-            }
-
-            //sst.read(buf, length);
-            memcpy(buf, buffer + cursor, length);
-            buf[length] = 0;
-            T value(buf);
-            cursor += length;
-
-            Map<T, T, S>::put(key, value);
-        }
+        SerialFrame::parse(buffer, len, [this](const char *key, size_t keyLength, const char *value, size_t valueLength, char type)
+                           { M::put(make(SerialSlice(key, keyLength)), make(SerialSlice(value, valueLength, type))); });
+    }
+    /**
+     * @brief The version the map is encoded in, that of the frame it was decoded from
+     */
+    FRAME_VERSION getVersion() const
+    {
+        return version;
+    }
+    void setVersion(FRAME_VERSION version)
+    {
+        this->version = version;
     }
 
     /**
@@ -114,10 +88,26 @@ public:
      */
     size_t serialize(char *data, size_t len) const override
     {
+        // The v1 size is worked out along with the version, the v2 one only when needed
+        FRAME_VERSION encoding = version;
         size_t expectedSize = 1;
-        for (int i = 0; i < Map<T, T, S>::size; i++)
+        for (int i = 0; i < M::size; i++)
+        {
+            size_t keyLength = M::keys[i].length(), valueLength = M::values[i].length();
+            if (keyLength > 255 || valueLength > 255)
+            {
+                encoding = FRAME_V2;
+            }
+            expectedSize += 4 + keyLength + valueLength;
+        }
+        if (encoding == FRAME_V2)
         {
-            expectedSize += Map<T, T, S>::keys[i].length() + Map<T, T, S>::values[i].length() + 4;
+            expectedSize = 2;
+            for (int i = 0; i < M::size; i++)
+            {
+                expectedSize += SerialFrame::headerSize(M::keys[i].length(), encoding) + M::keys[i].length() +
+                                SerialFrame::headerSize(M::values[i].length(), encoding) + M::values[i].length();
+            }
         }
 
         if (expectedSize > len)
@@ -126,22 +116,15 @@ public:
         }
 
         size_t written = 0;
-
-        for (int i = 0; i < Map<T, T, S>::size; i++)
+        if (encoding == FRAME_V2)
         {
-            const T &key = Map<T, T, S>::keys[i];
-            const T &value = Map<T, T, S>::values[i];
-
-            data[written++] = KEY_TYPE;
-            data[written++] = (unsigned char)key.length();
-
-            memcpy(data + written, key.c_str(), key.length());
-            written += key.length();
+            data[written++] = SerialFrame::VERSION_2;
+        }
 
-            data[written++] = VALUE_TYPE;
-            data[written++] = (unsigned char)value.length();
-            memcpy(data + written, value.c_str(), value.length());
-            written += value.length();
+        for (int i = 0; i < M::size; i++)
+        {
+            written += encodeField(data + written, SerialFrame::KEY_TYPE, M::keys[i], encoding);
+            written += encodeField(data + written, SerialFrame::VALUE_TYPE, M::values[i], encoding);
         }
 
         data[written++] = '\0';
@@ -156,14 +139,15 @@ public:
      */
     void write(Stream &stream)
     {
-        for (auto it = Map<T, T, S>::begin(); it != Map<T, T, S>::end(); it++)
+        FRAME_VERSION encoding = encodingVersion();
+        if (encoding == FRAME_V2)
+        {
+            stream.write(SerialFrame::VERSION_2);
+        }
+        for (auto it = M::begin(); it != M::end(); it++)
         {
-            stream.write(KEY_TYPE);
-            stream.write(static_cast<unsigned char>((*it).key().length()));
-            stream.write((*it).key().c_str());
-            stream.write(VALUE_TYPE);
-            stream.write(static_cast<unsigned char>((*it).value().length()));
-            stream.write((*it).value().c_str());
+            writeField(stream, SerialFrame::KEY_TYPE, (*it).key(), encoding);
+            writeField(stream, SerialFrame::VALUE_TYPE, (*it).value(), encoding);
         }
         stream.write('\0');
     }
@@ -171,20 +155,96 @@ public:
     void print(Stream &stream)
     {
         stream.print("[ \"");
-        for (int i = 0; i < Map<T, T, S>::size; i++)
+        for (int i = 0; i < M::size; i++)
         {
-            stream.print(Map<T, T, S>::keys[i].c_str());
+            stream.print(M::keys[i].c_str());
             stream.print("\" => \"");
-            stream.print(Map<T, T, S>::values[i].c_str());
+            stream.print(M::values[i].c_str());
             stream.print("\", ");
         }
         stream.println(" ]");
     }
 
 private:
-    static constexpr char KEY_TYPE = 0x10;
-    static constexpr char VALUE_TYPE = 0x11;
-    static constexpr int BUFFER_SIZE = 512; //10kB
+    static constexpr size_t CHUNK_SIZE = 64;
+
+    FRAME_VERSION version = FRAME_V1;
+
+    FRAME_VERSION encodingVersion() const
+    {
+        if (version == FRAME_V2)
+        {
+            return FRAME_V2;
+        }
+        for (int i = 0; i < M::size; i++)
+        {
+            if (M::keys[i].length() > 255 || M::values[i].length() > 255)
+            {
+                return FRAME_V2;
+            }
+        }
+        return FRAME_V1;
+    }
+
+    static size_t encodeField(char *data, char type, const T &field, FRAME_VERSION encoding)
+    {
+        size_t n = 2;
+        if (encoding == FRAME_V1)
+        {
+            data[0] = type;
+            data[1] = (unsigned char)field.length();
+        }
+        else
+        {
+            n = SerialFrame::encodeHeader(reinterpret_cast<uint8_t *>(data), type, field.length(), encoding);
+        }
+        memcpy(data + n, field.c_str(), field.length());
+        return n + field.length();
+    }
+
+    static void writeField(Stream &stream, char type, const T &field, FRAME_VERSION encoding)
+    {
+        uint8_t header[SerialFrame::MAX_HEADER_SIZE];
+        stream.write(header, SerialFrame::encodeHeader(header, type, field.length(), encoding));
+        stream.write(reinterpret_cast<const uint8_t *>(field.c_str()), field.length());
+    }
+
+    static T make(const SerialSlice &slice)
+    {
+        if (!slice.isText())
+        {
+            return T(slice.toString().c_str());
+        }
+        T field;
+        if (slice.getType() == SerialFrame::BINARY_TYPE)
+        {
+            // The bytes may hold nulls, which the strings would stop at
+            field.reserve(slice.length());
+            for (size_t i = 0; i < slice.length(); i++)
+            {
+                field += slice.data()[i];
+            }
+            return field;
+        }
+        // The strings are null terminated in a buffer, a chunk at a time for the longer ones
+        char buf[CHUNK_SIZE + 1];
+        size_t n = slice.length() < CHUNK_SIZE ? slice.length() : CHUNK_SIZE;
+        memcpy(buf, slice.data(), n);
+        buf[n] = 0;
+        if (n == slice.length())
+        {
+            return T(buf);
+        }
+        field.reserve(slice.length());
+        for (size_t i = 0; i < slice.length(); i += n)
+        {
+            n = slice.length() - i < CHUNK_SIZE ? slice.length() - i : CHUNK_SIZE;
+            memcpy(buf, slice.data() + i, n);
+            buf[n] = 0;
+            field += buf;
+        }
+        return field;
+    }
 };
 
 #endif
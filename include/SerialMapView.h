@@ -0,0 +1,141 @@
+#ifndef SERIAL_MAP_VIEW_H
+#define SERIAL_MAP_VIEW_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <string.h>
+#include <utility>
+#include "SerialMap.h"
+#include "SerialSlice.h"
+#include "HashIndex.h"
+
+/**
+ * @brief A read-only map indexing the fields of a serialized frame in place. Keys and values
+ *  are slices of the frame buffer, so parsing allocates nothing, but the view is only valid
+ *  as long as the buffer is
+ *
+ * @tparam S The maximum size of the map in number of elements
+ */
+template <int S = 24>
+class SerialMapView
+{
+public:
+    SerialMapView() = default;
+    /**
+     * @brief Construct a new Serial Map View indexing the given raw data
+     *
+     * @param buffer The data buffer
+     * @param len The buffer size
+     */
+    SerialMapView(const char *buffer, size_t len) : buffer(buffer), len(len), version(SerialFrame::versionOf(buffer, len))
+    {
+        SerialFrame::parse(buffer, len, [this](const char *key, size_t keyLength, const char *value, size_t valueLength, char type)
+                           {
+                               if (size < S)
+                               {
+                                   keys[size] = SerialSlice(key, keyLength);
+                                   values[size] = SerialSlice(value, valueLength, type);
+                                   size++;
+                               }
+                               else
+                               {
+                                   truncated = true;
+                               } });
+    }
+    /**
+     * @brief Read a serialized frame from a Stream into the given buffer and index it
+     *
+     * @param stream The stream
+     * @param timeout The timeout
+     * @param buffer The buffer receiving the data, which has to outlive the view
+     * @param size The buffer size
+     * @return The Serial Map View
+     */
+    static SerialMapView fromStream(Stream &stream, int timeout, char *buffer, size_t size)
+    {
+        return SerialMapView(buffer, SerialFrame::read(stream, timeout, buffer, size));
+    }
+    /**
+     * @brief Gets the value by the given key. When a key is repeated the last value wins,
+     *  as it would in a SerialMap
+     *
+     * @param key The key to search for
+     * @return const SerialSlice* The pointer of the value
+     * @retval nullptr When the key has not been found
+     */
+    template <typename K>
+    const SerialSlice *get(const K &key) const
+    {
+        for (int i = size - 1; i >= 0; i--)
+        {
+            if (keys[i] == key)
+            {
+                return &values[i];
+            }
+        }
+        return nullptr;
+    }
+    template <typename K>
+    bool has(const K &key) const
+    {
+        return get(key) != nullptr;
+    }
+    template <typename K>
+    const SerialSlice *operator[](const K &key) const
+    {
+        return get(key);
+    }
+    /**
+     * @brief Get the number of fields
+     */
+    int getSize() const
+    {
+        return size;
+    }
+    /**
+     * @brief Whether the frame holds more fields than the view indexes, the last ones being left out
+     */
+    bool isTruncated() const
+    {
+        return truncated;
+    }
+    const SerialSlice &keyAt(int index) const
+    {
+        return keys[index];
+    }
+    const SerialSlice &valueAt(int index) const
+    {
+        return values[index];
+    }
+    /**
+     * @brief The frame this view indexes, e.g. to build a SerialMap out of it
+     */
+    const char *data() const
+    {
+        return buffer;
+    }
+    size_t length() const
+    {
+        return len;
+    }
+    /**
+     * @brief The version of the frame, e.g. to answer in the same one
+     */
+    FRAME_VERSION getVersion() const
+    {
+        return version;
+    }
+
+private:
+    const char *buffer = nullptr;
+    size_t len = 0;
+    FRAME_VERSION version = FRAME_V1;
+    SerialSlice keys[S];
+    SerialSlice values[S];
+    int size = 0;
+    bool truncated = false;
+};
+
+#endif // SERIAL_MAP_VIEW_H
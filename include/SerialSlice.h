@@ -0,0 +1,243 @@
+#ifndef SERIAL_SLICE_H
+#define SERIAL_SLICE_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SerialFrame.h"
+#include "HashIndex.h"
+
+/**
+ * @brief A read-only slice of characters pointing into a buffer owned by someone else.
+ *  The characters are not null terminated. The values of the v2 frames are typed: the slice of
+ *  an int, float or bool holds its encoded bytes, and reads as text through toString() and the
+ *  comparisons, while the strings and binaries read as numbers through toInt() and toFloat()
+ */
+class SerialSlice
+{
+public:
+    SerialSlice() = default;
+    SerialSlice(const char *data, size_t length, char type = SerialFrame::VALUE_TYPE) : ptr(data), len(length), type(type) {}
+
+    const char *data() const
+    {
+        return ptr;
+    }
+    size_t length() const
+    {
+        return len;
+    }
+    /**
+     * @brief The value type, SerialFrame::VALUE_TYPE for the strings
+     */
+    char getType() const
+    {
+        return type;
+    }
+    /**
+     * @brief Whether the slice holds characters or bytes, i.e. a string or a binary value
+     */
+    bool isText() const
+    {
+        return type == SerialFrame::VALUE_TYPE || type == SerialFrame::BINARY_TYPE;
+    }
+    /**
+     * @brief Checks if the slice holds exactly the given characters, comparing the typed
+     *  values as text
+     *
+     * @param str The characters
+     * @param length The number of characters
+     */
+    bool equals(const char *str, size_t length) const
+    {
+        if (!isText())
+        {
+            char text[TEXT_SIZE];
+            return format(text) == length && memcmp(text, str, length) == 0;
+        }
+        return len == length && memcmp(ptr, str, length) == 0;
+    }
+    bool operator==(const char *str) const
+    {
+        return equals(str, strlen(str));
+    }
+    bool operator==(const SerialSlice &other) const
+    {
+        return equals(other.data(), other.length());
+    }
+    /**
+     * @brief Compares the slice with a string-like object, such as String or std::string
+     */
+    template <typename T>
+    auto operator==(const T &str) const -> decltype(str.c_str(), str.length(), bool())
+    {
+        return equals(str.c_str(), str.length());
+    }
+    template <typename T>
+    bool operator!=(const T &str) const
+    {
+        return !(*this == str);
+    }
+    /**
+     * @brief Parses the slice as a decimal integer, like String::toInt does
+     *
+     * @return long The number, or 0 if the slice does not start with a number
+     */
+    long toInt() const
+    {
+        if (type == SerialFrame::INT_TYPE)
+        {
+            size_t cursor = 0;
+            uint32_t value = 0;
+            SerialFrame::decodeVarint(ptr, len, cursor, value);
+            return SerialFrame::unzigzag(value);
+        }
+        if (type == SerialFrame::FLOAT_TYPE)
+        {
+            return (long)toFloat();
+        }
+        if (type == SerialFrame::BOOL_TYPE)
+        {
+            return toBool() ? 1 : 0;
+        }
+        size_t i = 0;
+        bool negative = false;
+        if (len > 0 && (ptr[0] == '-' || ptr[0] == '+'))
+        {
+            negative = ptr[i++] == '-';
+        }
+        long result = 0;
+        for (; i < len && ptr[i] >= '0' && ptr[i] <= '9'; i++)
+        {
+            result = result * 10 + (ptr[i] - '0');
+        }
+        return negative ? -result : result;
+    }
+    /**
+     * @brief Parses the slice as a decimal number, like String::toFloat does
+     */
+    float toFloat() const
+    {
+        if (type == SerialFrame::FLOAT_TYPE)
+        {
+            // The float is little-endian, as both the ESP8266 and the usual hosts are
+            float value;
+            memcpy(&value, ptr, sizeof(value));
+            return value;
+        }
+        if (type == SerialFrame::INT_TYPE || type == SerialFrame::BOOL_TYPE)
+        {
+            return (float)toInt();
+        }
+        char text[TEXT_SIZE];
+        size_t n = len < sizeof(text) - 1 ? len : sizeof(text) - 1;
+        memcpy(text, ptr, n);
+        text[n] = '\0';
+        return strtof(text, nullptr);
+    }
+    /**
+     * @brief Reads the slice as a bool, the strings being true when "true" or "1"
+     */
+    bool toBool() const
+    {
+        if (type == SerialFrame::BOOL_TYPE)
+        {
+            return len > 0 && ptr[0] != 0;
+        }
+        if (type == SerialFrame::INT_TYPE || type == SerialFrame::FLOAT_TYPE)
+        {
+            return toFloat() != 0;
+        }
+        return equals("true", 4) || equals("1", 1);
+    }
+    /**
+     * @brief Copies the slice into a new String, the typed values written as text
+     */
+    String toString() const
+    {
+        if (!isText())
+        {
+            char text[TEXT_SIZE];
+            format(text);
+            return String(text);
+        }
+        String str;
+        str.reserve(len);
+        for (size_t i = 0; i < len; i++)
+        {
+            str += ptr[i];
+        }
+        return str;
+    }
+    /**
+     * @brief Hashes the slice as the text it compares equal to, so that a typed value
+     *  hashes like the same value sent as a string
+     */
+    uint32_t hash() const
+    {
+        if (!isText())
+        {
+            char text[TEXT_SIZE];
+            return fnv1a(text, format(text));
+        }
+        return fnv1a(ptr, len);
+    }
+
+private:
+    static constexpr size_t TEXT_SIZE = 32;
+
+    const char *ptr = nullptr;
+    uint32_t len = 0;
+    char type = SerialFrame::VALUE_TYPE;
+
+    /**
+     * @brief Writes an int, float or bool value as text
+     *
+     * @return size_t The text length
+     */
+    size_t format(char (&text)[TEXT_SIZE]) const
+    {
+        int n;
+        if (type == SerialFrame::FLOAT_TYPE)
+        {
+            n = snprintf(text, TEXT_SIZE, "%g", (double)toFloat());
+        }
+        else if (type == SerialFrame::BOOL_TYPE)
+        {
+            n = snprintf(text, TEXT_SIZE, "%s", toBool() ? "true" : "false");
+        }
+        else
+        {
+            n = snprintf(text, TEXT_SIZE, "%ld", toInt());
+        }
+        return n > 0 ? n : 0;
+    }
+};
+
+// These compare through equals(), as under C++20 `slice == str` would pick the reversed
+// operator again
+inline bool operator==(const char *str, const SerialSlice &slice)
+{
+    return slice.equals(str, strlen(str));
+}
+
+template <typename T>
+auto operator==(const T &str, const SerialSlice &slice) -> decltype(str.c_str(), str.length(), bool())
+{
+    return slice.equals(str.c_str(), str.length());
+}
+
+template <>
+struct MapHash<SerialSlice>
+{
+    uint32_t operator()(const SerialSlice &key) const
+    {
+        return key.hash();
+    }
+};
+
+#endif // SERIAL_SLICE_H
@@ -0,0 +1,52 @@
+#ifndef SERVER_CREDENTIALS_H
+#define SERVER_CREDENTIALS_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+/**
+ * @brief The TLS identity of a server: its certificate, its private key and, optionally,
+ *  a cache of the sessions negotiated with the clients, so that a returning client can
+ *  resume its session with an abbreviated handshake instead of a full private key operation
+ */
+class ServerCredentials
+{
+public:
+  ServerCredentials() = delete;
+  ServerCredentials(const ServerCredentials &) = delete;
+  /**
+   * @brief Construct a new Server Credentials object
+   * 
+   * @param certificate The server certificate in PEM format
+   * @param privateKey The server private key in PEM format, either RSA or EC
+   * @param issuerKeyType The key type of the certificate issuer (BR_KEYTYPE_RSA or BR_KEYTYPE_EC),
+   *  only used with EC keys. 0 means the issuer has the same key type, as in self-signed certificates
+   * @param sessionCacheSize The number of TLS sessions to cache, 0 disables the cache
+   */
+  ServerCredentials(const char *certificate, const char *privateKey,
+                    unsigned issuerKeyType = 0, uint32_t sessionCacheSize = 0);
+  /**
+   * @brief Sets up the given server with the certificate, the key and the session cache
+   * 
+   * @param server The server
+   */
+  void apply(BearSSL::WiFiServerSecure &server);
+  /**
+   * @brief The heap taken by the parsed certificate, the key and the session cache
+   */
+  size_t getHeapUsed() const
+  {
+    return heapUsed;
+  }
+
+private:
+  // Sampled before the members below are constructed
+  uint32_t heapUsed;
+  BearSSL::X509List certificate;
+  BearSSL::PrivateKey privateKey;
+  BearSSL::ServerSessions sessions;
+  unsigned issuerKeyType;
+  uint32_t sessionCacheSize;
+};
+
+#endif // SERVER_CREDENTIALS_H
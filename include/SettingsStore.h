@@ -0,0 +1,319 @@
+#ifndef SETTINGS_STORE_H
+#define SETTINGS_STORE_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include "HashIndex.h"
+#include "SerialMapView.h"
+#include "Crc32.h"
+
+/**
+ * @brief A key/value settings store kept as a log of records in the emulated EEPROM.
+ *  An update appends a record instead of rewriting the data in place, and the updates are only
+ *  written to flash by commit(), so that several of them cost a single sector write. When the log
+ *  is full, the records superseded by newer ones are compacted away.
+ *  Each record is `<key length><value length><key><value><CRC32>`, a value length of 0xFF marking
+ *  a removed key and a key length of 0xFF the end of the log. A record failing its CRC, e.g. a
+ *  torn write, ends the log as well. A RAM index maps each key to its latest value, so reads
+ *  never scan the log
+ *
+ * @tparam E The EEPROM type, such as EEPROMClass
+ * @tparam K The maximum number of keys
+ */
+template <class E, int K = 16>
+class SettingsStore
+{
+public:
+  /** @brief The longest key or value */
+  static constexpr size_t MAX_LENGTH = 254;
+
+  SettingsStore() = delete;
+  SettingsStore(const SettingsStore &) = delete;
+  /**
+   * @brief Construct a new Settings Store over a region of the EEPROM, which has to be begun
+   *
+   * @param eeprom The EEPROM
+   * @param offset The first byte of the region
+   * @param size The region size
+   */
+  SettingsStore(E &eeprom, size_t offset, size_t size) : eeprom(eeprom), offset(offset), size(size) {}
+  /**
+   * @brief Loads the log from the EEPROM, building the index
+   *
+   * @return false If the region doesn't hold a log, which format() then creates
+   */
+  bool load()
+  {
+    index.clear();
+    end = 0;
+    const uint8_t *data = region();
+    if (size < HEADER_SIZE + 1 || memcmp(data, MAGIC, HEADER_SIZE) != 0)
+    {
+      return false;
+    }
+    end = scan();
+    return true;
+  }
+  /**
+   * @brief Erases every setting, starting an empty log. Like the updates, it is written by commit()
+   */
+  void format()
+  {
+    uint8_t *data = writableRegion();
+    memcpy(data, MAGIC, HEADER_SIZE);
+    data[HEADER_SIZE] = END;
+    index.clear();
+    end = HEADER_SIZE;
+    dirty = true;
+  }
+  /**
+   * @brief Gets the value of a key, pointing into the EEPROM data until the next update
+   *
+   * @return const SerialSlice* The value, nullptr if the key is not set
+   */
+  const SerialSlice *get(const char *key) const
+  {
+    return index.get(SerialSlice(key, strlen(key)));
+  }
+  bool has(const char *key) const
+  {
+    return get(key) != nullptr;
+  }
+  /**
+   * @brief Sets the value of a key, doing nothing if it already holds that value
+   *
+   * @return false If the key or the value are too long, or the store is full
+   */
+  bool put(const char *key, const char *value)
+  {
+    return put(key, strlen(key), value, strlen(value));
+  }
+  bool put(const char *key, size_t keyLength, const char *value, size_t valueLength)
+  {
+    if (keyLength == 0 || keyLength > MAX_LENGTH || valueLength > MAX_LENGTH)
+    {
+      return false;
+    }
+    const SerialSlice *current = index.get(SerialSlice(key, keyLength));
+    if (current != nullptr && current->equals(value, valueLength))
+    {
+      return true;
+    }
+    if (current == nullptr && index.getSize() >= K)
+    {
+      return false;
+    }
+    return append(key, keyLength, value, valueLength, (uint8_t)valueLength);
+  }
+  /**
+   * @brief Removes a key
+   *
+   * @return false If the store is full
+   */
+  bool remove(const char *key)
+  {
+    size_t keyLength = strlen(key);
+    if (index.get(SerialSlice(key, keyLength)) == nullptr)
+    {
+      return true;
+    }
+    return append(key, keyLength, nullptr, 0, REMOVED);
+  }
+  /**
+   * @brief Writes the updates made since the last commit to flash
+   */
+  bool commit()
+  {
+    if (!dirty)
+    {
+      return true;
+    }
+    dirty = false;
+    return eeprom.commit();
+  }
+  /**
+   * @brief Whether there are updates waiting for a commit
+   */
+  bool isDirty() const
+  {
+    return dirty;
+  }
+  int getSize() const
+  {
+    return index.getSize();
+  }
+  /**
+   * @brief The bytes taken by the log, superseded records included
+   */
+  size_t getUsed() const
+  {
+    return end;
+  }
+  size_t getCapacity() const
+  {
+    return size;
+  }
+  /**
+   * @brief The number of compactions since construction
+   */
+  unsigned getCompactions() const
+  {
+    return compactions;
+  }
+
+private:
+  static constexpr size_t HEADER_SIZE = 4;
+  static constexpr const char *MAGIC = "RCS1";
+  static constexpr size_t RECORD_OVERHEAD = 2 + 4;
+  static constexpr uint8_t END = 0xFF;
+  static constexpr uint8_t REMOVED = 0xFF;
+
+  E &eeprom;
+  size_t offset, size;
+  size_t end = 0;
+  bool dirty = false;
+  unsigned compactions = 0;
+  HashMap<SerialSlice, SerialSlice, K> index;
+
+  const uint8_t *region() const
+  {
+    return eeprom.getConstDataPtr() + offset;
+  }
+  // Asking the EEPROM for writable data marks it as changed
+  uint8_t *writableRegion()
+  {
+    return eeprom.getDataPtr() + offset;
+  }
+
+  static size_t recordLength(uint8_t keyLength, uint8_t valueLength)
+  {
+    return RECORD_OVERHEAD + keyLength + (valueLength == REMOVED ? 0 : valueLength);
+  }
+
+  /**
+   * @brief Reads the records from the start of the log, indexing them
+   *
+   * @return size_t The end of the log
+   */
+  size_t scan()
+  {
+    const uint8_t *data = region();
+    size_t position = HEADER_SIZE;
+    while (position + RECORD_OVERHEAD <= size && data[position] != END && data[position] != 0)
+    {
+      uint8_t keyLength = data[position], valueLength = data[position + 1];
+      size_t length = recordLength(keyLength, valueLength);
+      if (position + length > size)
+      {
+        break;
+      }
+      uint32_t stored;
+      memcpy(&stored, data + position + length - 4, 4);
+      if (crc32(data + position, length - 4) != stored)
+      {
+        break;
+      }
+      indexRecord(data + position);
+      position += length;
+    }
+    return position;
+  }
+
+  void indexRecord(const uint8_t *record)
+  {
+    uint8_t keyLength = record[0], valueLength = record[1];
+    SerialSlice key(reinterpret_cast<const char *>(record + 2), keyLength);
+    // The key of an updated setting is indexed again along with its value, so that both point
+    // into the latest record, which compact() finds through the key
+    index.remove(key);
+    if (valueLength != REMOVED)
+    {
+      index.put(key, SerialSlice(key.data() + keyLength, valueLength));
+    }
+  }
+
+  bool append(const char *key, size_t keyLength, const char *value, size_t valueLength, uint8_t lengthByte)
+  {
+    size_t length = recordLength((uint8_t)keyLength, lengthByte);
+    // The key and the value may point into the log itself, they are copied before it moves
+    char copy[2 * MAX_LENGTH];
+    // One byte is always left for the end marker
+    if (end + length + 1 > size)
+    {
+      memcpy(copy, key, keyLength);
+      if (valueLength > 0)
+      {
+        memcpy(copy + keyLength, value, valueLength);
+      }
+      compact();
+      if (end + length + 1 > size)
+      {
+        return false;
+      }
+      key = copy;
+      value = copy + keyLength;
+    }
+
+    uint8_t *record = writableRegion() + end;
+    record[0] = (uint8_t)keyLength;
+    record[1] = lengthByte;
+    memcpy(record + 2, key, keyLength);
+    if (valueLength > 0)
+    {
+      memcpy(record + 2 + keyLength, value, valueLength);
+    }
+    uint32_t crc = crc32(record, length - 4);
+    memcpy(record + length - 4, &crc, 4);
+    record[length] = END;
+
+    indexRecord(record);
+    end += length;
+    dirty = true;
+    return true;
+  }
+
+  /**
+   * @brief Moves the live records to the start of the log, in place and in order, dropping
+   *  the superseded and removed ones
+   */
+  void compact()
+  {
+    uint8_t *data = writableRegion();
+
+    // The records the index points to, in log order. The index can't be searched while
+    // moving the records, as its keys point into the log
+    size_t live[K];
+    int count = 0;
+    for (auto it = index.begin(); it != index.end(); it++)
+    {
+      size_t position = reinterpret_cast<const uint8_t *>((*it).key().data()) - 2 - data;
+      int i = count++;
+      for (; i > 0 && live[i - 1] > position; i--)
+      {
+        live[i] = live[i - 1];
+      }
+      live[i] = position;
+    }
+
+    size_t write = HEADER_SIZE;
+    for (int i = 0; i < count; i++)
+    {
+      size_t length = recordLength(data[live[i]], data[live[i] + 1]);
+      memmove(data + write, data + live[i], length);
+      write += length;
+    }
+    data[write] = END;
+    compactions++;
+    dirty = true;
+
+    // The index points to the old positions
+    index.clear();
+    end = scan();
+  }
+};
+
+#endif // SETTINGS_STORE_H
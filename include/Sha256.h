@@ -0,0 +1,187 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * @brief An incremental SHA-256, small enough to be shared by the device and the native tests
+ */
+class Sha256
+{
+public:
+  static constexpr size_t DIGEST_SIZE = 32;
+  static constexpr size_t BLOCK_SIZE = 64;
+
+  Sha256()
+  {
+    reset();
+  }
+  void reset()
+  {
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(state, initial, sizeof(state));
+    total = 0;
+    used = 0;
+  }
+  void update(const void *data, size_t len)
+  {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    total += len;
+    while (len > 0)
+    {
+      size_t n = BLOCK_SIZE - used;
+      if (n > len)
+      {
+        n = len;
+      }
+      memcpy(block + used, bytes, n);
+      used += n;
+      bytes += n;
+      len -= n;
+      if (used == BLOCK_SIZE)
+      {
+        compress();
+        used = 0;
+      }
+    }
+  }
+  /**
+   * @brief Pads the data and writes the digest. The hash has to be reset before being used again
+   */
+  void finish(uint8_t digest[DIGEST_SIZE])
+  {
+    uint64_t bits = total * 8;
+    uint8_t padding = 0x80;
+    update(&padding, 1);
+    padding = 0;
+    while (used != BLOCK_SIZE - 8)
+    {
+      update(&padding, 1);
+    }
+    uint8_t length[8];
+    for (int i = 0; i < 8; i++)
+    {
+      length[i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    update(length, sizeof(length));
+    for (int i = 0; i < 8; i++)
+    {
+      digest[4 * i] = (uint8_t)(state[i] >> 24);
+      digest[4 * i + 1] = (uint8_t)(state[i] >> 16);
+      digest[4 * i + 2] = (uint8_t)(state[i] >> 8);
+      digest[4 * i + 3] = (uint8_t)state[i];
+    }
+  }
+
+private:
+  uint32_t state[8];
+  uint64_t total;
+  uint8_t block[BLOCK_SIZE];
+  size_t used;
+
+  static uint32_t rotate(uint32_t x, int n)
+  {
+    return (x >> n) | (x << (32 - n));
+  }
+
+  void compress()
+  {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+    {
+      w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+             (uint32_t)block[4 * i + 2] << 8 | (uint32_t)block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+      uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+             e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++)
+    {
+      uint32_t t1 = h + (rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+      uint32_t t2 = (rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+};
+
+/**
+ * @brief An incremental HMAC-SHA256
+ */
+class HmacSha256
+{
+public:
+  HmacSha256(const void *key, size_t keyLength)
+  {
+    uint8_t block[Sha256::BLOCK_SIZE] = {};
+    uint8_t innerPad[Sha256::BLOCK_SIZE];
+    if (keyLength > Sha256::BLOCK_SIZE)
+    {
+      Sha256 hash;
+      hash.update(key, keyLength);
+      hash.finish(block);
+    }
+    else
+    {
+      memcpy(block, key, keyLength);
+    }
+    for (size_t i = 0; i < Sha256::BLOCK_SIZE; i++)
+    {
+      innerPad[i] = block[i] ^ 0x36;
+      outerPad[i] = block[i] ^ 0x5c;
+    }
+    inner.update(innerPad, sizeof(innerPad));
+  }
+  void update(const void *data, size_t len)
+  {
+    inner.update(data, len);
+  }
+  void finish(uint8_t mac[Sha256::DIGEST_SIZE])
+  {
+    uint8_t digest[Sha256::DIGEST_SIZE];
+    inner.finish(digest);
+    Sha256 outer;
+    outer.update(outerPad, sizeof(outerPad));
+    outer.update(digest, sizeof(digest));
+    outer.finish(mac);
+  }
+
+private:
+  uint8_t outerPad[Sha256::BLOCK_SIZE];
+  Sha256 inner;
+};
+
+#endif // SHA256_H
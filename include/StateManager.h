@@ -1,8 +1,8 @@
 #ifndef STATE_MANAGER_H
 #define STATE_MANAGER_H
 
-#include <functional>
 #include "Map.h"
+#include "InplaceFunction.h"
 
 enum MACHINE_STATE
 {
@@ -21,7 +21,7 @@ public:
    * @param state The state to which associate the function
    * @param callback The callback function
    */
-  void registerStateFunction(MACHINE_STATE state, std::function<void(void)> callback);
+  void registerStateFunction(MACHINE_STATE state, InplaceFunction<void(void)> callback);
   /**
    * @brief Sets the current state
    * 
@@ -42,7 +42,7 @@ public:
 
 private:
   MACHINE_STATE state = CONNECTING;
-  Map<MACHINE_STATE, std::function<void(void)>, 3> callbacks;
+  Map<MACHINE_STATE, InplaceFunction<void(void)>, 3> callbacks;
 };
 
 #endif // STATE_MANAGER_H
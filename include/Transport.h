@@ -0,0 +1,32 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+/*
+ * The CommandServer reaches the network through a transport, a class providing:
+ *
+ *  - `typedef ... Client`, a copyable handle to an accepted connection: a Stream with
+ *    `read(uint8_t *, size_t)`, `connected()`, `stop()`, `remoteIP().toString()` and `remotePort()`;
+ *  - a constructor taking the CommandServerSettings;
+ *  - `bool begin()`, starting to listen on the server port;
+ *  - `bool accept(Client &client)`, taking a pending connection without waiting for one,
+ *    the TLS handshake included;
+ *  - `typedef ... Udp`, a UDP socket with the WiFiUDP methods used by the DiscoveryResponder:
+ *    `parsePacket()`, `read(char *, size_t)`, `remoteIP()`, `remotePort()`, `beginPacket(IPAddress, port)`,
+ *    `write(const uint8_t *, size_t)` and `endPacket()`;
+ *  - `Udp &getUdp()`, the socket bound to the UDP_PORT by begin();
+ *  - `IPAddress getBroadcastIP()`, where the discovery beacons go;
+ *  - `void idle(bool busy)`, called at the end of every server loop, `busy` telling whether
+ *    a connection is open;
+ *  - `void stop()`.
+ *
+ * The device uses the WiFiTransport, the native environment the PosixTransport
+ */
+#ifdef _TEST_ENV
+#include "PosixTransport.h"
+typedef PosixTransport DefaultTransport;
+#else
+#include "WiFiTransport.h"
+typedef WiFiTransport DefaultTransport;
+#endif
+
+#endif // TRANSPORT_H
@@ -0,0 +1,245 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#endif
+
+#include <stdint.h>
+#include "Crc32.h"
+#include "LatencyHistogram.h"
+#include "Common.h"
+
+/**
+ * @brief The receiver of an upload action, e.g. a file or a firmware image. The payload follows
+ *  the action frame on the connection as raw bytes and is handed over in chunks as they arrive,
+ *  so it is never held whole in memory. The action frame gives the payload `length` in bytes and
+ *  its `crc32` in hex: the upload is committed once the whole payload has been received with
+ *  a matching CRC, and aborted otherwise
+ */
+class UploadHandler
+{
+public:
+  virtual ~UploadHandler() = default;
+  /**
+   * @brief Starts an upload
+   *
+   * @param action The action frame, only valid during the call
+   * @param length The payload length
+   * @return false To refuse the upload, which is answered with an error
+   */
+  virtual bool begin(ActionView &action, size_t length) = 0;
+  /**
+   * @brief How many bytes write() can take right now. The rest of the payload is left in the
+   *  socket meanwhile, so that the client is held back by the TCP window. A handler stalled for
+   *  longer than the server timeout is aborted
+   */
+  virtual size_t availableForWrite()
+  {
+    return SIZE_MAX;
+  }
+  /**
+   * @brief Takes the next chunk of the payload, no longer than availableForWrite()
+   *
+   * @return false To abort the upload, e.g. when the chunk can't be stored
+   */
+  virtual bool write(const uint8_t *data, size_t len) = 0;
+  /**
+   * @brief Ends the upload, once the whole payload has been written and checked
+   *
+   * @param output The response stream
+   * @return true To terminate the server, as the action callbacks do
+   */
+  virtual bool commit(Stream &output) = 0;
+  /**
+   * @brief Drops the upload, after a CRC mismatch, a refused chunk, a timeout or the client
+   *  going away
+   */
+  virtual void abort() {}
+};
+
+enum UPLOAD_RESULT
+{
+  UPLOAD_NEED_MORE,
+  /** @brief The whole payload has been written and its CRC matches, it can be committed */
+  UPLOAD_COMPLETE,
+  /** @brief The upload has been aborted */
+  UPLOAD_FAILED
+};
+
+/**
+ * @brief An upload running on behalf of a client, reading its payload without ever blocking
+ */
+class UploadTask
+{
+public:
+  /** @brief The reads at every poll, so that a fast upload can't stall the other clients */
+  static constexpr int MAX_READS_PER_POLL = 4;
+
+  UploadTask() = default;
+  UploadTask(const UploadTask &) = delete;
+  /**
+   * @brief Starts the upload, whose payload is read by the following polls
+   *
+   * @param handler The handler, which has to outlive the task
+   * @param action The action frame, giving the payload length and CRC
+   * @param latency If not null, receives the time taken by the upload
+   * @return false If the length or the CRC are missing, or the handler refused the upload
+   */
+  bool start(UploadHandler &handler, ActionView &action, LatencyHistogram *latency = nullptr)
+  {
+    running = false;
+    const SerialSlice *size = action.get("length");
+    const SerialSlice *checksum = action.get("crc32");
+    long declared = size != nullptr ? size->toInt() : -1;
+    if (declared < 0 || checksum == nullptr || !parseHex(*checksum, expected) || !handler.begin(action, declared))
+    {
+      return false;
+    }
+
+    this->handler = &handler;
+    this->latency = latency;
+    length = declared;
+    received = 0;
+    crc = 0;
+    started = micros();
+    since = millis();
+    running = true;
+    return true;
+  }
+  /**
+   * @brief Reads the payload received so far, as far as the handler takes it
+   *
+   * @param client The client
+   * @param buffer The buffer the chunks are read into, which can be reused between the polls
+   * @param size The buffer size, i.e. the longest chunk
+   * @return UPLOAD_RESULT Whether the payload is complete, the upload failed or is still going
+   */
+  template <class Client>
+  UPLOAD_RESULT poll(Client &client, uint8_t *buffer, size_t size)
+  {
+    if (!running)
+    {
+      return UPLOAD_FAILED;
+    }
+    for (int i = 0; i < MAX_READS_PER_POLL && received < length; i++)
+    {
+      size_t n = length - received;
+      size_t writable = handler->availableForWrite();
+      int available = client.available();
+      n = n < size ? n : size;
+      n = n < writable ? n : writable;
+      if (available <= 0 || n == 0)
+      {
+        break;
+      }
+      n = n < (size_t)available ? n : available;
+      int read = client.read(buffer, n);
+      if (read <= 0)
+      {
+        break;
+      }
+      received += read;
+      crc = crc32(buffer, read, crc);
+      since = millis();
+      if (!handler->write(buffer, read))
+      {
+        cancel();
+        return UPLOAD_FAILED;
+      }
+    }
+
+    if (received < length)
+    {
+      return UPLOAD_NEED_MORE;
+    }
+    if (crc != expected)
+    {
+      cancel();
+      return UPLOAD_FAILED;
+    }
+    return UPLOAD_COMPLETE;
+  }
+  /**
+   * @brief Commits the complete upload
+   *
+   * @param output The response stream
+   * @return bool Whether the server has to terminate
+   */
+  bool commit(Stream &output)
+  {
+    running = false;
+    bool result = handler->commit(output);
+    if (latency != nullptr)
+    {
+      latency->record(micros() - started);
+    }
+    return result;
+  }
+  /**
+   * @brief Aborts the upload, e.g. when its client is gone
+   */
+  void cancel()
+  {
+    if (running)
+    {
+      running = false;
+      handler->abort();
+    }
+  }
+  /**
+   * @brief Whether no byte has been received for longer than the given timeout
+   */
+  bool timedOut(unsigned long timeout) const
+  {
+    return millis() - since >= timeout;
+  }
+  bool isRunning() const
+  {
+    return running;
+  }
+  size_t getReceived() const
+  {
+    return received;
+  }
+  size_t getLength() const
+  {
+    return length;
+  }
+
+private:
+  UploadHandler *handler = nullptr;
+  LatencyHistogram *latency = nullptr;
+  size_t length = 0, received = 0;
+  uint32_t crc = 0, expected = 0;
+  unsigned long started = 0, since = 0;
+  bool running = false;
+
+  static bool parseHex(const SerialSlice &text, uint32_t &value)
+  {
+    if (!text.isText() || text.length() == 0 || text.length() > 8)
+    {
+      return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < text.length(); i++)
+    {
+      char c = text.data()[i] | 0x20;
+      if (c >= '0' && c <= '9')
+      {
+        value = (value << 4) | (c - '0');
+      }
+      else if (c >= 'a' && c <= 'f')
+      {
+        value = (value << 4) | (c - 'a' + 10);
+      }
+      else
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+#endif // UPLOAD_H
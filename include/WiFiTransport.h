@@ -0,0 +1,42 @@
+#ifndef WIFI_TRANSPORT_H
+#define WIFI_TRANSPORT_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include "ServerCredentials.h"
+#include "RemoteControlSettings.h"
+
+/**
+ * @brief The transport of the device: a BearSSL TLS server over the WiFi, and a WiFiUDP socket
+ *  for the discovery on the local network
+ */
+class WiFiTransport
+{
+public:
+  typedef BearSSL::WiFiClientSecure Client;
+  typedef WiFiUDP Udp;
+
+  WiFiTransport() = delete;
+  WiFiTransport(const WiFiTransport &) = delete;
+  WiFiTransport(const CommandServerSettings &settings);
+  bool begin();
+  bool accept(Client &client);
+  Udp &getUdp();
+  IPAddress getBroadcastIP() const;
+  /**
+   * @brief Yields to the WiFi stack, waiting a little longer when no connection is open
+   */
+  void idle(bool busy);
+  void stop();
+  const ServerCredentials &getCredentials() const;
+
+private:
+  BearSSL::WiFiServerSecure server;
+  ServerCredentials credentials;
+  WiFiUDP udp;
+  IPAddress broadcastIp;
+  int udpPort;
+};
+
+#endif // WIFI_TRANSPORT_H
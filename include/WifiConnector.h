@@ -0,0 +1,161 @@
+#ifndef WIFI_CONNECTOR_H
+#define WIFI_CONNECTOR_H
+
+#ifndef _TEST_ENV
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include "Optional.h"
+#include "InplaceFunction.h"
+
+/**
+ * @brief The channel and the MAC address of the access point of the last successful connection
+ */
+struct WifiHint
+{
+  static constexpr size_t BSSID_SIZE = 6;
+
+  int32_t channel = 0;
+  uint8_t bssid[BSSID_SIZE] = {};
+
+  bool isValid() const
+  {
+    return channel > 0;
+  }
+  bool operator==(const WifiHint &other) const
+  {
+    return channel == other.channel && memcmp(bssid, other.bssid, BSSID_SIZE) == 0;
+  }
+  bool operator!=(const WifiHint &other) const
+  {
+    return !(*this == other);
+  }
+};
+
+enum WIFI_CONNECT_PATH
+{
+  /** @brief The connection failed */
+  WIFI_CONNECT_FAILED,
+  /** @brief Connected straight to the access point and channel of the hint, without a scan */
+  WIFI_CONNECT_FAST,
+  /** @brief Connected after a full scan of the channels */
+  WIFI_CONNECT_SCAN
+};
+
+/**
+ * @brief Connects to a WiFi network, first trying the access point and the channel of the last
+ *  successful connection, which skips the channel scan taking most of the connection time.
+ *  If that fails, e.g. because the access point changed channel or is gone, it falls back
+ *  to a full scan
+ *
+ * @tparam W The WiFi class, such as ESP8266WiFiClass
+ */
+template <class W>
+class WifiConnector
+{
+public:
+  /** @brief The interval at which the connection status is polled */
+  static constexpr unsigned long POLL_MS = 100;
+
+  WifiConnector() = delete;
+  WifiConnector(const WifiConnector &) = delete;
+  WifiConnector(W &wifi) : wifi(wifi) {}
+  /**
+   * @brief Set a callback to be executed between the polls of the connection status
+   */
+  void setLoopCallback(InplaceFunction<void(void)> callback)
+  {
+    loopCallback = callback;
+  }
+  /**
+   * @brief Connects to the network
+   *
+   * @param ssid The network name
+   * @param pass The network password
+   * @param hint The hint of the last connection, used for the fast connect if valid. On success it
+   *  receives the channel and the access point of the new connection, to be saved for the next one
+   * @param fastTimeoutMs How long the fast connect is given before falling back to a full scan,
+   *  0 disables the fast connect
+   * @param timeoutMs How long the full scan connection is given
+   * @return true If connected
+   */
+  bool connect(const char *ssid, const char *pass, WifiHint &hint, unsigned long fastTimeoutMs, unsigned long timeoutMs)
+  {
+    unsigned long start = millis();
+    path = WIFI_CONNECT_FAILED;
+
+    if (hint.isValid() && fastTimeoutMs > 0)
+    {
+      wifi.begin(ssid, pass, hint.channel, hint.bssid);
+      if (waitConnected(fastTimeoutMs))
+      {
+        path = WIFI_CONNECT_FAST;
+      }
+      else
+      {
+        wifi.disconnect();
+      }
+    }
+
+    if (path == WIFI_CONNECT_FAILED)
+    {
+      wifi.begin(ssid, pass);
+      if (waitConnected(timeoutMs))
+      {
+        path = WIFI_CONNECT_SCAN;
+      }
+    }
+
+    connectTime = millis() - start;
+    if (path == WIFI_CONNECT_FAILED)
+    {
+      return false;
+    }
+    hint.channel = wifi.channel();
+    memcpy(hint.bssid, wifi.BSSID(), WifiHint::BSSID_SIZE);
+    return true;
+  }
+  /**
+   * @brief The time taken by the last connect(), fallback included
+   */
+  unsigned long getConnectTime() const
+  {
+    return connectTime;
+  }
+  /**
+   * @brief How the last connect() succeeded, or WIFI_CONNECT_FAILED
+   */
+  WIFI_CONNECT_PATH getPath() const
+  {
+    return path;
+  }
+
+private:
+  W &wifi;
+  Optional<InplaceFunction<void(void)>> loopCallback;
+  unsigned long connectTime = 0;
+  WIFI_CONNECT_PATH path = WIFI_CONNECT_FAILED;
+
+  bool waitConnected(unsigned long timeoutMs)
+  {
+    unsigned long start = millis();
+    while (wifi.status() != WL_CONNECTED)
+    {
+      if (millis() - start >= timeoutMs)
+      {
+        return false;
+      }
+      if (loopCallback.hasValue())
+      {
+        loopCallback.get()();
+      }
+      delay(POLL_MS);
+    }
+    return true;
+  }
+};
+
+#endif // WIFI_CONNECTOR_H
@@ -2,25 +2,32 @@
 
 AccessPointOperations::AccessPointOperations(
     Configuration &configuration, StateManager &stateManager,
-    AccessPointSettings settings)
+    AccessPointSettings settings, BufferPool &pool)
     : configuration(configuration), stateManager(stateManager),
-      settings(settings), authHandler(settings.AUTH_USER, settings.AUTH_PASS, settings.TIMEOUT_MS),
-      serverCert(settings.CERTIFICATE), privateKey(settings.PRIVATE_KEY)
+      settings(settings), pool(pool), authHandler(settings.AUTH_USER, settings.AUTH_PASS, settings.TIMEOUT_MS),
+      credentials(settings.CERTIFICATE, settings.PRIVATE_KEY, settings.CERTIFICATE_ISSUER_KEY_TYPE, settings.TLS_SESSION_CACHE_SIZE)
 {
     actionParser.with("setwifi", CALLBACK(AccessPointOperations, setWifiPassword));
+    actionParser.usePool(pool);
 }
 
-void AccessPointOperations::setOnServerLoopCallback(std::function<void(void)> callback)
+void AccessPointOperations::setOnServerLoopCallback(InplaceFunction<void(void)> callback)
 {
     onServerLoopCallback = callback;
 }
 
+const ServerCredentials &AccessPointOperations::getCredentials() const
+{
+    return credentials;
+}
+
 void AccessPointOperations::startServer()
 {
     BearSSL::WiFiServerSecure server(settings.PORT);
 
-    server.setRSACert(&serverCert, &privateKey);
+    credentials.apply(server);
 
+    actionParser.freeze();
     server.begin(settings.PORT);
 
     while (serverRunning)
@@ -34,18 +41,36 @@ void AccessPointOperations::startServer()
             while (!incoming.available() && millis() - timeout < settings.TIMEOUT_MS)
                 delay(50);
 
-            if (incoming.available())
+            // The frames are read into the same buffer, one after the other
+            PoolBuffer receive = pool.acquire(SerialFrame::BUFFER_SIZE);
+            PoolBuffer transmit = pool.acquire(128);
+
+            if (!receive || !transmit)
+            {
+                Log::println("No buffer left for the connection");
+                incoming.stop();
+            }
+            else if (incoming.available())
             {
-                if (authHandler.authenticate(incoming))
+                // Each response is sent with a single write
+                BufferedWriter output(incoming, transmit.data(), transmit.size());
+
+                bool authenticated = authHandler.authenticate(output, receive.data(), receive.size());
+                output.flush();
+
+                if (authenticated)
                 {
                     // Wait for new transmission
                     timeout = millis();
                     while (!incoming.available() && millis() - timeout < settings.TIMEOUT_MS)
                         delay(50);
 
-                    ActionMap action = ActionMap::fromStream(incoming, settings.TIMEOUT_MS);
+                    ActionView action = ActionView::fromStream(incoming, settings.TIMEOUT_MS, receive.data(), receive.size());
+
+                    bool terminate = actionParser.execute(action, output);
+                    output.flush();
 
-                    if (actionParser.execute(action, incoming))
+                    if (terminate)
                     {
                         serverRunning = false;
                         stateManager.setState(CONNECTING);
@@ -70,11 +95,11 @@ void AccessPointOperations::startServer()
     server.stop();
 }
 
-bool AccessPointOperations::setWifiPassword(ActionMap &action, Stream &output)
+bool AccessPointOperations::setWifiPassword(ActionView &action, Stream &output)
 {
     if (action.has("bssid") && action.has("password"))
     {
-        configuration.updateConfig(*action.get("bssid"), *action.get("password"));
+        configuration.updateConfig(action.get("bssid")->toString(), action.get("password")->toString());
 
         Response::successResponse().write(output);
 
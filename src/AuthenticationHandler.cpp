@@ -2,25 +2,60 @@
 
 AuthenticationHandler::AuthenticationHandler(const String &username,
 											 const String &password, int TIMEOUT_MS)
-	: username(username), password(password), timeout(TIMEOUT_MS) {}
+	: credentials(username, password), timeout(TIMEOUT_MS) {}
 
 AuthenticationHandler::AuthenticationHandler(const char *username,
 											 const char *password, int TIMEOUT_MS)
-	: username(username), password(password), timeout(TIMEOUT_MS) {}
+	: credentials(username, password), timeout(TIMEOUT_MS) {}
 
-bool AuthenticationHandler::authenticate(Stream &client)
+bool AuthenticationHandler::authenticate(Stream &client, char *buffer, size_t size)
 {
-	ActionMap authentication = ActionMap::fromStream(client, timeout);
+	ActionView authentication = ActionView::fromStream(client, timeout, buffer, size);
 
-	if (authentication.has("username") &&
-		authentication.has("password") &&
-		(*authentication.get("username")) == this->username && (*authentication.get("password")) == this->password)
+	return authenticate(authentication, client);
+}
+
+bool AuthenticationHandler::authenticate(const ActionView &authentication, Stream &client)
+{
+	if (credentials.checkPassword(authentication.get("username"), authentication.get("password")))
 	{
-		Response::successResponse().write(client);
+		char token[FrameAuthenticator::TOKEN_LENGTH + 1];
+		if (credentials.issueToken(millis(), token))
+		{
+			SerialMap<String, 2> response;
+			response.put("result", "ok");
+			response.put("token", token);
+			response.write(client);
+		}
+		else
+		{
+			Response::successResponse().write(client);
+		}
 
 		return true;
 	}
 
 	Response::errorResponse().write(client);
 	return false;
-}
\ No newline at end of file
+}
+
+bool AuthenticationHandler::authorize(const ActionView &action)
+{
+	return credentials.authorize(action, millis());
+}
+
+void AuthenticationHandler::enableSessionTokens(unsigned long lifetimeMs)
+{
+	uint8_t key[FrameAuthenticator::KEY_SIZE];
+	for (size_t i = 0; i < sizeof(key); i += 4)
+	{
+		uint32_t random = ESP.random();
+		memcpy(key + i, &random, 4);
+	}
+	credentials.enableTokens(key, lifetimeMs);
+}
+
+void AuthenticationHandler::persistNonces(uint32_t floor, InplaceFunction<bool(uint32_t)> persist)
+{
+	credentials.persistNonces(floor, persist);
+}
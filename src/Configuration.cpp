@@ -1,6 +1,15 @@
 #include "Configuration.h"
 
-Configuration::Configuration()
+static const char *BSSID_KEY = "wifi.bssid";
+static const char *PASS_KEY = "wifi.pass";
+// <channel: uint8_t><BSSID: uint8_t[6]>
+static const char *HINT_KEY = "wifi.hint";
+static const size_t HINT_SIZE = 1 + WifiHint::BSSID_SIZE;
+// <floor: uint32_t, big endian>
+static const char *NONCE_KEY = "auth.nonce";
+static const size_t NONCE_SIZE = 4;
+
+Configuration::Configuration() : settings(EEPROM, 0, EEPROM_TOTAL_SIZE)
 {
   EEPROM.begin(EEPROM_TOTAL_SIZE);
   reload();
@@ -8,90 +17,107 @@ Configuration::Configuration()
 
 String Configuration::getBSSID() const
 {
-  return valid ? WLAN_BSSID : "";
+  const SerialSlice *bssid = settings.get(BSSID_KEY);
+  return valid && bssid != nullptr ? bssid->toString() : "";
 }
 
 String Configuration::getPass() const
 {
-  return valid ? PASS : "";
+  const SerialSlice *pass = settings.get(PASS_KEY);
+  return valid && pass != nullptr ? pass->toString() : "";
 }
 
 bool Configuration::updateConfig(String WLAN_BSSID, String PASS)
 {
-  bool result = writeStringToEEPROM(WLAN_BSSID, 0);
-  if (result == false)
-    return false;
-  result = writeStringToEEPROM(PASS, EEPROM_STR_SIZE);
-  if (result == false)
+  // The hint belongs to the previous network
+  if (WLAN_BSSID.length() == 0 || !settings.remove(HINT_KEY) ||
+      !settings.put(BSSID_KEY, WLAN_BSSID.c_str()) || !settings.put(PASS_KEY, PASS.c_str()))
     return false;
 
-  uint16_t checksum = 0;
-  for (size_t i = 0; i < WLAN_BSSID.length(); i++)
-    checksum += WLAN_BSSID[i];
-  for (size_t i = 0; i < PASS.length(); i++)
-    checksum += PASS[i];
-
-  EEPROM.write(EEPROM_TOTAL_SIZE - 2, (checksum >> 8) & 0xFF);
-  EEPROM.write(EEPROM_TOTAL_SIZE - 1, checksum & 0xFF);
-
-  result = EEPROM.commit();
-  if (result == false)
+  if (!settings.commit())
     return false;
 
   valid = true;
-  this->WLAN_BSSID = WLAN_BSSID;
-  this->PASS = PASS;
   return true;
 }
 
 void Configuration::reload()
 {
-  char buffer[EEPROM_TOTAL_SIZE];
-  for (size_t i = 0; i < EEPROM_TOTAL_SIZE; i++)
+  // The store reads the emulated EEPROM in place instead of copying it byte by byte
+  if (!settings.load() && !migrateLegacy())
   {
-    buffer[i] = EEPROM.read(i);
+    settings.format();
+    settings.commit();
   }
-  // Set the bytes at STR_SIZE to 0 to avoid buffer overflow
-  buffer[EEPROM_STR_SIZE - 1] = 0;
-  buffer[EEPROM_TOTAL_SIZE - 3] = 0;
 
-  uint16_t chks = buffer[EEPROM_TOTAL_SIZE - 2] << 8 | buffer[EEPROM_TOTAL_SIZE - 1];
-  uint16_t calc_chks = 0;
+  const SerialSlice *bssid = settings.get(BSSID_KEY);
+  valid = bssid != nullptr && bssid->length() > 0 && settings.has(PASS_KEY);
+}
 
-  String bssid_ = String(buffer);
-  String pass_ = String(buffer + EEPROM_STR_SIZE);
+bool Configuration::migrateLegacy()
+{
+  const uint8_t *data = EEPROM.getConstDataPtr();
+  size_t bssidLength = strnlen(reinterpret_cast<const char *>(data), LEGACY_STR_SIZE);
+  size_t passLength = strnlen(reinterpret_cast<const char *>(data + LEGACY_STR_SIZE), LEGACY_STR_SIZE);
+  if (bssidLength == 0 || bssidLength == LEGACY_STR_SIZE || passLength == LEGACY_STR_SIZE)
+    return false;
 
-  for (size_t i = 0; i < bssid_.length(); i++)
-    calc_chks += bssid_[i];
-  for (size_t i = 0; i < pass_.length(); i++)
-    calc_chks += pass_[i];
+  uint16_t checksum = 0;
+  for (size_t i = 0; i < bssidLength; i++)
+    checksum += data[i];
+  for (size_t i = 0; i < passLength; i++)
+    checksum += data[LEGACY_STR_SIZE + i];
+  if (checksum != (data[LEGACY_TOTAL_SIZE - 2] << 8 | data[LEGACY_TOTAL_SIZE - 1]))
+    return false;
 
-  if (chks == calc_chks && bssid_.length() > 0)
-  {
-    valid = true;
-    this->WLAN_BSSID = bssid_;
-    this->PASS = pass_;
-  }
-  else
-  {
-    valid = false;
-  }
+  // Formatting overwrites the old layout, the credentials are copied first
+  String bssid = String(reinterpret_cast<const char *>(data));
+  String pass = String(reinterpret_cast<const char *>(data + LEGACY_STR_SIZE));
+  settings.format();
+  return settings.put(BSSID_KEY, bssid.c_str()) && settings.put(PASS_KEY, pass.c_str()) && settings.commit();
 }
 
-bool Configuration::writeStringToEEPROM(String str, size_t baseAddr)
+bool Configuration::getWifiHint(WifiHint &hint) const
 {
-  size_t str_len = str.length();
-  if (str_len > EEPROM_STR_SIZE - 1)
+  const SerialSlice *value = settings.get(HINT_KEY);
+  if (value == nullptr || value->length() != HINT_SIZE)
     return false;
-  const char *str_c = str.c_str();
-  for (size_t i = 0; i < str_len + 1; i++)
-  {
-    EEPROM.write(baseAddr + i, str_c[i]);
-  }
-  return true;
+
+  hint.channel = (uint8_t)value->data()[0];
+  memcpy(hint.bssid, value->data() + 1, WifiHint::BSSID_SIZE);
+  return hint.isValid();
+}
+
+bool Configuration::updateWifiHint(const WifiHint &hint)
+{
+  char value[HINT_SIZE];
+  value[0] = (char)hint.channel;
+  memcpy(value + 1, hint.bssid, WifiHint::BSSID_SIZE);
+  return settings.put(HINT_KEY, strlen(HINT_KEY), value, HINT_SIZE) && settings.commit();
+}
+
+uint32_t Configuration::getNonceFloor() const
+{
+  const SerialSlice *value = settings.get(NONCE_KEY);
+  if (value == nullptr || value->length() != NONCE_SIZE)
+    return 0;
+
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(value->data());
+  return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+bool Configuration::updateNonceFloor(uint32_t floor)
+{
+  char value[NONCE_SIZE] = {(char)(floor >> 24), (char)(floor >> 16), (char)(floor >> 8), (char)floor};
+  return settings.put(NONCE_KEY, strlen(NONCE_KEY), value, NONCE_SIZE) && settings.commit();
 }
 
 bool Configuration::isValid() const
 {
   return valid;
 }
+
+Settings &Configuration::getSettings()
+{
+  return settings;
+}
@@ -0,0 +1,27 @@
+#include "ServerCredentials.h"
+
+ServerCredentials::ServerCredentials(const char *certificate, const char *privateKey,
+                                     unsigned issuerKeyType, uint32_t sessionCacheSize)
+    : heapUsed(ESP.getFreeHeap()), certificate(certificate), privateKey(privateKey), sessions(sessionCacheSize),
+      issuerKeyType(issuerKeyType), sessionCacheSize(sessionCacheSize)
+{
+  uint32_t freeHeap = ESP.getFreeHeap();
+  heapUsed = heapUsed > freeHeap ? heapUsed - freeHeap : 0;
+}
+
+void ServerCredentials::apply(BearSSL::WiFiServerSecure &server)
+{
+  if (privateKey.isEC())
+  {
+    server.setECCert(&certificate, issuerKeyType != 0 ? issuerKeyType : BR_KEYTYPE_EC, &privateKey);
+  }
+  else
+  {
+    server.setRSACert(&certificate, &privateKey);
+  }
+
+  if (sessionCacheSize > 0)
+  {
+    server.setCache(&sessions);
+  }
+}
@@ -14,7 +14,7 @@ MACHINE_STATE StateManager::getState() const
   return state;
 }
 
-void StateManager::registerStateFunction(MACHINE_STATE state, std::function<void(void)> callback)
+void StateManager::registerStateFunction(MACHINE_STATE state, InplaceFunction<void(void)> callback)
 {
   callbacks.put(state, callback);
 }
@@ -0,0 +1,51 @@
+#include "WiFiTransport.h"
+
+WiFiTransport::WiFiTransport(const CommandServerSettings &settings)
+    : server(settings.PORT),
+      credentials(settings.CERTIFICATE, settings.PRIVATE_KEY, settings.CERTIFICATE_ISSUER_KEY_TYPE, settings.TLS_SESSION_CACHE_SIZE),
+      udpPort(settings.UDP_PORT)
+{
+}
+
+bool WiFiTransport::begin()
+{
+  credentials.apply(server);
+  server.begin();
+  udp.begin(udpPort);
+
+  broadcastIp = WiFi.localIP();
+  broadcastIp[3] = 255;
+  return true;
+}
+
+bool WiFiTransport::accept(Client &client)
+{
+  client = server.available();
+  return static_cast<bool>(client);
+}
+
+WiFiTransport::Udp &WiFiTransport::getUdp()
+{
+  return udp;
+}
+
+IPAddress WiFiTransport::getBroadcastIP() const
+{
+  return broadcastIp;
+}
+
+void WiFiTransport::idle(bool busy)
+{
+  delay(busy ? 0 : 20);
+}
+
+void WiFiTransport::stop()
+{
+  server.stop();
+  udp.stop();
+}
+
+const ServerCredentials &WiFiTransport::getCredentials() const
+{
+  return credentials;
+}
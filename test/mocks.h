@@ -7,18 +7,35 @@
 #include <ios>
 #include <cstring>
 #include <iterator>
+#include <cstdint>
+#include <vector>
+#include <random>
 
 typedef std::string String;
 
-// Mock for Stream
+// Mock for Stream, the writes end up in write(uint8_t) and write(const uint8_t *, size_t) as in Arduino's Print
 class Stream
 {
 public:
     virtual int available() { return 0; }
-    virtual size_t write(char *data, size_t sz) { return 0; }
-    virtual size_t write(const char *str) { return 0; }
-    virtual size_t write(char c) { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    virtual void flush() {}
+    virtual size_t write(uint8_t c) { return 0; }
+    // As in Arduino's Print, 0 when the stream doesn't tell
+    virtual int availableForWrite() { return 0; }
+    virtual size_t write(const uint8_t *data, size_t sz)
+    {
+        size_t n = 0;
+        while (sz--)
+            n += write(*data++);
+        return n;
+    }
+    size_t write(const char *data, size_t sz) { return write(reinterpret_cast<const uint8_t *>(data), sz); }
+    size_t write(const char *str) { return write(str, strlen(str)); }
+    size_t write(char c) { return write(static_cast<uint8_t>(c)); }
     virtual size_t readBytesUntil(char c, char *b, size_t d) { return 0; }
+    virtual size_t readBytes(char *b, size_t d) { return 0; }
     virtual size_t print(const char *str) { return 0; }
     virtual size_t println(const char *str) { return 0; }
 };
@@ -30,19 +47,15 @@ public:
     IoStreamProxy(const IoStreamProxy &) = delete;
     IoStreamProxy(std::basic_iostream<char> &stream) : stream(stream) {}
     int available() override { return stream.good() ? 1 : -1; }
-    size_t write(char *data, size_t sz) override
+    using Stream::write;
+    size_t write(const uint8_t *data, size_t sz) override
     {
         std::copy(data, data + sz, std::ostream_iterator<char>(stream));
         return sz;
     }
-    size_t write(const char *str) override
-    {
-        stream << str;
-        return strlen(str);
-    }
-    size_t write(char c) override
+    size_t write(uint8_t c) override
     {
-        stream << c;
+        stream << (char)c;
         return 1;
     }
     size_t readBytesUntil(char terminator, char *buffer, size_t length) override
@@ -60,6 +73,11 @@ public:
         }
         return index; // return number of characters, not including null terminator }
     }
+    size_t readBytes(char *buffer, size_t length) override
+    {
+        stream.read(buffer, length);
+        return stream.gcount();
+    }
     size_t print(const char *str) override { return 0; }
     size_t println(const char *str) override { return 0; }
 
@@ -89,6 +107,165 @@ private:
     std::ostream &stream;
 };
 
+// Mock for IPAddress, as used by the settings
+class IPAddress
+{
+public:
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes{a, b, c, d} {}
+    uint8_t operator[](int index) const { return bytes[index]; }
+    uint8_t &operator[](int index) { return bytes[index]; }
+    String toString() const
+    {
+        return std::to_string(bytes[0]) + "." + std::to_string(bytes[1]) + "." + std::to_string(bytes[2]) + "." + std::to_string(bytes[3]);
+    }
+
+private:
+    uint8_t bytes[4] = {};
+};
+
+// Mock for the ESP global object, the heap figures are set by the tests
+struct EspMock
+{
+    uint32_t freeHeap = 0, maxFreeBlock = 0;
+    uint8_t fragmentation = 0;
+
+    uint32_t random()
+    {
+        static std::random_device device;
+        return device();
+    }
+    uint32_t getFreeHeap() { return freeHeap; }
+    uint32_t getMaxFreeBlockSize() { return maxFreeBlock; }
+    uint8_t getHeapFragmentation() { return fragmentation; }
+};
+
+inline EspMock ESP;
+
+// Mock for the emulated EEPROM: the data is a RAM copy of the flash, written back by commit().
+// reboot() discards the uncommitted changes as a power cycle would
+class EEPROMMock
+{
+public:
+    EEPROMMock(size_t size) : data(size, 0xFF), flash(size, 0xFF) {}
+    uint8_t read(int address) const { return data[address]; }
+    void write(int address, uint8_t value) { data[address] = value; }
+    bool commit()
+    {
+        flash = data;
+        commits++;
+        return true;
+    }
+    uint8_t *getDataPtr() { return data.data(); }
+    const uint8_t *getConstDataPtr() const { return data.data(); }
+    size_t length() const { return data.size(); }
+    void reboot() { data = flash; }
+    unsigned getCommits() const { return commits; }
+
+private:
+    std::vector<uint8_t> data, flash;
+    unsigned commits = 0;
+};
+
+enum wl_status_t
+{
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_DISCONNECTED = 6
+};
+
+// Mock for WiFiUDP: the datagrams queued in incoming are received in order, the ones sent are recorded
+class UdpMock
+{
+public:
+    struct Datagram
+    {
+        IPAddress ip;
+        uint16_t port;
+        std::string data;
+    };
+    std::vector<Datagram> incoming, sent;
+
+    int parsePacket()
+    {
+        position = 0;
+        if (incoming.empty())
+        {
+            current = {};
+            return 0;
+        }
+        current = incoming.front();
+        incoming.erase(incoming.begin());
+        return current.data.size();
+    }
+    int read(char *buffer, size_t len)
+    {
+        size_t n = std::min(len, current.data.size() - position);
+        memcpy(buffer, current.data.data() + position, n);
+        position += n;
+        return n;
+    }
+    IPAddress remoteIP() const { return current.ip; }
+    uint16_t remotePort() const { return current.port; }
+    int beginPacket(const IPAddress &ip, uint16_t port)
+    {
+        sent.push_back({ip, port, ""});
+        return 1;
+    }
+    size_t write(const uint8_t *data, size_t len)
+    {
+        sent.back().data.append(reinterpret_cast<const char *>(data), len);
+        return len;
+    }
+    int endPacket() { return 1; }
+
+private:
+    Datagram current;
+    size_t position = 0;
+};
+
+// Mock for the WiFi layer: a network on a given channel and access point, which a directed
+// connection reaches only if both match, after a number of status polls
+class WifiMock
+{
+public:
+    int32_t networkChannel = 6;
+    uint8_t networkBssid[6] = {0x10, 0x20, 0x30, 0x40, 0x50, 0x60};
+    int pollsToConnect = 3;
+    bool available = true;
+    int begins = 0, scans = 0;
+
+    wl_status_t begin(const char *ssid, const char *pass, int32_t channel = 0, const uint8_t *bssid = nullptr)
+    {
+        begins++;
+        directed = channel != 0 || bssid != nullptr;
+        scans += directed ? 0 : 1;
+        reachable = available && (!directed || (channel == networkChannel && bssid != nullptr && memcmp(bssid, networkBssid, 6) == 0));
+        polls = 0;
+        connected = false;
+        return WL_DISCONNECTED;
+    }
+    wl_status_t status()
+    {
+        if (reachable && ++polls >= pollsToConnect)
+            connected = true;
+        return connected ? WL_CONNECTED : WL_DISCONNECTED;
+    }
+    bool disconnect(bool wifioff = false)
+    {
+        connected = reachable = false;
+        return true;
+    }
+    int32_t channel() { return connected ? networkChannel : 0; }
+    uint8_t *BSSID() { return networkBssid; }
+
+private:
+    bool directed = false, reachable = false, connected = false;
+    int polls = 0;
+};
+
 #ifdef PRINT_SERIAL
 struct SerialMock
 {
@@ -112,14 +289,20 @@ struct SerialMock
 #endif
 
 // Mock for Serial global object
-SerialMock Serial;
+inline SerialMock Serial;
 
-unsigned long millis()
+inline unsigned long millis()
 {
     return std::chrono::system_clock::now().time_since_epoch() /
            std::chrono::milliseconds(1);
 }
 
-void delay(unsigned long t) {}
+inline unsigned long micros()
+{
+    return std::chrono::steady_clock::now().time_since_epoch() /
+           std::chrono::microseconds(1);
+}
+
+inline void delay(unsigned long t) {}
 
 #endif // MOCKS_H
\ No newline at end of file
@@ -7,15 +7,108 @@
 #include <iostream>
 #include <random>
 #include <sstream>
+#include <vector>
+#include <algorithm>
 #include "Optional.h"
 #include "Map.h"
+#include "HashIndex.h"
 #include "SerialMap.h"
+#include "SerialMapView.h"
+#include "ActionParser.h"
+#include "ClientConnection.h"
+#include "LatencyHistogram.h"
+#include "InplaceFunction.h"
+#include "BufferedWriter.h"
+#include "BufferStream.h"
+#include "FrameAuthenticator.h"
+#include "SettingsStore.h"
+#include "WifiConnector.h"
+#include "DiscoveryResponder.h"
+#include "Upload.h"
+#include "BufferPool.h"
+#include "MemoryStats.h"
+#ifdef __linux__
+#include "PosixTransport.h"
+#include "CommandServer.h"
+#include <thread>
+#endif
+#include <cstdlib>
+#include <climits>
+#include <new>
+#include <atomic>
+
+// Counts the heap allocations of the tests
+static std::atomic<unsigned long> allocations{0};
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// Counts its live instances, to check that every constructed value is destroyed
+struct Tracked
+{
+    static int instances;
+    int value;
+    Tracked(int value) : value(value) { instances++; }
+    Tracked(const Tracked &copy) : value(copy.value) { instances++; }
+    Tracked(Tracked &&move) : value(move.value)
+    {
+        move.value = -1;
+        instances++;
+    }
+    Tracked &operator=(const Tracked &copy) = default;
+    Tracked &operator=(Tracked &&move) = default;
+    ~Tracked() { instances--; }
+};
+int Tracked::instances = 0;
 
 void test_Optional();
 void test_Serialization_deserialization();
 void test_Stream_read_write();
 void test_Errors();
 void test_Map();
+void test_HashMap();
+void test_ActionParser();
+void test_SerialMapView();
+void test_ClientConnection();
+void test_SerialFrameParser();
+void test_Batch();
+void test_LatencyHistogram();
+void test_InplaceFunction();
+void test_BufferedWriter();
+void test_FrameAuthenticator();
+void test_SettingsStore();
+void test_WifiConnector();
+void test_PosixTransport();
+void test_CommandServer();
+void test_CommandServerAsync();
+void test_CommandServerKeepAlive();
+void test_CommandServerStats();
+void test_CommandServerUpload();
+void test_CommandServerMemory();
+void test_CommandServerInlineAuth();
+void test_AsyncTask();
+void test_DiscoveryResponder();
+void test_FrameV2();
+void test_Upload();
+void test_ResponseWriter();
+void test_BufferPool();
+void test_MemoryStats();
 
 int main(int argc, char **argv)
 {
@@ -26,6 +119,35 @@ int main(int argc, char **argv)
     RUN_TEST(test_Stream_read_write);
     RUN_TEST(test_Errors);
     RUN_TEST(test_Map);
+    RUN_TEST(test_HashMap);
+    RUN_TEST(test_ActionParser);
+    RUN_TEST(test_SerialMapView);
+    RUN_TEST(test_ClientConnection);
+    RUN_TEST(test_SerialFrameParser);
+    RUN_TEST(test_Batch);
+    RUN_TEST(test_LatencyHistogram);
+    RUN_TEST(test_InplaceFunction);
+    RUN_TEST(test_BufferedWriter);
+    RUN_TEST(test_FrameAuthenticator);
+    RUN_TEST(test_SettingsStore);
+    RUN_TEST(test_WifiConnector);
+    RUN_TEST(test_AsyncTask);
+    RUN_TEST(test_DiscoveryResponder);
+    RUN_TEST(test_FrameV2);
+    RUN_TEST(test_Upload);
+    RUN_TEST(test_ResponseWriter);
+    RUN_TEST(test_BufferPool);
+    RUN_TEST(test_MemoryStats);
+#ifdef __linux__
+    RUN_TEST(test_PosixTransport);
+    RUN_TEST(test_CommandServer);
+    RUN_TEST(test_CommandServerAsync);
+    RUN_TEST(test_CommandServerKeepAlive);
+    RUN_TEST(test_CommandServerStats);
+    RUN_TEST(test_CommandServerUpload);
+    RUN_TEST(test_CommandServerMemory);
+    RUN_TEST(test_CommandServerInlineAuth);
+#endif
 
     return UNITY_END();
 }
@@ -70,6 +192,45 @@ void test_Optional()
     TEST_ASSERT_TRUE(fun.hasValue());
     TEST_ASSERT_NOT_NULL(dynamic_cast<std::function<void(void)> *>(&fun.get()));
     fun.get()();
+
+    TEST_MESSAGE("Setting, replacing and resetting a value should never allocate");
+
+    unsigned long before = allocations;
+    Optional<int> number;
+    for (int i = 0; i < 100; i++)
+    {
+        number = i;
+        number = {};
+        number.set(i);
+    }
+    Optional<std::function<void(void)>> callback;
+    callback = []() {};
+    callback = []() {};
+    Optional<std::function<void(void)>> copied = callback;
+    TEST_ASSERT(allocations == before);
+    TEST_ASSERT_EQUAL_INT(number.get(), 99);
+    TEST_ASSERT_TRUE(copied.hasValue());
+
+    TEST_MESSAGE("Copies, moves and emplace should construct and destroy the values exactly once");
+
+    {
+        Optional<Tracked> tracked(Tracked(1));
+        TEST_ASSERT_EQUAL_INT(Tracked::instances, 1);
+        Optional<Tracked> copy = tracked;
+        TEST_ASSERT_EQUAL_INT(Tracked::instances, 2);
+        Optional<Tracked> moved = std::move(copy);
+        TEST_ASSERT_EQUAL_INT(moved.get().value, 1);
+        TEST_ASSERT_EQUAL_INT(copy.get().value, -1);
+        moved.emplace(7);
+        TEST_ASSERT_EQUAL_INT(moved.get().value, 7);
+        TEST_ASSERT_EQUAL_INT(Tracked::instances, 3);
+        copy = Optional<Tracked>();
+        TEST_ASSERT_FALSE(copy.hasValue());
+        TEST_ASSERT_EQUAL_INT(Tracked::instances, 2);
+        tracked = moved;
+        TEST_ASSERT_EQUAL_INT(tracked.get().value, 7);
+    }
+    TEST_ASSERT_EQUAL_INT(Tracked::instances, 0);
 }
 
 void test_Map()
@@ -194,4 +355,2367 @@ void test_Errors()
     SerialMap<std::string, 10> map(trickyData, sizeof(trickyData));
 
     TEST_ASSERT(map.getSize() == 0);
-}
\ No newline at end of file
+}
+struct CollidingHash
+{
+    uint32_t operator()(const std::string &key) const { return 7; }
+};
+
+void test_HashMap()
+{
+    HashMap<std::string, int, 3> map;
+
+    TEST_MESSAGE("Should succeed setting the entries when below the size limit");
+
+    TEST_ASSERT(map.put("one", 1));
+    TEST_ASSERT(map.put("two", 2));
+    TEST_ASSERT(map.put("three", 3));
+
+    TEST_MESSAGE("Map should contain the saved entries, and only those");
+
+    TEST_ASSERT(map.has("one"));
+    TEST_ASSERT(map.has("two"));
+    TEST_ASSERT(map.has("three"));
+    TEST_ASSERT(!map.has("four"));
+    TEST_ASSERT(map.get("four") == nullptr);
+    TEST_ASSERT(*map.get("two") == 2);
+
+    TEST_MESSAGE("Putting an existing key should overwrite the value, putting a new one in a full map should fail");
+
+    TEST_ASSERT(map.put("two", 22));
+    TEST_ASSERT(*map.get("two") == 22);
+    TEST_ASSERT(!map.put("four", 4));
+    TEST_ASSERT(map.getSize() == 3);
+
+    TEST_MESSAGE("Removing an entry should keep the other ones reachable, in insertion order");
+
+    TEST_ASSERT(map.remove("one"));
+    TEST_ASSERT(!map.remove("one"));
+    TEST_ASSERT(!map.has("one"));
+    TEST_ASSERT(*map.get("two") == 22);
+    TEST_ASSERT(*map.get("three") == 3);
+    TEST_ASSERT((*map.begin()).key() == "two");
+    TEST_ASSERT(map.put("four", 4));
+    TEST_ASSERT(*map.get("four") == 4);
+
+    TEST_MESSAGE("Colliding hashes should still resolve to the right entries");
+
+    HashMap<std::string, int, 4, CollidingHash> colliding;
+    colliding.put("a", 1);
+    colliding.put("b", 2);
+    colliding.put("c", 3);
+    colliding.remove("a");
+
+    TEST_ASSERT(!colliding.has("a"));
+    TEST_ASSERT(*colliding.get("b") == 2);
+    TEST_ASSERT(*colliding.get("c") == 3);
+
+    TEST_MESSAGE("Integral keys should be hashed too");
+
+    HashMap<int, std::string, 24> ints;
+    for (int i = 0; i < 24; i++)
+    {
+        TEST_ASSERT(ints.put(i * 1024, std::to_string(i)));
+    }
+    TEST_ASSERT(*ints.get(23 * 1024) == "23");
+    TEST_ASSERT(!ints.has(1));
+
+    TEST_MESSAGE("A SerialMap backed by a HashMap should parse the same data");
+
+    char data[] = {0x10, 4, 'w', 'i', 'l', 'l', 0x11, 2, 'i', 't', 0x10, 5, 't', 'r', 'u', 'l', 'y', 0x11, 5, 'w', 'o', 'r', 'k', '?', 0x00};
+
+    SerialMap<std::string, 10, HashMap<std::string, std::string, 10>> parsed(data, sizeof(data));
+
+    TEST_ASSERT(parsed.getSize() == 2);
+    TEST_ASSERT(*parsed.get("will") == "it");
+    TEST_ASSERT(*parsed.get("truly") == "work?");
+}
+
+void test_ActionParser()
+{
+    ActionParser<8> parser;
+    std::string called;
+    Stream output;
+
+    for (const char *name : {"setpin", "getpin", "reset", "apmode", "blink"})
+    {
+        std::string action = name;
+        parser.with(name, [&called, action](ActionMap &map, Stream &out)
+                    {
+                        called = action;
+                        return action == "apmode"; });
+    }
+
+    ActionMap request;
+    request.put("action", "reset");
+
+    TEST_MESSAGE("The linear dispatch should call the requested action");
+
+    TEST_ASSERT_FALSE(parser.isFrozen());
+    TEST_ASSERT_FALSE(parser.execute(request, output));
+    TEST_ASSERT(called == "reset");
+
+    TEST_MESSAGE("The frozen dispatch should call the same actions and pass their result back");
+
+    parser.freeze();
+    TEST_ASSERT_TRUE(parser.isFrozen());
+
+    for (const char *name : {"setpin", "getpin", "reset", "apmode", "blink"})
+    {
+        request.put("action", name);
+        called = "";
+        bool result = parser.execute(request, output);
+        TEST_ASSERT(called == name);
+        TEST_ASSERT(result == (called == "apmode"));
+    }
+
+    TEST_MESSAGE("Unknown or missing actions should not call anything");
+
+    called = "";
+    request.put("action", "unknown");
+    TEST_ASSERT_FALSE(parser.execute(request, output));
+    ActionMap empty;
+    TEST_ASSERT_FALSE(parser.execute(empty, output));
+    TEST_ASSERT(called == "");
+
+    TEST_MESSAGE("Registering an action should unfreeze the parser and keep the new action reachable");
+
+    parser.with("late", [&called](ActionMap &map, Stream &out)
+                {
+                    called = "late";
+                    return false; });
+    TEST_ASSERT_FALSE(parser.isFrozen());
+    request.put("action", "late");
+    parser.execute(request, output);
+    TEST_ASSERT(called == "late");
+    parser.freeze();
+    called = "";
+    parser.execute(request, output);
+    TEST_ASSERT(called == "late");
+}
+
+void test_SerialMapView()
+{
+    TEST_MESSAGE("SerialMapView indexing of { \"will\": \"it\", \"truly\": \"work?\", \"pin\": \"-12\" }");
+
+    char data[] = {0x10, 4, 'w', 'i', 'l', 'l', 0x11, 2, 'i', 't', 0x10, 5, 't', 'r', 'u', 'l', 'y', 0x11, 5, 'w', 'o', 'r', 'k', '?',
+                   0x10, 3, 'p', 'i', 'n', 0x11, 3, '-', '1', '2', 0x00};
+
+    SerialMapView<10> view(data, sizeof(data));
+
+    TEST_ASSERT(view.getSize() == 3);
+    TEST_ASSERT(view.has("will"));
+    TEST_ASSERT(view.has(std::string("truly")));
+    TEST_ASSERT(!view.has("wil"));
+    TEST_ASSERT(!view.has("work?"));
+
+    TEST_MESSAGE("The values should point straight into the parsed buffer");
+
+    TEST_ASSERT(view.get("will")->data() == data + 8);
+    TEST_ASSERT(*view.get("will") == "it");
+    TEST_ASSERT(*view.get("truly") == std::string("work?"));
+    TEST_ASSERT(std::string("work?") == *view.get("truly"));
+    TEST_ASSERT(view.get("truly")->toString() == "work?");
+    TEST_ASSERT(view.get("pin")->toInt() == -12);
+    TEST_ASSERT(view.get("missing") == nullptr);
+
+    TEST_MESSAGE("The view should stop at malformed data like SerialMap does");
+
+    char trickyData[] = {0x10, 0x45, 'B', 'a', 'd', 0x11, 0x2, 'O', 'k'};
+    SerialMapView<10> bad(trickyData, sizeof(trickyData));
+    TEST_ASSERT(bad.getSize() == 0);
+
+    TEST_MESSAGE("The view should be read from a stream into the given buffer");
+
+    std::stringstream strm;
+    strm.write(data, sizeof(data));
+    strm.seekg(std::ios::beg);
+    IoStreamProxy strmp(strm);
+
+    char buffer[512];
+    SerialMapView<10> streamed = SerialMapView<10>::fromStream(strmp, 3000, buffer, sizeof(buffer));
+
+    TEST_ASSERT(streamed.getSize() == 3);
+    TEST_ASSERT(*streamed.get("truly") == "work?");
+
+    TEST_MESSAGE("ActionParser should dispatch views to both view and map callbacks");
+
+    ActionParser<4> parser;
+    Stream output;
+    std::string seen;
+    parser.with("view", [&seen](ActionView &action, Stream &out)
+                {
+                    seen = action.get("value")->toString();
+                    return true; });
+    parser.with("map", [&seen](ActionMap &action, Stream &out)
+                {
+                    seen = *action.get("value");
+                    return false; });
+
+    char viewAction[] = {0x10, 6, 'a', 'c', 't', 'i', 'o', 'n', 0x11, 4, 'v', 'i', 'e', 'w', 0x10, 5, 'v', 'a', 'l', 'u', 'e', 0x11, 1, 'v', 0x00};
+    char mapAction[] = {0x10, 6, 'a', 'c', 't', 'i', 'o', 'n', 0x11, 3, 'm', 'a', 'p', 0x10, 5, 'v', 'a', 'l', 'u', 'e', 0x11, 1, 'm', 0x00};
+
+    for (int frozen = 0; frozen < 2; frozen++)
+    {
+        if (frozen)
+        {
+            parser.freeze();
+        }
+        ActionView v(viewAction, sizeof(viewAction));
+        TEST_ASSERT_TRUE(parser.execute(v, output));
+        TEST_ASSERT(seen == "v");
+
+        ActionView m(mapAction, sizeof(mapAction));
+        TEST_ASSERT_FALSE(parser.execute(m, output));
+        TEST_ASSERT(seen == "m");
+
+        ActionMap asMap(viewAction, sizeof(viewAction));
+        seen = "";
+        TEST_ASSERT_TRUE(parser.execute(asMap, output));
+        TEST_ASSERT(seen == "v");
+    }
+
+    TEST_MESSAGE("Registering an action again should replace its callback, whatever its kind");
+
+    parser.with("view", [&seen](ActionMap &action, Stream &out)
+                {
+                    seen = "replaced";
+                    return false; });
+    ActionView replaced(viewAction, sizeof(viewAction));
+    TEST_ASSERT_FALSE(parser.execute(replaced, output));
+    TEST_ASSERT(seen == "replaced");
+    static_assert(!std::is_copy_constructible<ActionParser<4>>::value, "The dispatch table points into the parser");
+}
+
+// A client socket receiving its data in the given chunks, one chunk per poll
+struct ChunkedClient
+{
+    std::vector<std::string> *chunks = nullptr;
+    std::string pending;
+    bool open = true;
+
+    int available()
+    {
+        if (pending.empty() && chunks != nullptr && !chunks->empty())
+        {
+            pending = chunks->front();
+            chunks->erase(chunks->begin());
+            return 0;
+        }
+        return pending.size();
+    }
+    int read(uint8_t *buffer, size_t size)
+    {
+        size_t n = std::min(size, pending.size());
+        memcpy(buffer, pending.data(), n);
+        pending.erase(0, n);
+        return n;
+    }
+    bool connected() { return open; }
+    void stop() { open = false; }
+};
+
+void test_ClientConnection()
+{
+    TEST_MESSAGE("A frame arriving in chunks should be received across several polls, without blocking");
+
+    std::vector<std::string> chunks = {
+        std::string("\x10\x04will\x11", 7),
+        std::string("\x02it\x10\x05truly", 10),
+        std::string("\x11\x05work?", 7) + '\0' + std::string("\x10", 1)};
+    ChunkedClient client;
+    client.chunks = &chunks;
+
+    BufferPool pool;
+    ClientConnection<ChunkedClient> connection;
+    TEST_ASSERT_FALSE(connection.isOpen());
+
+    connection.open(client, pool.acquire(SerialFrame::BUFFER_SIZE));
+    TEST_ASSERT(connection.getState() == CONNECTION_AUTHENTICATING);
+
+    int polls = 0;
+    while (connection.receive() == PARSE_NEED_MORE && polls < 10)
+    {
+        polls++;
+    }
+
+    TEST_ASSERT(polls == 3);
+    ActionView frame = connection.frame();
+    TEST_ASSERT(frame.getSize() == 2);
+    TEST_ASSERT(*frame.get("will") == "it");
+    TEST_ASSERT(*frame.get("truly") == "work?");
+
+    TEST_MESSAGE("The bytes following the frame should be left for the next one");
+
+    TEST_ASSERT(connection.getClient().pending.size() == 1);
+    connection.setState(CONNECTION_READING_ACTION);
+    TEST_ASSERT(connection.receive() == PARSE_NEED_MORE);
+    TEST_ASSERT_FALSE(connection.timedOut(1000));
+    TEST_ASSERT_TRUE(connection.isConnected());
+
+    connection.close();
+    TEST_ASSERT_FALSE(connection.isOpen());
+    TEST_ASSERT_FALSE(connection.getClient().open);
+    TEST_ASSERT(pool.getUsed() == 0);
+}
+
+void test_SerialFrameParser()
+{
+    char data[] = {0x10, 4, 'w', 'i', 'l', 'l', 0x11, 0, 0x10, 5, 't', 'r', 'u', 'l', 'y', 0x11, 5, 'w', 'o', 'r', 'k', '?', 0x00, 0x10};
+    char buffer[64];
+
+    TEST_MESSAGE("Feeding a frame one byte at a time should complete exactly at its terminator");
+
+    SerialFrameParser parser(buffer, sizeof(buffer));
+    size_t fed = 0;
+    PARSE_RESULT result = PARSE_NEED_MORE;
+    while (result == PARSE_NEED_MORE && fed < sizeof(data))
+    {
+        result = parser.feed(data + fed, 1);
+        fed++;
+    }
+
+    TEST_ASSERT(result == PARSE_COMPLETE);
+    TEST_ASSERT(fed == sizeof(data) - 1);
+    TEST_ASSERT(parser.getLength() == sizeof(data) - 2);
+
+    TEST_MESSAGE("An empty value, i.e. a zero length byte, should not be taken for the terminator");
+
+    SerialMapView<10> view(parser.data(), parser.getLength());
+    TEST_ASSERT(view.getSize() == 2);
+    TEST_ASSERT(view.get("will")->length() == 0);
+    TEST_ASSERT(*view.get("truly") == "work?");
+
+    TEST_MESSAGE("Feeding the whole data should consume it up to the terminator only");
+
+    parser.reset();
+    size_t consumed = 0;
+    TEST_ASSERT(parser.feed(data, sizeof(data), &consumed) == PARSE_COMPLETE);
+    TEST_ASSERT(consumed == sizeof(data) - 1);
+
+    TEST_MESSAGE("needed() should never reach past the current field");
+
+    parser.reset();
+    TEST_ASSERT(parser.needed() == 1);
+    parser.feed(data, 2);
+    TEST_ASSERT(parser.needed() == 4);
+    memcpy(parser.tail(), data + 2, 3);
+    TEST_ASSERT(parser.advance(3) == PARSE_NEED_MORE);
+    TEST_ASSERT(parser.needed() == 1);
+
+    TEST_MESSAGE("Wrong type bytes should be reported as errors, keeping the well-formed part");
+
+    char bad[] = {0x10, 1, 'a', 0x11, 1, 'b', 0x42};
+    parser.reset();
+    TEST_ASSERT(parser.feed(bad, sizeof(bad)) == PARSE_ERROR);
+    TEST_ASSERT(parser.getLength() == 6);
+
+    TEST_MESSAGE("A frame not fitting the buffer should be reported as an error instead of being truncated");
+
+    char small[8];
+    SerialFrameParser smallParser(small, sizeof(small));
+    TEST_ASSERT(smallParser.feed(data, sizeof(data)) == PARSE_ERROR);
+
+    TEST_MESSAGE("Frames bigger than 512 bytes should be read when the buffer is big enough");
+
+    SerialMap<std::string, 10> big;
+    big.put("first", std::string(250, 'x'));
+    big.put("second", std::string(250, 'y'));
+    big.put("third", std::string(250, 'z'));
+    char serialized[1024];
+    size_t len = big.serialize(serialized, sizeof(serialized));
+
+    std::stringstream strm;
+    strm.write(serialized, len);
+    strm.seekg(std::ios::beg);
+    IoStreamProxy strmp(strm);
+
+    char bigBuffer[1024];
+    size_t read = SerialFrame::read(strmp, 3000, bigBuffer, sizeof(bigBuffer));
+
+    TEST_ASSERT(read == len - 1);
+    SerialMap<std::string, 10> parsed(bigBuffer, read);
+    TEST_ASSERT(*parsed.get("third") == std::string(250, 'z'));
+}
+
+std::string serializedAction(std::initializer_list<std::pair<std::string, std::string>> fields)
+{
+    SerialMap<std::string, 10> map;
+    for (auto &field : fields)
+    {
+        map.put(field.first, field.second);
+    }
+    char buffer[256];
+    size_t len = map.serialize(buffer, sizeof(buffer));
+    // Nested frames go without their terminator
+    return std::string(buffer, len - 1);
+}
+
+void test_Batch()
+{
+    ActionParser<4> parser;
+    std::vector<std::string> calls;
+
+    parser.with("set", [&calls](ActionMap &map, Stream &out)
+                {
+                    calls.push_back("set " + *map.get("pin"));
+                    Response::successResponse().write(out);
+                    return false; });
+    parser.with("get", [&calls](ActionView &view, Stream &out)
+                {
+                    calls.push_back("get " + view.get("pin")->toString());
+                    ResponseMap response;
+                    response.put("value", "1");
+                    response.write(out);
+                    return false; });
+    parser.with("stop", [&calls](ActionView &view, Stream &out)
+                {
+                    calls.push_back("stop");
+                    return true; });
+    parser.with("huge", [](ActionView &view, Stream &out)
+                {
+                    ResponseMap response;
+                    response.put("value", std::string(255, 'x'));
+                    response.write(out);
+                    return false; });
+    parser.freeze();
+
+    TEST_MESSAGE("BufferStream should collect the writes and flag the ones not fitting");
+
+    char small[4];
+    BufferStream buffered(small, sizeof(small));
+    buffered.write("abc");
+    TEST_ASSERT(buffered.getLength() == 3 && !buffered.hasOverflown());
+    buffered.write("de");
+    TEST_ASSERT(buffered.getLength() == 4 && buffered.hasOverflown());
+    TEST_ASSERT(memcmp(buffered.data(), "abcd", 4) == 0);
+    buffered.clear();
+    TEST_ASSERT(buffered.getLength() == 0 && !buffered.hasOverflown());
+
+    TEST_MESSAGE("A batch should execute its actions in order and answer with a single frame");
+
+    ActionMap batch;
+    batch.put("action", "__batch");
+    batch.put("0", serializedAction({{"action", "set"}, {"pin", "4"}}));
+    batch.put("1", serializedAction({{"action", "get"}, {"pin", "5"}}));
+    batch.put("2", serializedAction({{"action", "missing"}}));
+
+    std::stringstream strm;
+    IoStreamProxy strmp(strm);
+    TEST_ASSERT_FALSE(parser.execute(batch, strmp));
+
+    TEST_ASSERT(calls.size() == 2);
+    TEST_ASSERT(calls[0] == "set 4");
+    TEST_ASSERT(calls[1] == "get 5");
+
+    std::string response = strm.str();
+    TEST_ASSERT(response.back() == '\0');
+    TEST_ASSERT(std::count(response.begin(), response.end(), '\0') == 1);
+
+    SerialMapView<10> results(response.data(), response.size() - 1);
+    TEST_ASSERT(results.getSize() == 3);
+    SerialMapView<10> first(results.get("0")->data(), results.get("0")->length());
+    TEST_ASSERT(*first.get("result") == "ok");
+    SerialMapView<10> second(results.get("1")->data(), results.get("1")->length());
+    TEST_ASSERT(*second.get("value") == "1");
+
+    TEST_MESSAGE("Unknown actions, nested batches and oversized responses should get an error response");
+
+    SerialMapView<10> third(results.get("2")->data(), results.get("2")->length());
+    TEST_ASSERT(*third.get("result") == "error");
+
+    char frame[SerialFrame::BUFFER_SIZE];
+    ActionMap nested;
+    nested.put("action", "__batch");
+    nested.put("a", serializedAction({{"action", "__batch"}}));
+    nested.put("b", serializedAction({{"action", "huge"}}));
+    size_t len = nested.serialize(frame, sizeof(frame));
+    ActionView nestedView(frame, len - 1);
+
+    strm.str("");
+    TEST_ASSERT_FALSE(parser.execute(nestedView, strmp));
+    response = strm.str();
+    results = SerialMapView<10>(response.data(), response.size() - 1);
+    SerialMapView<10> refused(results.get("a")->data(), results.get("a")->length());
+    TEST_ASSERT(*refused.get("result") == "error");
+    SerialMapView<10> oversized(results.get("b")->data(), results.get("b")->length());
+    TEST_ASSERT(*oversized.get("result") == "error");
+
+    TEST_MESSAGE("A terminating action should only take effect once the whole batch is done");
+
+    calls.clear();
+    batch.remove("2");
+    batch.put("0", serializedAction({{"action", "stop"}}));
+    strm.str("");
+    TEST_ASSERT_TRUE(parser.execute(batch, strmp));
+    TEST_ASSERT(calls.size() == 2);
+    TEST_ASSERT(calls[1] == "get 5");
+    response = strm.str();
+    SerialMapView<10> stopped(response.data(), response.size() - 1);
+    TEST_ASSERT(stopped.get("0")->length() == 0);
+
+    TEST_MESSAGE("The buffers of a batch should be drawn from the pool, and the batch refused when it is used up");
+
+    BufferPool pool;
+    parser.usePool(pool);
+    strm.str("");
+    TEST_ASSERT_TRUE(parser.execute(batch, strmp));
+    TEST_ASSERT(pool.getHighWater() == SerialFrame::BUFFER_SIZE + ActionParser<4>::BATCH_RESPONSE_SIZE);
+    TEST_ASSERT(pool.getUsed() == 0);
+
+    PoolBuffer taken = pool.acquire(BufferPool::BUDGET - SerialFrame::BUFFER_SIZE);
+    calls.clear();
+    strm.str("");
+    TEST_ASSERT_FALSE(parser.execute(batch, strmp));
+    TEST_ASSERT(calls.empty());
+    response = strm.str();
+    SerialMapView<10> exhausted(response.data(), response.size() - 1);
+    TEST_ASSERT(*exhausted.get("result") == "error");
+}
+
+void test_LatencyHistogram()
+{
+    LatencyHistogram histogram;
+
+    TEST_MESSAGE("An empty histogram should report zeros");
+
+    TEST_ASSERT(histogram.getCount() == 0);
+    TEST_ASSERT(histogram.getMean() == 0);
+    TEST_ASSERT(histogram.percentile(99) == 0);
+    TEST_ASSERT(histogram.toString() == "0,0,0,0,0,0");
+
+    TEST_MESSAGE("Durations should land in power of two buckets");
+
+    histogram.record(0);
+    histogram.record(1);
+    histogram.record(3);
+    histogram.record(4);
+    histogram.record(1000000000UL);
+    TEST_ASSERT(histogram.getBucket(0) == 1);
+    TEST_ASSERT(histogram.getBucket(1) == 1);
+    TEST_ASSERT(histogram.getBucket(2) == 1);
+    TEST_ASSERT(histogram.getBucket(3) == 1);
+    TEST_ASSERT(histogram.getBucket(LatencyHistogram::BUCKETS - 1) == 1);
+    TEST_ASSERT(histogram.getMax() == 1000000000UL);
+
+    TEST_MESSAGE("Percentiles should be within a factor of two and never above the maximum");
+
+    histogram.clear();
+    for (unsigned long us = 1; us <= 1000; us++)
+    {
+        histogram.record(us);
+    }
+    TEST_ASSERT(histogram.getCount() == 1000);
+    TEST_ASSERT(histogram.getMean() == 500);
+    TEST_ASSERT(histogram.percentile(50) >= 500 && histogram.percentile(50) < 1000);
+    TEST_ASSERT(histogram.percentile(99) == 1000);
+    TEST_ASSERT(histogram.toString() == "1000,500,511,1000,1000,1000");
+
+    TEST_MESSAGE("TimedStream should forward the writes and measure them");
+
+    std::stringstream strm;
+    IoStreamProxy strmp(strm);
+    TimedStream timed(strmp);
+    timed.write("abc");
+    TEST_ASSERT(strm.str() == "abc");
+
+    TEST_MESSAGE("The parser should record the execution time of each action, batched ones included");
+
+    ActionParser<2> parser;
+    parser.with("fast", [](ActionView &view, Stream &out)
+                { return false; });
+    parser.with("slow", [](ActionMap &map, Stream &out)
+                {
+                    unsigned long start = micros();
+                    while (micros() - start < 2000)
+                        ;
+                    return false; });
+    parser.freeze();
+
+    ActionMap request;
+    request.put("action", "slow");
+    parser.execute(request, strmp);
+    ActionMap batch;
+    batch.put("action", "__batch");
+    batch.put("0", serializedAction({{"action", "fast"}}));
+    batch.put("1", serializedAction({{"action", "slow"}}));
+    parser.execute(batch, strmp);
+
+    std::vector<std::pair<std::string, LatencyHistogram>> latencies;
+    parser.forEachLatency([&latencies](const std::string &name, const LatencyHistogram &latency)
+                          { latencies.push_back({name, latency}); });
+    TEST_ASSERT(latencies.size() == 2);
+    for (auto &latency : latencies)
+    {
+        if (latency.first == "slow")
+        {
+            TEST_ASSERT(latency.second.getCount() == 2);
+            TEST_ASSERT(latency.second.percentile(50) >= 2000);
+        }
+        else
+        {
+            TEST_ASSERT(latency.second.getCount() == 1);
+        }
+    }
+
+    parser.clearLatencies();
+    parser.forEachLatency([](const std::string &name, const LatencyHistogram &latency)
+                          { TEST_ASSERT(latency.getCount() == 0); });
+}
+
+struct Counter
+{
+    int count = 0;
+    bool increment(ActionMap &map, Stream &output)
+    {
+        count++;
+        return false;
+    }
+};
+
+void test_InplaceFunction()
+{
+    TEST_MESSAGE("An empty function should be false, a set one should be called with its arguments");
+
+    InplaceFunction<int(int, int)> empty;
+    TEST_ASSERT_FALSE((bool)empty);
+    InplaceFunction<int(int, int)> sum = [](int a, int b)
+    { return a + b; };
+    TEST_ASSERT_TRUE((bool)sum);
+    TEST_ASSERT_EQUAL_INT(sum(2, 3), 5);
+    sum = nullptr;
+    TEST_ASSERT_FALSE((bool)sum);
+
+    TEST_MESSAGE("Bound member functions and captured values should be stored without allocating");
+
+    Counter counter;
+    unsigned long before = allocations;
+    InplaceFunction<bool(ActionMap &, Stream &)> bound = std::bind(&Counter::increment, &counter, std::placeholders::_1, std::placeholders::_2);
+    std::string captured = "value";
+    InplaceFunction<size_t()> capturing = [captured]()
+    { return captured.length(); };
+    TEST_ASSERT(allocations == before);
+    ActionMap map;
+    Stream output;
+    bound(map, output);
+    TEST_ASSERT_EQUAL_INT(counter.count, 1);
+    TEST_ASSERT_EQUAL_INT(capturing(), 5);
+
+    TEST_MESSAGE("Copies and moves should keep the callable alive exactly once");
+
+    {
+        Tracked tracked(3);
+        InplaceFunction<int()> function = [tracked]()
+        { return tracked.value; };
+        TEST_ASSERT_EQUAL_INT(Tracked::instances, 2);
+        InplaceFunction<int()> copy = function;
+        InplaceFunction<int()> moved = std::move(function);
+        TEST_ASSERT_EQUAL_INT(copy(), 3);
+        TEST_ASSERT_EQUAL_INT(moved(), 3);
+        TEST_ASSERT_EQUAL_INT(Tracked::instances, 4);
+        copy = moved;
+        TEST_ASSERT_EQUAL_INT(Tracked::instances, 4);
+        copy = nullptr;
+        TEST_ASSERT_EQUAL_INT(Tracked::instances, 3);
+    }
+    TEST_ASSERT_EQUAL_INT(Tracked::instances, 0);
+
+    TEST_MESSAGE("The callable signature should pick the ActionParser overload");
+
+    ActionParser<2> parser;
+    int views = 0;
+    parser.with("map", std::bind(&Counter::increment, &counter, std::placeholders::_1, std::placeholders::_2));
+    parser.with("view", [&views](ActionView &view, Stream &out)
+                {
+                    views++;
+                    return false; });
+    ActionMap request;
+    request.put("action", "map");
+    parser.execute(request, output);
+    request.put("action", "view");
+    parser.execute(request, output);
+    TEST_ASSERT_EQUAL_INT(counter.count, 2);
+    TEST_ASSERT_EQUAL_INT(views, 1);
+}
+
+// Records every write reaching it, e.g. one per TLS record on a secure client
+class RecordingStream : public Stream
+{
+public:
+    using Stream::write;
+    size_t write(uint8_t c) override
+    {
+        writes.push_back(std::string(1, (char)c));
+        return 1;
+    }
+    size_t write(const uint8_t *data, size_t sz) override
+    {
+        writes.push_back(std::string(reinterpret_cast<const char *>(data), sz));
+        return sz;
+    }
+    std::string all() const
+    {
+        std::string data;
+        for (auto &write : writes)
+        {
+            data += write;
+        }
+        return data;
+    }
+    std::vector<std::string> writes;
+};
+
+void test_BufferedWriter()
+{
+    RecordingStream unbuffered;
+    Response::successResponse().write(unbuffered);
+
+    TEST_MESSAGE("A response should reach the stream in a single write, only once flushed");
+
+    RecordingStream recording;
+    char buffer[64];
+    BufferedWriter output(recording, buffer, sizeof(buffer));
+    Response::successResponse().write(output);
+    TEST_ASSERT(recording.writes.empty());
+    TEST_ASSERT(output.getBuffered() == unbuffered.all().size());
+    output.flush();
+    TEST_ASSERT(unbuffered.writes.size() > 1);
+    TEST_ASSERT(recording.writes.size() == 1);
+    TEST_ASSERT(recording.writes[0] == unbuffered.all());
+    TEST_ASSERT(output.getBuffered() == 0);
+
+    TEST_MESSAGE("Frames larger than the buffer should be sent whole and in order");
+
+    recording.writes.clear();
+    ResponseMap large;
+    large.put("value", std::string(200, 'x'));
+    RecordingStream expected;
+    output.write("abc");
+    large.write(output);
+    output.flush();
+    expected.write("abc");
+    large.write(expected);
+    TEST_ASSERT(recording.all() == expected.all());
+    // The data buffered before the value, the value itself and the terminator
+    TEST_ASSERT(recording.writes.size() == 3);
+    TEST_ASSERT(recording.writes[1] == std::string(200, 'x'));
+
+    TEST_MESSAGE("The data left should be sent on destruction, each write at once with FLUSH_EACH_WRITE");
+
+    recording.writes.clear();
+    {
+        BufferedWriter scoped(recording, buffer, sizeof(buffer));
+        scoped.write("left");
+    }
+    TEST_ASSERT(recording.writes.size() == 1 && recording.writes[0] == "left");
+
+    recording.writes.clear();
+    BufferedWriter direct(recording, buffer, sizeof(buffer), FLUSH_EACH_WRITE);
+    Response::successResponse().write(direct);
+    TEST_ASSERT(direct.getBuffered() == 0);
+    TEST_ASSERT(recording.writes == unbuffered.writes);
+
+    TEST_MESSAGE("Reads should be forwarded to the underlying stream");
+
+    std::stringstream strm;
+    strm.write("\x10\x01k\x11\x01v", 6);
+    strm.put('\0');
+    IoStreamProxy strmp(strm);
+    BufferedWriter readable(strmp, buffer, sizeof(buffer));
+    char frame[16];
+    ActionView view = ActionView::fromStream(readable, 100, frame, sizeof(frame));
+    TEST_ASSERT(*view.get("k") == "v");
+}
+
+std::string hex(const uint8_t *data, size_t len)
+{
+    std::string out;
+    char digits[3];
+    for (size_t i = 0; i < len; i++)
+    {
+        snprintf(digits, sizeof(digits), "%02x", data[i]);
+        out += digits;
+    }
+    return out;
+}
+
+// Appends the hmac field to a frame without its terminator, signing every field before it
+std::string withHmac(const std::string &frame, const char *password)
+{
+    // The fields follow the version byte of a v2 frame
+    size_t start = SerialFrame::versionOf(frame.data(), frame.size()) == FRAME_V2 ? 1 : 0;
+    HmacSha256 mac(password, strlen(password));
+    mac.update(frame.data() + start, frame.size() - start);
+    uint8_t digest[Sha256::DIGEST_SIZE];
+    mac.finish(digest);
+    return frame + std::string("\x10\x04hmac\x11\x40", 8) + hex(digest, sizeof(digest));
+}
+
+void test_FrameAuthenticator()
+{
+    uint8_t digest[Sha256::DIGEST_SIZE];
+
+    TEST_MESSAGE("SHA-256 and HMAC-SHA256 should match the reference vectors");
+
+    Sha256 sha;
+    sha.update("abc", 3);
+    sha.finish(digest);
+    TEST_ASSERT(hex(digest, sizeof(digest)) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+
+    sha.reset();
+    std::string thousand(1000, 'a');
+    for (size_t i = 0; i < thousand.size(); i += 100)
+    {
+        sha.update(thousand.data() + i, 100);
+    }
+    sha.finish(digest);
+    TEST_ASSERT(hex(digest, sizeof(digest)) == "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3");
+
+    HmacSha256 mac("Jefe", 4);
+    mac.update("what do ya want for nothing?", 28);
+    mac.finish(digest);
+    TEST_ASSERT(hex(digest, sizeof(digest)) == "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+
+    FrameAuthenticator credentials("user", "secret");
+
+    TEST_MESSAGE("Frames carrying the right username and password should be accepted");
+
+    ActionMap request;
+    request.put("action", "setpin");
+    request.put("username", "user");
+    request.put("password", "secret");
+    char frame[SerialFrame::BUFFER_SIZE];
+    size_t len = request.serialize(frame, sizeof(frame));
+    TEST_ASSERT_TRUE(credentials.authorize(ActionView(frame, len - 1), 0));
+
+    request.put("password", "wrong");
+    len = request.serialize(frame, sizeof(frame));
+    TEST_ASSERT_FALSE(credentials.authorize(ActionView(frame, len - 1), 0));
+
+    TEST_MESSAGE("Frames with a valid HMAC should be accepted once per nonce");
+
+    std::string signedFrame = serializedAction({{"action", "setpin"}, {"pin", "4"}, {"nonce", "42"}});
+    std::string withMac = signedFrame + std::string("\x10\x04hmac\x11\x40", 8) + "37c45068b40570ca03c85dd872f3d8ada82d00385712aa741aaeec3b0ee2cb33";
+    ActionView hmacView(withMac.data(), withMac.size());
+    TEST_ASSERT_TRUE(credentials.authorize(hmacView, 0));
+    TEST_ASSERT_FALSE(credentials.authorize(hmacView, 0));
+
+    std::string tampered = withMac;
+    tampered[tampered.find("\x01" "4") + 1] = '5';
+    credentials = FrameAuthenticator("user", "secret");
+    TEST_ASSERT_FALSE(credentials.authorize(ActionView(tampered.data(), tampered.size()), 0));
+    TEST_ASSERT_TRUE(credentials.authorize(hmacView, 0));
+
+    TEST_MESSAGE("The nonce of a v2 frame should be accepted as an integer");
+
+    RecordingStream typed;
+    SerialFrameWriter writer(typed, FRAME_V2);
+    writer.put("action", "setpin");
+    writer.putInt("nonce", 43);
+    writer.end();
+    std::string v2 = typed.all();
+    v2.pop_back();
+    std::string v2Signed = withHmac(v2, "secret");
+    TEST_ASSERT_TRUE(credentials.authorize(ActionView(v2Signed.data(), v2Signed.size()), 0));
+    TEST_ASSERT_FALSE(credentials.authorize(ActionView(v2Signed.data(), v2Signed.size()), 0));
+
+    TEST_MESSAGE("A signed frame with a repeated key or more fields than the view holds should be refused");
+
+    std::string repeated = withHmac(serializedAction({{"action", "setpin"}, {"nonce", "50"}}) + std::string("\x10\x06" "action\x11\x06" "reboot", 16), "secret");
+    TEST_ASSERT_FALSE(credentials.authorize(ActionView(repeated.data(), repeated.size()), 0));
+
+    std::string crowded = serializedAction({{"action", "setpin"}, {"nonce", "51"}, {"a", "1"}, {"b", "2"}, {"c", "3"}, {"d", "4"}, {"e", "5"}, {"f", "6"}, {"g", "7"}, {"h", "8"}});
+    std::string crowdedSigned = withHmac(crowded, "secret");
+    ActionView crowdedView(crowdedSigned.data(), crowdedSigned.size());
+    TEST_ASSERT_TRUE(crowdedView.isTruncated());
+    TEST_ASSERT_FALSE(credentials.authorize(crowdedView, 0));
+    std::string fitting = withHmac(serializedAction({{"action", "setpin"}, {"nonce", "52"}, {"a", "1"}}), "secret");
+    TEST_ASSERT_TRUE(credentials.authorize(ActionView(fitting.data(), fitting.size()), 0));
+
+    TEST_MESSAGE("The nonce floor should be persisted ahead of the nonces, and refuse them after a reboot");
+
+    std::vector<uint32_t> floors;
+    FrameAuthenticator persisted("user", "secret");
+    persisted.persistNonces(0, [&floors](uint32_t floor)
+                            { floors.push_back(floor);
+                              return true; });
+    for (int nonce = 1; nonce <= 300; nonce++)
+    {
+        std::string frame = withHmac(serializedAction({{"action", "setpin"}, {"nonce", std::to_string(nonce)}}), "secret");
+        TEST_ASSERT_TRUE(persisted.authorize(ActionView(frame.data(), frame.size()), 0));
+    }
+    TEST_ASSERT(floors.size() == 2);
+    TEST_ASSERT(floors[0] == 1 + FrameAuthenticator::NONCE_RESERVATION);
+    TEST_ASSERT(floors[1] == 257 + FrameAuthenticator::NONCE_RESERVATION);
+
+    bool writable = false;
+    FrameAuthenticator rebooted("user", "secret");
+    rebooted.persistNonces(floors.back(), [&writable](uint32_t floor)
+                           { return writable; });
+    std::string replayed = withHmac(serializedAction({{"action", "setpin"}, {"nonce", "300"}}), "secret");
+    TEST_ASSERT_FALSE(rebooted.authorize(ActionView(replayed.data(), replayed.size()), 0));
+    std::string next = withHmac(serializedAction({{"action", "setpin"}, {"nonce", std::to_string(floors.back() + 1)}}), "secret");
+    TEST_ASSERT_FALSE(rebooted.authorize(ActionView(next.data(), next.size()), 0));
+    writable = true;
+    TEST_ASSERT_TRUE(rebooted.authorize(ActionView(next.data(), next.size()), 0));
+
+    TEST_MESSAGE("Session tokens should only be issued when enabled, and accepted until they expire");
+
+    char token[FrameAuthenticator::TOKEN_LENGTH + 1];
+    TEST_ASSERT_FALSE(credentials.issueToken(1000, token));
+
+    uint8_t key[FrameAuthenticator::KEY_SIZE] = {1, 2, 3};
+    credentials.enableTokens(key, 60000);
+    TEST_ASSERT_TRUE(credentials.issueToken(0xfffff000UL, token));
+    TEST_ASSERT(strlen(token) == FrameAuthenticator::TOKEN_LENGTH);
+
+    std::string tokenFrame = serializedAction({{"action", "setpin"}, {"token", token}});
+    ActionView tokenView(tokenFrame.data(), tokenFrame.size());
+    TEST_ASSERT_TRUE(credentials.authorize(tokenView, 0xfffff000UL + 1000));
+    TEST_ASSERT_TRUE(credentials.authorize(tokenView, 0xfffff000UL + 59999));
+    TEST_ASSERT_FALSE(credentials.authorize(tokenView, 0xfffff000UL + 60000));
+
+    token[FrameAuthenticator::TOKEN_LENGTH - 1] ^= 1;
+    SerialSlice forged(token, FrameAuthenticator::TOKEN_LENGTH);
+    TEST_ASSERT_FALSE(credentials.checkToken(forged, 0xfffff000UL + 1000));
+
+    uint8_t otherKey[FrameAuthenticator::KEY_SIZE] = {3, 2, 1};
+    credentials.enableTokens(otherKey, 60000);
+    TEST_ASSERT_FALSE(credentials.authorize(tokenView, 0xfffff000UL + 1000));
+}
+
+void test_SettingsStore()
+{
+    EEPROMMock eeprom(256);
+    SettingsStore<EEPROMMock, 4> settings(eeprom, 0, 256);
+
+    TEST_MESSAGE("An empty EEPROM should not hold a log until formatted");
+
+    TEST_ASSERT_FALSE(settings.load());
+    settings.format();
+    TEST_ASSERT_TRUE(settings.commit());
+    TEST_ASSERT(settings.getSize() == 0);
+    TEST_ASSERT_FALSE(settings.has("bssid"));
+
+    TEST_MESSAGE("Several updates should be written to flash by a single commit");
+
+    unsigned commits = eeprom.getCommits();
+    TEST_ASSERT_TRUE(settings.put("bssid", "home"));
+    TEST_ASSERT_TRUE(settings.put("password", "secret"));
+    TEST_ASSERT_TRUE(settings.put("bssid", "office"));
+    TEST_ASSERT_TRUE(settings.isDirty());
+    TEST_ASSERT(*settings.get("bssid") == "office");
+    TEST_ASSERT(*settings.get("password") == "secret");
+    TEST_ASSERT_TRUE(settings.commit());
+    TEST_ASSERT(eeprom.getCommits() == commits + 1);
+
+    TEST_MESSAGE("Setting a key to the value it holds should not need a commit");
+
+    TEST_ASSERT_TRUE(settings.put("password", "secret"));
+    TEST_ASSERT_FALSE(settings.isDirty());
+    TEST_ASSERT_TRUE(settings.commit());
+    TEST_ASSERT(eeprom.getCommits() == commits + 1);
+
+    TEST_MESSAGE("The committed settings should survive a reboot, the uncommitted ones should not");
+
+    TEST_ASSERT_TRUE(settings.put("pin", "4"));
+    TEST_ASSERT_TRUE(settings.remove("password"));
+    TEST_ASSERT_FALSE(settings.has("password"));
+    eeprom.reboot();
+    TEST_ASSERT_TRUE(settings.load());
+    TEST_ASSERT(settings.getSize() == 2);
+    TEST_ASSERT(*settings.get("bssid") == "office");
+    TEST_ASSERT(*settings.get("password") == "secret");
+    TEST_ASSERT_FALSE(settings.has("pin"));
+
+    TEST_ASSERT_TRUE(settings.remove("password"));
+    TEST_ASSERT_TRUE(settings.commit());
+    eeprom.reboot();
+    TEST_ASSERT_TRUE(settings.load());
+    TEST_ASSERT(settings.getSize() == 1);
+    TEST_ASSERT_FALSE(settings.has("password"));
+
+    TEST_MESSAGE("A full log should be compacted, keeping the latest values");
+
+    for (int i = 0; i < 100; i++)
+    {
+        TEST_ASSERT_TRUE(settings.put("counter", std::to_string(i).c_str()));
+        TEST_ASSERT_TRUE(settings.put("bssid", i % 2 == 0 ? "even" : "odd"));
+    }
+    TEST_ASSERT(settings.getCompactions() > 0);
+    TEST_ASSERT(settings.getUsed() <= settings.getCapacity());
+    TEST_ASSERT(*settings.get("counter") == "99");
+    TEST_ASSERT(*settings.get("bssid") == "odd");
+    TEST_ASSERT_TRUE(settings.commit());
+    eeprom.reboot();
+    TEST_ASSERT_TRUE(settings.load());
+    TEST_ASSERT(settings.getSize() == 2);
+    TEST_ASSERT(*settings.get("counter") == "99");
+    TEST_ASSERT(*settings.get("bssid") == "odd");
+
+    TEST_MESSAGE("The latest value of a key updated several times should survive a compaction");
+
+    EEPROMMock smallEeprom(64);
+    SettingsStore<EEPROMMock, 4> small(smallEeprom, 0, 64);
+    small.format();
+    TEST_ASSERT_TRUE(small.put("k", "first"));
+    TEST_ASSERT_TRUE(small.put("k", "second"));
+    TEST_ASSERT_TRUE(small.put("k", "third-value-long"));
+    unsigned compactions = small.getCompactions();
+    TEST_ASSERT_TRUE(small.put("z", "12345678901234"));
+    TEST_ASSERT(small.getCompactions() == compactions + 1);
+    TEST_ASSERT(*small.get("k") == "third-value-long");
+    TEST_ASSERT(*small.get("z") == "12345678901234");
+    TEST_ASSERT_TRUE(small.commit());
+    smallEeprom.reboot();
+    TEST_ASSERT_TRUE(small.load());
+    TEST_ASSERT(small.getSize() == 2);
+    TEST_ASSERT(*small.get("k") == "third-value-long");
+    TEST_ASSERT(*small.get("z") == "12345678901234");
+
+    TEST_MESSAGE("A corrupted record should end the log, keeping the records before it");
+
+    size_t used = settings.getUsed();
+    TEST_ASSERT_TRUE(settings.put("pin", "1234"));
+    TEST_ASSERT_TRUE(settings.commit());
+    eeprom.write(used + 3, eeprom.read(used + 3) ^ 1);
+    eeprom.commit();
+    TEST_ASSERT_TRUE(settings.load());
+    TEST_ASSERT_FALSE(settings.has("pin"));
+    TEST_ASSERT(*settings.get("counter") == "99");
+    TEST_ASSERT(settings.getUsed() == used);
+    TEST_ASSERT_TRUE(settings.put("pin", "5678"));
+    TEST_ASSERT(*settings.get("pin") == "5678");
+
+    TEST_MESSAGE("The store should refuse more keys than it indexes, and values it can't fit");
+
+    TEST_ASSERT_TRUE(settings.put("mode", "a"));
+    TEST_ASSERT_FALSE(settings.put("extra", "b"));
+    std::string large(SettingsStore<EEPROMMock, 4>::MAX_LENGTH, 'x');
+    TEST_ASSERT_FALSE(settings.put("mode", large.c_str()));
+    TEST_ASSERT(*settings.get("mode") == "a");
+    TEST_ASSERT_FALSE(settings.put("mode", (large + "x").c_str()));
+}
+
+void test_WifiConnector()
+{
+    WifiMock wifi;
+    WifiConnector<WifiMock> connector(wifi);
+    int loops = 0;
+    connector.setLoopCallback([&loops]()
+                              { loops++; });
+    WifiHint hint;
+
+    TEST_MESSAGE("Without a hint the connection should scan, and return the hint of the connection");
+
+    TEST_ASSERT_TRUE(connector.connect("ssid", "pass", hint, 100, 1000));
+    TEST_ASSERT(connector.getPath() == WIFI_CONNECT_SCAN);
+    TEST_ASSERT(wifi.scans == 1);
+    TEST_ASSERT(loops == wifi.pollsToConnect - 1);
+    TEST_ASSERT_TRUE(hint.isValid());
+    TEST_ASSERT(hint.channel == 6);
+    TEST_ASSERT(memcmp(hint.bssid, wifi.networkBssid, WifiHint::BSSID_SIZE) == 0);
+
+    TEST_MESSAGE("With a valid hint the connection should skip the scan");
+
+    WifiHint saved = hint;
+    TEST_ASSERT_TRUE(connector.connect("ssid", "pass", hint, 100, 1000));
+    TEST_ASSERT(connector.getPath() == WIFI_CONNECT_FAST);
+    TEST_ASSERT(wifi.begins == 2);
+    TEST_ASSERT(wifi.scans == 1);
+    TEST_ASSERT(hint == saved);
+
+    TEST_MESSAGE("A stale hint should fall back to a scan and be replaced");
+
+    wifi.networkChannel = 11;
+    TEST_ASSERT_TRUE(connector.connect("ssid", "pass", hint, 20, 1000));
+    TEST_ASSERT(connector.getPath() == WIFI_CONNECT_SCAN);
+    TEST_ASSERT(wifi.scans == 2);
+    TEST_ASSERT(connector.getConnectTime() >= 20);
+    TEST_ASSERT(hint.channel == 11);
+    TEST_ASSERT(hint != saved);
+
+    TEST_MESSAGE("A fast connect timeout of 0 should always scan");
+
+    TEST_ASSERT_TRUE(connector.connect("ssid", "pass", hint, 0, 1000));
+    TEST_ASSERT(connector.getPath() == WIFI_CONNECT_SCAN);
+    TEST_ASSERT(wifi.scans == 3);
+
+    TEST_MESSAGE("An unreachable network should fail after both timeouts, leaving the hint alone");
+
+    wifi.available = false;
+    saved = hint;
+    TEST_ASSERT_FALSE(connector.connect("ssid", "pass", hint, 10, 30));
+    TEST_ASSERT(connector.getPath() == WIFI_CONNECT_FAILED);
+    TEST_ASSERT(connector.getConnectTime() >= 40);
+    TEST_ASSERT(hint == saved);
+}
+
+void test_AsyncTask()
+{
+    ActionParser<4> parser;
+    bool sensor = false;
+    int steps = 0;
+    parser.with("move", [&sensor, &steps](ActionView &action, Stream &out, AsyncContext &context) -> Async
+                {
+                    ASYNC_BEGIN(context);
+                    steps++;
+                    ASYNC_SLEEP(context, 20);
+                    steps++;
+                    ASYNC_UNTIL(context, sensor);
+                    out.write("done");
+                    ASYNC_RETURN(context, action.get("stop") != nullptr);
+                    ASYNC_END(context); });
+    parser.with("sync", [](ActionView &action, Stream &out)
+                { return false; });
+    parser.freeze();
+
+    TEST_MESSAGE("An asynchronous action should wait for its timer, then for its condition");
+
+    std::string frame = serializedAction({{"action", "move"}});
+    ActionView view(frame.data(), frame.size());
+    RecordingStream output;
+    AsyncTask task;
+    TEST_ASSERT_TRUE(parser.startAsync(view, output, task));
+    TEST_ASSERT_TRUE(task.isRunning());
+    TEST_ASSERT(steps == 0);
+
+    unsigned long start = millis();
+    TEST_ASSERT_FALSE(task.poll());
+    TEST_ASSERT(steps == 1);
+    while (millis() - start < 30)
+    {
+        TEST_ASSERT_FALSE(task.poll());
+    }
+    TEST_ASSERT(steps == 2);
+    TEST_ASSERT(output.writes.empty());
+
+    sensor = true;
+    TEST_ASSERT_TRUE(task.poll());
+    TEST_ASSERT_FALSE(task.isRunning());
+    TEST_ASSERT_FALSE(task.getResult());
+    TEST_ASSERT(output.all() == "done");
+
+    int recorded = 0;
+    parser.forEachLatency([&recorded](const String &name, const LatencyHistogram &latency)
+                          { recorded += name == "move" ? latency.getCount() : 0; });
+    TEST_ASSERT(recorded == 1);
+
+    TEST_MESSAGE("Only the asynchronous actions should be started");
+
+    std::string syncFrame = serializedAction({{"action", "sync"}});
+    ActionView syncView(syncFrame.data(), syncFrame.size());
+    TEST_ASSERT_FALSE(parser.isAsync(syncView));
+    TEST_ASSERT_FALSE(parser.startAsync(syncView, output, task));
+    TEST_ASSERT_FALSE(task.isRunning());
+
+    TEST_MESSAGE("Executing an asynchronous action should run it to completion, passing its result back");
+
+    std::string stopFrame = serializedAction({{"action", "move"}, {"stop", "1"}});
+    ActionView stopView(stopFrame.data(), stopFrame.size());
+    output.writes.clear();
+    steps = 0;
+    TEST_ASSERT_TRUE(parser.execute(stopView, output));
+    TEST_ASSERT(steps == 2);
+    TEST_ASSERT(output.all() == "done");
+
+    TEST_MESSAGE("A cancelled action should never resume");
+
+    output.writes.clear();
+    steps = 0;
+    sensor = false;
+    TEST_ASSERT_TRUE(parser.startAsync(view, output, task));
+    TEST_ASSERT_FALSE(task.poll());
+    task.cancel();
+    sensor = true;
+    TEST_ASSERT_FALSE(task.isRunning());
+    TEST_ASSERT_TRUE(task.poll());
+    TEST_ASSERT(steps == 1);
+    TEST_ASSERT(output.writes.empty());
+}
+
+void test_DiscoveryResponder()
+{
+    CommandServerSettings settings = {};
+    settings.UDP_PORT = 5001;
+    settings.UDP_PACKET = "RCS";
+    settings.UDP_PACKET_SIZE = 3;
+    settings.UDP_RATE_MS = 1000;
+    settings.UDP_RATE_MAX_MS = 8000;
+    UdpMock udp;
+    DiscoveryResponder<UdpMock> discovery(udp, settings);
+
+    TEST_MESSAGE("The beacons should start right away, then back off up to the longest interval across the millis() wrap");
+
+    // The log of the beacons sent, as the offsets from the start
+    unsigned long start = ULONG_MAX - 1500;
+    std::vector<unsigned long> beacons;
+    discovery.begin(IPAddress(192, 168, 1, 255), start);
+    for (unsigned long t = 0; t <= 24000; t += 100)
+    {
+        size_t before = udp.sent.size();
+        discovery.poll(start + t);
+        if (udp.sent.size() > before)
+        {
+            beacons.push_back(t);
+        }
+    }
+    TEST_ASSERT((beacons == std::vector<unsigned long>{0, 1000, 3000, 7000, 15000, 23000}));
+    TEST_ASSERT(discovery.getInterval() == 8000);
+    TEST_ASSERT(discovery.getBeacons() == 6);
+    TEST_ASSERT(udp.sent[0].ip.toString() == "192.168.1.255");
+    TEST_ASSERT(udp.sent[0].port == 5001);
+    TEST_ASSERT(udp.sent[0].data == "RCS");
+
+    TEST_MESSAGE("A probe should be answered straight away to its sender, bringing the beacons back to the highest rate");
+
+    udp.sent.clear();
+    unsigned long now = start + 25000;
+    udp.incoming.push_back({IPAddress(192, 168, 1, 20), 40000, "RCS_DISCOVER"});
+    discovery.poll(now);
+    TEST_ASSERT(udp.sent.size() == 1);
+    TEST_ASSERT(udp.sent[0].ip.toString() == "192.168.1.20");
+    TEST_ASSERT(udp.sent[0].port == 40000);
+    TEST_ASSERT(udp.sent[0].data == "RCS");
+    TEST_ASSERT(discovery.getProbes() == 1);
+    TEST_ASSERT(discovery.getInterval() == 1000);
+    discovery.poll(now + 999);
+    TEST_ASSERT(udp.sent.size() == 1);
+    discovery.poll(now + 1000);
+    TEST_ASSERT(udp.sent.size() == 2);
+    TEST_ASSERT(udp.sent[1].ip.toString() == "192.168.1.255");
+
+    TEST_MESSAGE("The other datagrams, the beacons of the servers included, should be ignored");
+
+    udp.sent.clear();
+    udp.incoming.push_back({IPAddress(192, 168, 1, 21), 5001, "RCS"});
+    udp.incoming.push_back({IPAddress(192, 168, 1, 22), 40000, "RCS_DISCOVERY"});
+    udp.incoming.push_back({IPAddress(192, 168, 1, 23), 40000, "rcs_discover"});
+    discovery.poll(now + 1001);
+    TEST_ASSERT(udp.sent.empty());
+    TEST_ASSERT(udp.incoming.empty());
+    TEST_ASSERT(discovery.getProbes() == 1);
+
+    TEST_MESSAGE("A flood of probes should be answered a few per poll");
+
+    for (int i = 0; i < 10; i++)
+    {
+        udp.incoming.push_back({IPAddress(10, 0, 0, i), 40000, "RCS_DISCOVER"});
+    }
+    discovery.poll(now + 1002);
+    TEST_ASSERT(udp.sent.size() == DiscoveryResponder<UdpMock>::MAX_DATAGRAMS_PER_POLL);
+    TEST_ASSERT(udp.incoming.size() == 10 - DiscoveryResponder<UdpMock>::MAX_DATAGRAMS_PER_POLL);
+
+    TEST_MESSAGE("Without a probe or a longest interval, the server should only send beacons at a fixed rate");
+
+    settings.UDP_PROBE_PACKET = nullptr;
+    settings.UDP_RATE_MAX_MS = 0;
+    UdpMock fixedUdp;
+    DiscoveryResponder<UdpMock> fixed(fixedUdp, settings);
+    fixed.begin(IPAddress(192, 168, 1, 255), 0);
+    fixedUdp.incoming.push_back({IPAddress(192, 168, 1, 20), 40000, "RCS_DISCOVER"});
+    for (unsigned long t = 0; t <= 5000; t += 500)
+    {
+        fixed.poll(t);
+    }
+    TEST_ASSERT(fixed.getProbes() == 0);
+    TEST_ASSERT(fixed.getBeacons() == 6);
+    TEST_ASSERT(fixed.getInterval() == 1000);
+}
+
+void test_FrameV2()
+{
+    TEST_MESSAGE("Typed values should be written without conversions and read back by type");
+
+    RecordingStream typed;
+    SerialFrameWriter writer(typed, FRAME_V2);
+    TEST_ASSERT_TRUE(writer.put("name", "motor"));
+    TEST_ASSERT_TRUE(writer.putInt("steps", -1200));
+    TEST_ASSERT_TRUE(writer.putInt("min", INT32_MIN));
+    TEST_ASSERT_TRUE(writer.putInt("max", INT32_MAX));
+    TEST_ASSERT_TRUE(writer.putFloat("ratio", 0.25f));
+    TEST_ASSERT_TRUE(writer.putBool("on", true));
+    const uint8_t blob[] = {0x00, 0xFF, 0x10, 0x11};
+    TEST_ASSERT_TRUE(writer.putBinary("blob", blob, sizeof(blob)));
+    writer.end();
+
+    std::string frame = typed.all();
+    TEST_ASSERT(frame[0] == SerialFrame::VERSION_2);
+    TEST_ASSERT(frame.back() == '\0');
+    SerialMapView<10> view(frame.data(), frame.size() - 1);
+    TEST_ASSERT(view.getVersion() == FRAME_V2);
+    TEST_ASSERT(view.getSize() == 7);
+    TEST_ASSERT(*view.get("name") == "motor");
+    TEST_ASSERT(view.get("steps")->getType() == SerialFrame::INT_TYPE);
+    TEST_ASSERT(view.get("steps")->toInt() == -1200);
+    TEST_ASSERT(view.get("min")->toInt() == INT32_MIN);
+    TEST_ASSERT(view.get("max")->toInt() == INT32_MAX);
+    TEST_ASSERT(view.get("ratio")->toFloat() == 0.25f);
+    TEST_ASSERT_TRUE(view.get("on")->toBool());
+    TEST_ASSERT(view.get("blob")->getType() == SerialFrame::BINARY_TYPE);
+    TEST_ASSERT(view.get("blob")->equals(reinterpret_cast<const char *>(blob), sizeof(blob)));
+
+    TEST_MESSAGE("Typed values should read and compare as text, and strings as numbers");
+
+    TEST_ASSERT(*view.get("steps") == "-1200");
+    TEST_ASSERT(view.get("steps")->toString() == "-1200");
+    TEST_ASSERT(*view.get("ratio") == "0.25");
+    TEST_ASSERT(*view.get("on") == "true");
+    char text[] = {0x10, 1, 'n', 0x11, 3, '4', '.', '5', 0x10, 1, 'b', 0x11, 4, 't', 'r', 'u', 'e'};
+    SerialMapView<2> textView(text, sizeof(text));
+    TEST_ASSERT(textView.getVersion() == FRAME_V1);
+    TEST_ASSERT(textView.get("n")->toFloat() == 4.5f);
+    TEST_ASSERT(textView.get("n")->toInt() == 4);
+    TEST_ASSERT_TRUE(textView.get("b")->toBool());
+
+    TEST_MESSAGE("A v1 writer should send the typed values as text and refuse the fields longer than 255 bytes");
+
+    RecordingStream legacy;
+    SerialFrameWriter legacyWriter(legacy, FRAME_V1);
+    TEST_ASSERT_TRUE(legacyWriter.putInt("steps", -1200));
+    TEST_ASSERT_TRUE(legacyWriter.putBool("on", false));
+    TEST_ASSERT_FALSE(legacyWriter.put("long", 4, std::string(256, 'x').c_str(), 256));
+    legacyWriter.end();
+    std::string legacyFrame = legacy.all();
+    SerialMap<std::string, 4> legacyMap(legacyFrame.data(), legacyFrame.size() - 1);
+    TEST_ASSERT(legacyMap.getVersion() == FRAME_V1);
+    TEST_ASSERT(legacyMap.getSize() == 2);
+    TEST_ASSERT(*legacyMap.get("steps") == "-1200");
+    TEST_ASSERT(*legacyMap.get("on") == "false");
+
+    TEST_MESSAGE("A SerialMap should decode the typed values as text, and keep the version when encoding again");
+
+    SerialMap<std::string, 10> decoded(frame.data(), frame.size() - 1);
+    TEST_ASSERT(decoded.getVersion() == FRAME_V2);
+    TEST_ASSERT(*decoded.get("steps") == "-1200");
+    TEST_ASSERT(*decoded.get("on") == "true");
+    TEST_ASSERT(decoded.get("blob")->size() == sizeof(blob));
+    char reencoded[128];
+    size_t len = decoded.serialize(reencoded, sizeof(reencoded));
+    TEST_ASSERT(reencoded[0] == SerialFrame::VERSION_2);
+    SerialMapView<10> reencodedView(reencoded, len - 1);
+    TEST_ASSERT(*reencodedView.get("name") == "motor");
+    TEST_ASSERT(*reencodedView.get("ratio") == "0.25");
+
+    TEST_MESSAGE("Values longer than 255 bytes should never be truncated, the map moving to v2");
+
+    SerialMap<std::string, 2> large;
+    large.put("payload", std::string(300, 'p'));
+    large.put("small", "s");
+    char largeBuffer[512];
+    len = large.serialize(largeBuffer, sizeof(largeBuffer));
+    TEST_ASSERT(len == 1 + (2 + 7) + (3 + 300) + (2 + 5) + (2 + 1) + 1);
+    TEST_ASSERT(largeBuffer[0] == SerialFrame::VERSION_2);
+    RecordingStream largeStream;
+    large.write(largeStream);
+    TEST_ASSERT(largeStream.all() == std::string(largeBuffer, len));
+    SerialMap<std::string, 2> largeParsed(largeBuffer, len - 1);
+    TEST_ASSERT(*largeParsed.get("payload") == std::string(300, 'p'));
+    TEST_ASSERT(*largeParsed.get("small") == "s");
+    TEST_ASSERT(large.serialize(largeBuffer, 100) == (size_t)-1);
+
+    TEST_MESSAGE("The incremental parser should take v2 frames one byte at a time");
+
+    char buffer[512];
+    SerialFrameParser parser(buffer, sizeof(buffer));
+    size_t fed = 0;
+    PARSE_RESULT result = PARSE_NEED_MORE;
+    while (result == PARSE_NEED_MORE && fed < len)
+    {
+        result = parser.feed(largeBuffer + fed, 1);
+        fed++;
+    }
+    TEST_ASSERT(result == PARSE_COMPLETE);
+    TEST_ASSERT(parser.getVersion() == FRAME_V2);
+    TEST_ASSERT(parser.getLength() == len - 1);
+    parser.reset();
+    TEST_ASSERT(parser.feed(frame.data(), frame.size()) == PARSE_COMPLETE);
+    TEST_ASSERT(parser.getLength() == frame.size() - 1);
+
+    TEST_MESSAGE("Unknown types, typed values in v1 and oversized lengths should be reported as errors");
+
+    char unknownType[] = {0x02, 0x10, 1, 'a', 0x19, 0};
+    parser.reset();
+    TEST_ASSERT(parser.feed(unknownType, sizeof(unknownType)) == PARSE_ERROR);
+    char typedV1[] = {0x10, 1, 'a', 0x12, 2, 0};
+    parser.reset();
+    TEST_ASSERT(parser.feed(typedV1, sizeof(typedV1)) == PARSE_ERROR);
+    char oversized[] = {0x02, 0x10, 1, 'a', 0x11, (char)0x80, 0x04};
+    parser.reset();
+    TEST_ASSERT(parser.feed(oversized, sizeof(oversized)) == PARSE_ERROR);
+    TEST_ASSERT(parser.getLength() == 6);
+    char endless[] = {0x02, 0x10, 1, 'a', 0x12, (char)0x80, (char)0x80, (char)0x80, (char)0x80, (char)0x80, 0x01};
+    parser.reset();
+    TEST_ASSERT(parser.feed(endless, sizeof(endless)) == PARSE_ERROR);
+    SerialMapView<2> endlessView(endless, sizeof(endless));
+    TEST_ASSERT(endlessView.getSize() == 0);
+
+    TEST_MESSAGE("A v2 batch should be answered with a v2 frame");
+
+    ActionParser<2> actions;
+    actions.with("count", [](ActionView &action, Stream &out)
+                 {
+                     SerialFrameWriter response(out, action.getVersion());
+                     response.putInt("count", action.get("n")->toInt() + 1);
+                     response.end();
+                     return false; });
+    RecordingStream nested;
+    SerialFrameWriter nestedWriter(nested, FRAME_V2);
+    nestedWriter.put("action", "count");
+    nestedWriter.putInt("n", 41);
+    std::string nestedFrame = nested.all();
+    RecordingStream batchFrame;
+    SerialFrameWriter batchWriter(batchFrame, FRAME_V2);
+    batchWriter.put("action", "__batch");
+    batchWriter.putBinary("0", reinterpret_cast<const uint8_t *>(nestedFrame.data()), nestedFrame.size());
+    std::string batch = batchFrame.all();
+    ActionView batchView(batch.data(), batch.size());
+    RecordingStream batchResponse;
+    TEST_ASSERT_FALSE(actions.execute(batchView, batchResponse));
+    std::string answer = batchResponse.all();
+    TEST_ASSERT(answer[0] == SerialFrame::VERSION_2);
+    SerialMapView<2> answerView(answer.data(), answer.size() - 1);
+    const SerialSlice *first = answerView.get("0");
+    TEST_ASSERT(first != nullptr);
+    SerialMapView<2> firstView(first->data(), first->length());
+    TEST_ASSERT(firstView.get("count")->toInt() == 42);
+
+    TEST_MESSAGE("A typed value should hash like the text it compares equal to, so a frozen parser finds it");
+
+    RecordingStream typedName;
+    SerialFrameWriter typedNameWriter(typedName, FRAME_V2);
+    typedNameWriter.putInt("action", 7);
+    typedNameWriter.end();
+    std::string typedAction = typedName.all();
+    ActionView typedView(typedAction.data(), typedAction.size() - 1);
+    const SerialSlice *name = typedView.get("action");
+    TEST_ASSERT(*name == "7");
+    TEST_ASSERT(MapHash<SerialSlice>()(*name) == MapHash<std::string>()(std::string("7")));
+
+    ActionParser<2> numbered;
+    bool called = false;
+    numbered.with("7", [&called](ActionView &action, Stream &out)
+                  {
+                      called = true;
+                      return false; });
+    for (int frozen = 0; frozen < 2; frozen++)
+    {
+        if (frozen)
+        {
+            numbered.freeze();
+        }
+        called = false;
+        numbered.execute(typedView, batchResponse);
+        TEST_ASSERT_TRUE(called);
+    }
+}
+
+// Collects an upload, taking at most `window` bytes at a time
+struct RecordingUpload : public UploadHandler
+{
+    size_t window = SIZE_MAX;
+    size_t length = 0;
+    std::string data;
+    std::vector<size_t> chunks;
+    bool committed = false, aborted = false, refuse = false;
+
+    bool begin(ActionView &action, size_t length) override
+    {
+        this->length = length;
+        return !refuse;
+    }
+    size_t availableForWrite() override
+    {
+        return window;
+    }
+    bool write(const uint8_t *chunk, size_t len) override
+    {
+        data.append(reinterpret_cast<const char *>(chunk), len);
+        chunks.push_back(len);
+        return true;
+    }
+    bool commit(Stream &output) override
+    {
+        committed = true;
+        output.write("stored");
+        return false;
+    }
+    void abort() override
+    {
+        aborted = true;
+    }
+};
+
+void test_Upload()
+{
+    std::string payload = "a calibration table too long for a frame field";
+    char checksum[9];
+    snprintf(checksum, sizeof(checksum), "%08lx", (unsigned long)crc32(reinterpret_cast<const uint8_t *>(payload.data()), payload.size()));
+
+    ActionParser<4> parser;
+    RecordingUpload handler;
+    parser.with("push", handler);
+    parser.freeze();
+
+    TEST_MESSAGE("The payload should be handed over in chunks no longer than the handler takes, the rest staying in the socket");
+
+    std::string frame = serializedAction({{"action", "push"}, {"length", std::to_string(payload.size())}, {"crc32", checksum}});
+    ActionView view(frame.data(), frame.size());
+    std::vector<std::string> chunks = {payload.substr(0, 20), payload.substr(20) + "next"};
+    ChunkedClient client;
+    client.chunks = &chunks;
+    UploadTask task;
+    uint8_t buffer[16];
+
+    handler.window = 0;
+    TEST_ASSERT_TRUE(parser.startUpload(view, task));
+    TEST_ASSERT_TRUE(task.isRunning());
+    TEST_ASSERT(handler.length == payload.size());
+    TEST_ASSERT(task.poll(client, buffer, sizeof(buffer)) == UPLOAD_NEED_MORE);
+    TEST_ASSERT(task.poll(client, buffer, sizeof(buffer)) == UPLOAD_NEED_MORE);
+    TEST_ASSERT(handler.chunks.empty());
+    TEST_ASSERT(client.pending.size() == 20);
+
+    handler.window = 7;
+    UPLOAD_RESULT result;
+    int polls = 0;
+    while ((result = task.poll(client, buffer, sizeof(buffer))) == UPLOAD_NEED_MORE && polls < 20)
+    {
+        polls++;
+    }
+    TEST_ASSERT(result == UPLOAD_COMPLETE);
+    TEST_ASSERT(handler.data == payload);
+    TEST_ASSERT(std::all_of(handler.chunks.begin(), handler.chunks.end(), [](size_t n)
+                            { return n > 0 && n <= 7; }));
+    TEST_ASSERT(client.pending == "next");
+
+    RecordingStream output;
+    TEST_ASSERT_FALSE(task.commit(output));
+    TEST_ASSERT_FALSE(task.isRunning());
+    TEST_ASSERT_TRUE(handler.committed);
+    TEST_ASSERT(output.all() == "stored");
+
+    TEST_MESSAGE("A payload failing its CRC should be aborted");
+
+    handler = RecordingUpload();
+    std::string wrong = serializedAction({{"action", "push"}, {"length", "4"}, {"crc32", "DEADBEEF"}});
+    ActionView wrongView(wrong.data(), wrong.size());
+    chunks = {"data"};
+    TEST_ASSERT_TRUE(parser.startUpload(wrongView, task));
+    while ((result = task.poll(client, buffer, sizeof(buffer))) == UPLOAD_NEED_MORE)
+    {
+    }
+    TEST_ASSERT(result == UPLOAD_FAILED);
+    TEST_ASSERT_TRUE(handler.aborted);
+    TEST_ASSERT_FALSE(handler.committed);
+    TEST_ASSERT_FALSE(task.isRunning());
+
+    TEST_MESSAGE("An upload without its length or CRC, or refused by the handler, should not start");
+
+    handler = RecordingUpload();
+    std::string bare = serializedAction({{"action", "push"}, {"length", "4"}});
+    ActionView bareView(bare.data(), bare.size());
+    TEST_ASSERT_TRUE(parser.startUpload(bareView, task));
+    TEST_ASSERT_FALSE(task.isRunning());
+    TEST_ASSERT(handler.length == 0);
+
+    handler.refuse = true;
+    TEST_ASSERT_TRUE(parser.startUpload(view, task));
+    TEST_ASSERT_FALSE(task.isRunning());
+
+    TEST_MESSAGE("An upload should be answered with an error where it can't get its payload");
+
+    output.writes.clear();
+    TEST_ASSERT_FALSE(parser.execute(view, output));
+    std::string answer = output.all();
+    ActionView response(answer.data(), answer.size());
+    TEST_ASSERT(*response.get("result") == "error");
+    TEST_ASSERT_FALSE(handler.committed);
+}
+
+// A stream taking at most `window` bytes at a time, as a client with a small send window
+class WindowedStream : public RecordingStream
+{
+public:
+    int window = 16;
+    int availableForWrite() override
+    {
+        return window;
+    }
+};
+
+void test_ResponseWriter()
+{
+    TEST_MESSAGE("The common responses should be written straight to the stream, as the maps would be, without allocating");
+
+    ResponseMap map;
+    map.put("result", "error");
+    RecordingStream expected;
+    map.write(expected);
+    char response[32];
+    BufferStream output(response, sizeof(response));
+    unsigned long before = allocations;
+    Response::errorResponse().write(output);
+    TEST_ASSERT(allocations == before);
+    TEST_ASSERT(std::string(output.data(), output.getLength()) == expected.all());
+
+    TEST_MESSAGE("The common responses should still convert to the map they used to be");
+
+    ResponseMap converted = Response::errorResponse();
+    RecordingStream fromMap;
+    converted.write(fromMap);
+    TEST_ASSERT(fromMap.all() == expected.all());
+
+    TEST_MESSAGE("A short write should fail the frame and drop the writes after it");
+
+    char tiny[10];
+    BufferStream truncated(tiny, sizeof(tiny));
+    TEST_ASSERT_FALSE(Response::successResponse().write(truncated));
+    BufferStream cut(tiny, sizeof(tiny));
+    SerialFrameWriter failing(cut);
+    TEST_ASSERT_TRUE(failing.put("a", "b"));
+    TEST_ASSERT_FALSE(failing.put("status", "ok"));
+    TEST_ASSERT_TRUE(failing.hasFailed());
+    size_t written = cut.getLength();
+    TEST_ASSERT_FALSE(failing.put("c", "d"));
+    TEST_ASSERT(failing.writeValue("e", 1) == 0);
+    TEST_ASSERT_FALSE(failing.end());
+    TEST_ASSERT(cut.getLength() == written);
+
+    TEST_MESSAGE("The values should be sent in pieces no larger than the send window");
+
+    WindowedStream windowed;
+    SerialFrameWriter writer(windowed);
+    std::string value(100, 'v');
+    TEST_ASSERT_TRUE(writer.put("status", value));
+    writer.end();
+    TEST_ASSERT(std::all_of(windowed.writes.begin(), windowed.writes.end(), [](const std::string &write)
+                            { return write.size() <= 16; }));
+    SerialMap<std::string, 1> sent(windowed.all().data(), windowed.all().size());
+    TEST_ASSERT(*sent.get("status") == value);
+
+    TEST_MESSAGE("A value produced in parts should never be held whole, even past a v1 field");
+
+    RecordingStream dump;
+    SerialFrameWriter parts(dump, FRAME_V2);
+    TEST_ASSERT_TRUE(parts.beginValue("log", 600));
+    for (int i = 0; i < 6; i++)
+    {
+        std::string line(100, 'a' + i);
+        TEST_ASSERT(parts.writeValue(line.data(), line.size()) == 100);
+    }
+    TEST_ASSERT_TRUE(parts.putInt("lines", 6));
+    parts.end();
+    std::string frame = dump.all();
+    SerialMapView<2> view(frame.data(), frame.size());
+    TEST_ASSERT(view.getSize() == 2);
+    TEST_ASSERT(view.get("log")->length() == 600);
+    TEST_ASSERT(view.get("log")->data()[599] == 'f');
+    TEST_ASSERT(view.get("lines")->toInt() == 6);
+
+    RecordingStream legacy;
+    SerialFrameWriter v1(legacy);
+    TEST_ASSERT_FALSE(v1.beginValue("log", 600));
+    TEST_ASSERT(legacy.writes.empty());
+
+    TEST_MESSAGE("The buffers should tell the room they have left, and what the stream behind takes");
+
+    char buffer[32];
+    BufferStream captured(buffer, sizeof(buffer));
+    captured.write("0123456789");
+    TEST_ASSERT(captured.availableForWrite() == 22);
+
+    WindowedStream client;
+    client.window = 100;
+    char pending[64];
+    BufferedWriter buffered(client, pending, sizeof(pending));
+    buffered.write("0123456789");
+    TEST_ASSERT(buffered.availableForWrite() == 90);
+    client.window = 0;
+    TEST_ASSERT(buffered.availableForWrite() == 54);
+    buffered.discard();
+}
+
+void test_BufferPool()
+{
+    TEST_MESSAGE("The buffers should be drawn from the budget and given back when destroyed");
+
+    BufferPool pool;
+    {
+        PoolBuffer first = pool.acquire(SerialFrame::BUFFER_SIZE);
+        PoolBuffer second = pool.acquire(130);
+        TEST_ASSERT_TRUE(first);
+        TEST_ASSERT_TRUE(second);
+        TEST_ASSERT(first.size() == SerialFrame::BUFFER_SIZE);
+        TEST_ASSERT(second.size() == 130);
+        TEST_ASSERT(second.data() >= first.data() + first.size());
+        TEST_ASSERT((reinterpret_cast<uintptr_t>(second.data()) & 3) == 0);
+        TEST_ASSERT(pool.getUsed() == SerialFrame::BUFFER_SIZE + 132);
+        memset(first.data(), 'a', first.size());
+        memset(second.data(), 'b', second.size());
+        TEST_ASSERT(first.data()[first.size() - 1] == 'a');
+    }
+    TEST_ASSERT(pool.getUsed() == 0);
+    TEST_ASSERT(pool.getHighWater() == SerialFrame::BUFFER_SIZE + 132);
+
+    TEST_MESSAGE("A buffer past the budget should be refused and counted");
+
+    PoolBuffer whole = pool.acquire(BufferPool::BUDGET);
+    TEST_ASSERT_TRUE(whole);
+    TEST_ASSERT_FALSE(pool.fits(1));
+    TEST_ASSERT_FALSE(pool.acquire(1));
+    TEST_ASSERT(pool.getFailures() == 1);
+    TEST_ASSERT(pool.getHighWater() == BufferPool::BUDGET);
+
+    TEST_MESSAGE("A buffer moved elsewhere should be given back once, by its last owner");
+
+    PoolBuffer moved = std::move(whole);
+    TEST_ASSERT_FALSE(whole);
+    whole.release();
+    TEST_ASSERT(pool.getUsed() == BufferPool::BUDGET);
+    moved = PoolBuffer();
+    TEST_ASSERT(pool.getUsed() == 0);
+
+    TEST_MESSAGE("The gap left by a buffer given back should be reused first");
+
+    PoolBuffer a = pool.acquire(256), b = pool.acquire(256), c = pool.acquire(256);
+    char *gap = b.data();
+    b.release();
+    TEST_ASSERT_FALSE(pool.fits(BufferPool::BUDGET - 768 + 1));
+    PoolBuffer small = pool.acquire(100);
+    TEST_ASSERT(small.data() == gap);
+    PoolBuffer large = pool.acquire(200);
+    TEST_ASSERT(large.data() == c.data() + 256);
+
+    char summary[48];
+    pool.summary(summary, sizeof(summary));
+    TEST_ASSERT(std::string(summary) == "812,2048,2048,1");
+}
+
+void test_MemoryStats()
+{
+    TEST_MESSAGE("The footprint of the components should be printed as a table");
+
+    MemoryStats memory;
+    TEST_ASSERT_TRUE(memory.addComponent("BufferPool", sizeof(BufferPool)));
+    TEST_ASSERT_TRUE(memory.addComponent("ActionParser<10>", sizeof(ActionParser<10>)));
+    TEST_ASSERT_TRUE(memory.addComponent("ClientConnection", sizeof(ClientConnection<BufferStream>), 512));
+    std::stringstream table;
+    OStreamProxy out(table);
+    memory.printTo(out);
+    TEST_MESSAGE(table.str().c_str());
+    std::string line;
+    std::getline(table, line);
+    TEST_ASSERT(line.find("component") == 0);
+    std::getline(table, line);
+    TEST_ASSERT(line.find("BufferPool") == 0);
+    TEST_ASSERT(line.find(std::to_string(sizeof(BufferPool))) != std::string::npos);
+
+    TEST_MESSAGE("The heap left allocated and the allocations of each request should be recorded");
+
+    ESP.freeHeap = 30000;
+    ESP.maxFreeBlock = 20000;
+    ESP.fragmentation = 12;
+    memory.setAllocationCounter([]
+                                { return allocations.load(); });
+    MemoryStats::Sample before = memory.sample();
+    std::string *leaked = new std::string("leaked");
+    ESP.freeHeap -= 40;
+    memory.record(before);
+    before = memory.sample();
+    delete leaked;
+    ESP.freeHeap += 40;
+    memory.record(before);
+    TEST_ASSERT(memory.getRetained().getCount() == 2);
+    TEST_ASSERT(memory.getRetained().getMax() == 40);
+    TEST_ASSERT(memory.getAllocations().getMax() == 1);
+    TEST_ASSERT(memory.getMinFreeHeap() == 29960);
+
+    TEST_MESSAGE("The stats should be written as a frame");
+
+    RecordingStream client;
+    memory.write(client);
+    std::string frame = client.all();
+    SerialMapView<10> view(frame.data(), frame.size());
+    TEST_ASSERT(*view.get("heap") == "30000,20000,12,29960");
+    TEST_ASSERT(*view.get("request.heap") == "2,20,0,40,40,40");
+    TEST_ASSERT(view.has("request.allocations"));
+    TEST_ASSERT(*view.get("static.ClientConnection") == (std::to_string(sizeof(ClientConnection<BufferStream>)) + ",512").c_str());
+
+    memory.clear();
+    TEST_ASSERT(memory.getRetained().getCount() == 0);
+    TEST_ASSERT(memory.getMinFreeHeap() == UINT32_MAX);
+
+    TEST_MESSAGE("A component past the capacity should be refused");
+
+    while (memory.getComponentCount() < MemoryStats::MAX_COMPONENTS)
+    {
+        TEST_ASSERT_TRUE(memory.addComponent("filler", 1));
+    }
+    TEST_ASSERT_FALSE(memory.addComponent("extra", 1));
+    ESP.freeHeap = ESP.maxFreeBlock = ESP.fragmentation = 0;
+}
+
+#ifdef __linux__
+void test_PosixTransport()
+{
+    CommandServerSettings settings = {};
+    settings.PORT = 0;
+    PosixTransport transport(settings);
+
+    TEST_MESSAGE("The transport should listen on a free port and accept the connections on loopback");
+
+    TEST_ASSERT_TRUE(transport.begin());
+    TEST_ASSERT(transport.getPort() > 0);
+    TEST_ASSERT_FALSE(transport.isSecure());
+
+    SocketClient client;
+    TEST_ASSERT_FALSE(transport.accept(client));
+
+    int peer = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(transport.getPort());
+    TEST_ASSERT(connect(peer, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+
+    transport.idle(false);
+    TEST_ASSERT_TRUE(transport.accept(client));
+    TEST_ASSERT_TRUE(client.connected());
+    TEST_ASSERT(client.remoteIP().toString() == "127.0.0.1");
+    TEST_ASSERT(client.available() == 0);
+
+    TEST_MESSAGE("The frames sent by the peer should be received by a ClientConnection");
+
+    std::string request = serializedAction({{"action", "ping"}}) + '\0';
+    TEST_ASSERT(send(peer, request.data(), request.size(), 0) == (ssize_t)request.size());
+    transport.idle(true);
+
+    BufferPool pool;
+    ClientConnection<SocketClient> connection;
+    connection.open(client, pool.acquire(SerialFrame::BUFFER_SIZE));
+    TEST_ASSERT(connection.receive() == PARSE_COMPLETE);
+    TEST_ASSERT(*connection.frame().get("action") == "ping");
+
+    TEST_MESSAGE("The responses should reach the peer, and the peer closing should be noticed");
+
+    Response::successResponse().write(client);
+    char response[64];
+    ssize_t received = recv(peer, response, sizeof(response), 0);
+    TEST_ASSERT(received == 13);
+    TEST_ASSERT(SerialMapView<1>(response, received - 1).get("result")->toString() == "ok");
+
+    close(peer);
+    transport.idle(true);
+    TEST_ASSERT_FALSE(connection.isConnected());
+    connection.close();
+    TEST_ASSERT_FALSE((bool)client);
+
+    TEST_MESSAGE("A probe should wake the idle loop and be answered on the discovery socket");
+
+    settings.UDP_PACKET = "RCS";
+    settings.UDP_PACKET_SIZE = 3;
+    settings.UDP_RATE_MS = 60000;
+    DiscoveryResponder<PosixUdp> discovery(transport.getUdp(), settings);
+    discovery.begin(IPAddress(127, 0, 0, 1), millis());
+    TEST_ASSERT(transport.getUdp().getPort() > 0);
+
+    int prober = socket(AF_INET, SOCK_DGRAM, 0);
+    timeval timeout = {1, 0};
+    setsockopt(prober, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    address.sin_port = htons(transport.getUdp().getPort());
+    TEST_ASSERT(sendto(prober, "RCS_DISCOVER", 12, 0, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 12);
+    transport.idle(false);
+    discovery.poll(millis());
+    TEST_ASSERT(discovery.getProbes() == 1);
+    char answer[8];
+    TEST_ASSERT(recv(prober, answer, sizeof(answer), 0) == 3);
+    TEST_ASSERT(memcmp(answer, "RCS", 3) == 0);
+    close(prober);
+    transport.stop();
+}
+
+// A client of the server under test, over loopback with blocking sockets
+class LoopbackClient
+{
+public:
+    LoopbackClient(int port)
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        timeval timeout = {2, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        connected = connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+    }
+    LoopbackClient(const LoopbackClient &) = delete;
+    ~LoopbackClient()
+    {
+        close(fd);
+    }
+    bool isConnected() const
+    {
+        return connected;
+    }
+    void send(const std::string &data)
+    {
+        ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+    }
+    void sendAction(std::initializer_list<std::pair<std::string, std::string>> fields)
+    {
+        send(serializedAction(fields) + '\0');
+    }
+    /**
+     * @brief The next frame, empty if the server closed the connection or didn't answer in time
+     */
+    std::string receive()
+    {
+        std::vector<char> buffer(4096);
+        SerialFrameParser parser(buffer.data(), buffer.size());
+        while (parser.getResult() == PARSE_NEED_MORE)
+        {
+            ssize_t n = recv(fd, parser.tail(), parser.needed(), 0);
+            if (n <= 0)
+            {
+                return "";
+            }
+            parser.advance(n);
+        }
+        return std::string(parser.data(), parser.getLength());
+    }
+    /**
+     * @brief Whether the server closed the connection, waiting for it up to the receive timeout
+     */
+    bool closedByServer()
+    {
+        char c;
+        return recv(fd, &c, 1, 0) == 0;
+    }
+    /**
+     * @brief Goes through the authentication exchange
+     */
+    bool authenticate()
+    {
+        sendAction({{"username", "user"}, {"password", "password"}});
+        return result(receive()) == "ok";
+    }
+
+    /**
+     * @brief The result field of a response frame
+     */
+    static std::string result(const std::string &frame)
+    {
+        SerialMap<std::string, 24> response(frame.data(), frame.size());
+        return response.has("result") ? *response.get("result") : "";
+    }
+
+private:
+    int fd;
+    bool connected;
+};
+
+/**
+ * @brief A CommandServer over a loopback PosixTransport running on its own thread, whose
+ *  actions are registered before start(). The "shutdown" action stops it
+ */
+class ServerHarness
+{
+public:
+    StateManager stateManager;
+    BufferPool pool;
+    CommandServer<8, 2, PosixTransport> server;
+
+    static CommandServerSettings defaults()
+    {
+        CommandServerSettings settings = {};
+        settings.HOSTNAME = "localhost";
+        settings.PORT = 0;
+        settings.AUTH_USERNAME = "user";
+        settings.AUTH_PASSWORD = "password";
+        settings.UDP_RATE_MS = 60000;
+        settings.TIMEOUT_MS = 1000;
+        return settings;
+    }
+
+    ServerHarness(const CommandServerSettings &settings = defaults()) : server(stateManager, settings, pool)
+    {
+        server.registerAction("ping", [](ActionView &action, Stream &client)
+                              {
+                                  Response::successResponse().write(client);
+                                  return false; });
+        server.registerAction("shutdown", [](ActionView &action, Stream &client)
+                              {
+                                  Response::successResponse().write(client);
+                                  return true; });
+    }
+    ~ServerHarness()
+    {
+        if (thread.joinable())
+        {
+            stop();
+        }
+    }
+    void start()
+    {
+        server.setOnServerLoopCallback([this]()
+                                       { looping = true; });
+        thread = std::thread([this]()
+                             { server.startServer(); });
+        while (!looping)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    /**
+     * @brief Sends the shutdown action and waits for the server to terminate
+     */
+    void stop()
+    {
+        {
+            LoopbackClient client(getPort());
+            client.authenticate();
+            client.sendAction({{"action", "shutdown"}});
+            client.receive();
+        }
+        thread.join();
+    }
+    int getPort()
+    {
+        return server.getTransport().getPort();
+    }
+
+private:
+    std::thread thread;
+    std::atomic<bool> looping{false};
+};
+
+void test_CommandServer()
+{
+    TEST_MESSAGE("The server should serve two clients at once, each through its own exchange");
+
+    ServerHarness harness;
+    harness.start();
+
+    LoopbackClient first(harness.getPort()), second(harness.getPort());
+    TEST_ASSERT_TRUE(first.isConnected());
+    TEST_ASSERT_TRUE(second.isConnected());
+    TEST_ASSERT_TRUE(first.authenticate());
+    TEST_ASSERT_TRUE(second.authenticate());
+    second.sendAction({{"action", "ping"}});
+    TEST_ASSERT(LoopbackClient::result(second.receive()) == "ok");
+    first.sendAction({{"action", "ping"}});
+    TEST_ASSERT(LoopbackClient::result(first.receive()) == "ok");
+    TEST_ASSERT_TRUE(first.closedByServer());
+    TEST_ASSERT_TRUE(second.closedByServer());
+
+    TEST_MESSAGE("A client stalled halfway through a frame should not hold back the other one");
+
+    LoopbackClient stalled(harness.getPort()), other(harness.getPort());
+    std::string authentication = serializedAction({{"username", "user"}, {"password", "password"}}) + '\0';
+    stalled.send(authentication.substr(0, 5));
+    TEST_ASSERT_TRUE(other.authenticate());
+    other.sendAction({{"action", "ping"}});
+    TEST_ASSERT(LoopbackClient::result(other.receive()) == "ok");
+    stalled.send(authentication.substr(5));
+    TEST_ASSERT(LoopbackClient::result(stalled.receive()) == "ok");
+    stalled.sendAction({{"action", "ping"}});
+    TEST_ASSERT(LoopbackClient::result(stalled.receive()) == "ok");
+
+    TEST_MESSAGE("A wrong password should be answered with an error and the connection closed");
+
+    LoopbackClient intruder(harness.getPort());
+    intruder.sendAction({{"username", "user"}, {"password", "wrong"}});
+    TEST_ASSERT(LoopbackClient::result(intruder.receive()) == "error");
+    TEST_ASSERT_TRUE(intruder.closedByServer());
+
+    harness.stop();
+    TEST_ASSERT(harness.stateManager.getState() == AP_MODE);
+    TEST_ASSERT(harness.pool.getUsed() == 0);
+}
+
+void test_CommandServerAsync()
+{
+    TEST_MESSAGE("An asynchronous action should run through the server loop without holding back the other clients");
+
+    ServerHarness harness;
+    harness.server.registerAction("sleep", [](ActionView &action, Stream &client, AsyncContext &context) -> Async
+                                  {
+                                      ASYNC_BEGIN(context);
+                                      ASYNC_SLEEP(context, action.has("ms") ? atol(action.get("ms")->toString().c_str()) : 0);
+                                      Response::successResponse().write(client);
+                                      ASYNC_RETURN(context, false);
+                                      ASYNC_END(context); });
+    harness.start();
+
+    LoopbackClient sleeping(harness.getPort()), other(harness.getPort());
+    TEST_ASSERT_TRUE(sleeping.authenticate());
+    TEST_ASSERT_TRUE(other.authenticate());
+    unsigned long start = millis();
+    sleeping.sendAction({{"action", "sleep"}, {"ms", "300"}});
+    other.sendAction({{"action", "ping"}});
+    TEST_ASSERT(LoopbackClient::result(other.receive()) == "ok");
+    TEST_ASSERT(millis() - start < 300);
+    TEST_ASSERT(LoopbackClient::result(sleeping.receive()) == "ok");
+    TEST_ASSERT(millis() - start >= 300);
+
+    TEST_MESSAGE("Both arms of the wait should be usable, as without the \"ms\" field");
+
+    LoopbackClient immediate(harness.getPort());
+    TEST_ASSERT_TRUE(immediate.authenticate());
+    immediate.sendAction({{"action", "sleep"}});
+    TEST_ASSERT(LoopbackClient::result(immediate.receive()) == "ok");
+
+    harness.stop();
+    TEST_ASSERT(harness.pool.getUsed() == 0);
+}
+
+void test_CommandServerKeepAlive()
+{
+    TEST_MESSAGE("A client asking for keep-alive should send several actions on the same connection");
+
+    CommandServerSettings settings = ServerHarness::defaults();
+    settings.KEEP_ALIVE_MS = 300;
+    ServerHarness harness(settings);
+    harness.start();
+
+    LoopbackClient client(harness.getPort());
+    TEST_ASSERT_TRUE(client.authenticate());
+    client.sendAction({{"action", "ping"}, {"connection", "keep-alive"}});
+    TEST_ASSERT(LoopbackClient::result(client.receive()) == "ok");
+    client.sendAction({{"action", "ping"}, {"connection", "keep-alive"}});
+    TEST_ASSERT(LoopbackClient::result(client.receive()) == "ok");
+
+    TEST_MESSAGE("An idle persistent connection should be closed after KEEP_ALIVE_MS");
+
+    unsigned long start = millis();
+    TEST_ASSERT_TRUE(client.closedByServer());
+    TEST_ASSERT(millis() - start >= 250);
+
+    TEST_MESSAGE("A frame without the connection field should close the connection after its response");
+
+    LoopbackClient single(harness.getPort());
+    TEST_ASSERT_TRUE(single.authenticate());
+    single.sendAction({{"action", "ping"}, {"connection", "keep-alive"}});
+    TEST_ASSERT(LoopbackClient::result(single.receive()) == "ok");
+    single.sendAction({{"action", "ping"}});
+    TEST_ASSERT(LoopbackClient::result(single.receive()) == "ok");
+    start = millis();
+    TEST_ASSERT_TRUE(single.closedByServer());
+    TEST_ASSERT(millis() - start < 250);
+
+    harness.stop();
+}
+
+void test_CommandServerStats()
+{
+    TEST_MESSAGE("The __stats action should answer with the phases, the actions and the pool");
+
+    CommandServerSettings settings = ServerHarness::defaults();
+    settings.STATS_ACTION_ENABLED = true;
+    ServerHarness harness(settings);
+    harness.start();
+
+    for (int i = 0; i < 2; i++)
+    {
+        LoopbackClient client(harness.getPort());
+        TEST_ASSERT_TRUE(client.authenticate());
+        client.sendAction({{"action", "ping"}});
+        TEST_ASSERT(LoopbackClient::result(client.receive()) == "ok");
+    }
+
+    LoopbackClient client(harness.getPort());
+    TEST_ASSERT_TRUE(client.authenticate());
+    client.sendAction({{"action", "__stats"}, {"reset", "true"}});
+    std::string frame = client.receive();
+    SerialMap<std::string, 24> stats(frame.data(), frame.size());
+    const char *phases[] = {"handshake", "authentication", "receive", "execute", "write", "pool"};
+    for (const char *phase : phases)
+    {
+        TEST_ASSERT_TRUE(stats.has(phase));
+    }
+    TEST_ASSERT_TRUE(stats.has("action.ping"));
+    TEST_ASSERT(stats.get("action.ping")->rfind("2,", 0) == 0);
+    // The response buffer and the buffer of this connection, the synchronous actions drawing
+    // no buffer for an asynchronous response
+    TEST_ASSERT(stats.get("pool")->rfind("1024,1024,", 0) == 0);
+
+    TEST_MESSAGE("The reset should clear the histograms");
+
+    LoopbackClient after(harness.getPort());
+    TEST_ASSERT_TRUE(after.authenticate());
+    after.sendAction({{"action", "__stats"}});
+    frame = after.receive();
+    SerialMap<std::string, 24> cleared(frame.data(), frame.size());
+    TEST_ASSERT(cleared.get("action.ping")->rfind("0,", 0) == 0);
+
+    TEST_MESSAGE("Without STATS_ACTION_ENABLED, __stats should be an unknown action");
+
+    ServerHarness disabled;
+    disabled.start();
+    LoopbackClient unknown(disabled.getPort());
+    TEST_ASSERT_TRUE(unknown.authenticate());
+    unknown.sendAction({{"action", "__stats"}});
+    TEST_ASSERT_FALSE(LoopbackClient::result(unknown.receive()) == "ok");
+    disabled.stop();
+
+    harness.stop();
+}
+
+void test_CommandServerUpload()
+{
+    TEST_MESSAGE("An upload through the server should reach the handler whole, without holding back the other clients");
+
+    // Answers the committed upload with a frame
+    struct AnsweringUpload : public RecordingUpload
+    {
+        bool commit(Stream &output) override
+        {
+            committed = true;
+            Response::successResponse().write(output);
+            return false;
+        }
+    };
+
+    AnsweringUpload upload;
+    upload.window = 100;
+    ServerHarness harness;
+    harness.server.registerAction("upload", upload);
+    harness.start();
+
+    std::string payload;
+    for (int i = 0; i < 3000; i++)
+    {
+        payload += (char)('a' + i % 26);
+    }
+    char checksum[9];
+    snprintf(checksum, sizeof(checksum), "%08x", (unsigned)crc32(reinterpret_cast<const uint8_t *>(payload.data()), payload.size()));
+
+    LoopbackClient uploader(harness.getPort()), other(harness.getPort());
+    TEST_ASSERT_TRUE(uploader.authenticate());
+    TEST_ASSERT_TRUE(other.authenticate());
+    uploader.send(serializedAction({{"action", "upload"}, {"length", "3000"}, {"crc32", checksum}}) + '\0' + payload.substr(0, 1000));
+    other.sendAction({{"action", "ping"}});
+    TEST_ASSERT(LoopbackClient::result(other.receive()) == "ok");
+    uploader.send(payload.substr(1000));
+    TEST_ASSERT(LoopbackClient::result(uploader.receive()) == "ok");
+    TEST_ASSERT_TRUE(upload.committed);
+    TEST_ASSERT(upload.data == payload);
+    for (size_t chunk : upload.chunks)
+    {
+        TEST_ASSERT(chunk <= 100);
+    }
+
+    TEST_MESSAGE("A CRC mismatch should abort the upload, answered with an error");
+
+    upload.committed = false;
+    upload.data.clear();
+    LoopbackClient corrupted(harness.getPort());
+    TEST_ASSERT_TRUE(corrupted.authenticate());
+    payload[1234] ^= 1;
+    corrupted.send(serializedAction({{"action", "upload"}, {"length", "3000"}, {"crc32", checksum}}) + '\0' + payload);
+    TEST_ASSERT(LoopbackClient::result(corrupted.receive()) == "error");
+    TEST_ASSERT_TRUE(corrupted.closedByServer());
+    TEST_ASSERT_FALSE(upload.committed);
+    TEST_ASSERT_TRUE(upload.aborted);
+
+    harness.stop();
+    TEST_ASSERT(harness.pool.getUsed() == 0);
+}
+
+void test_CommandServerMemory()
+{
+    TEST_MESSAGE("The __memory action should answer with the heap, the requests and the components");
+
+    CommandServerSettings settings = ServerHarness::defaults();
+    settings.MEMORY_ACTION_ENABLED = true;
+    ServerHarness harness(settings);
+    harness.server.getMemoryStats().addComponent("BufferPool", sizeof(BufferPool));
+    harness.server.getMemoryStats().setAllocationCounter([]
+                                                         { return allocations.load(); });
+    harness.start();
+
+    LoopbackClient client(harness.getPort());
+    TEST_ASSERT_TRUE(client.authenticate());
+    client.sendAction({{"action", "__memory"}});
+    std::string frame = client.receive();
+    SerialMap<std::string, 24> memory(frame.data(), frame.size());
+    TEST_ASSERT_TRUE(memory.has("heap"));
+    TEST_ASSERT_TRUE(memory.has("request.heap"));
+    TEST_ASSERT_TRUE(memory.has("request.allocations"));
+    TEST_ASSERT(*memory.get("static.BufferPool") == std::to_string(sizeof(BufferPool)) + ",0");
+
+    TEST_MESSAGE("The __stats setting alone should leave __memory unanswered");
+
+    CommandServerSettings statsOnly = ServerHarness::defaults();
+    statsOnly.STATS_ACTION_ENABLED = true;
+    ServerHarness other(statsOnly);
+    other.start();
+    LoopbackClient unknown(other.getPort());
+    TEST_ASSERT_TRUE(unknown.authenticate());
+    unknown.sendAction({{"action", "__memory"}});
+    TEST_ASSERT_FALSE(LoopbackClient::result(unknown.receive()) == "ok");
+    other.stop();
+
+    harness.stop();
+}
+
+void test_CommandServerInlineAuth()
+{
+    TEST_MESSAGE("An action carrying the password should be answered in a single round trip");
+
+    CommandServerSettings settings = ServerHarness::defaults();
+    settings.INLINE_AUTH_ENABLED = true;
+    settings.SESSION_TOKEN_LIFETIME_MS = 300;
+    ServerHarness harness(settings);
+    harness.start();
+
+    LoopbackClient password(harness.getPort());
+    password.sendAction({{"action", "ping"}, {"username", "user"}, {"password", "password"}});
+    TEST_ASSERT(LoopbackClient::result(password.receive()) == "ok");
+
+    TEST_MESSAGE("The token of a login should authenticate the following actions until it expires");
+
+    LoopbackClient login(harness.getPort());
+    login.sendAction({{"username", "user"}, {"password", "password"}});
+    std::string frame = login.receive();
+    SerialMap<std::string, 2> response(frame.data(), frame.size());
+    TEST_ASSERT(*response.get("result") == "ok");
+    TEST_ASSERT_TRUE(response.has("token"));
+    std::string token = *response.get("token");
+    unsigned long issued = millis();
+
+    LoopbackClient withToken(harness.getPort());
+    withToken.sendAction({{"action", "ping"}, {"token", token}});
+    TEST_ASSERT(LoopbackClient::result(withToken.receive()) == "ok");
+    TEST_ASSERT(millis() - issued < 300);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(350));
+    LoopbackClient expired(harness.getPort());
+    expired.sendAction({{"action", "ping"}, {"token", token}});
+    TEST_ASSERT(LoopbackClient::result(expired.receive()) == "error");
+    TEST_ASSERT_TRUE(expired.closedByServer());
+
+    TEST_MESSAGE("A signed action should be accepted, a bad MAC or a replay refused");
+
+    std::string hmacFrame = withHmac(serializedAction({{"action", "ping"}, {"nonce", "1"}}), "password") + '\0';
+    LoopbackClient hmac(harness.getPort());
+    hmac.send(hmacFrame);
+    TEST_ASSERT(LoopbackClient::result(hmac.receive()) == "ok");
+
+    LoopbackClient replay(harness.getPort());
+    replay.send(hmacFrame);
+    TEST_ASSERT(LoopbackClient::result(replay.receive()) == "error");
+    TEST_ASSERT_TRUE(replay.closedByServer());
+
+    std::string forged = withHmac(serializedAction({{"action", "ping"}, {"nonce", "2"}}), "password");
+    forged[forged.size() - 1] = forged[forged.size() - 1] == '0' ? '1' : '0';
+    LoopbackClient badMac(harness.getPort());
+    badMac.send(forged + '\0');
+    TEST_ASSERT(LoopbackClient::result(badMac.receive()) == "error");
+    TEST_ASSERT_TRUE(badMac.closedByServer());
+
+    harness.stop();
+}
+#endif
@@ -0,0 +1,467 @@
+// Drives concurrent load at a running command server and reports its throughput and latency.
+// The frames are encoded with SerialMap and the responses decoded with SerialFrameParser, so the
+// tool speaks exactly the protocol of the device. It connects in plain TCP, e.g. to the native_server
+// stand-in on loopback.
+//
+// Usage: program [options]
+//   --host <address>      The server address (127.0.0.1)
+//   --port <port>         The server port (5000)
+//   --connections <n>     The concurrent connections (8)
+//   --duration <s>        How long the load lasts, in seconds (10)
+//   --mix <a:w,b:w>       The actions sent and their weights (echo:1)
+//   --payload <bytes>     The size of the "payload" field of each action, at most 255 (16)
+//   --rate <rps>          Open loop: the total requests per second, sent on schedule whatever
+//                         the responses. 0 runs a closed loop, each connection sending its next
+//                         request once the previous one is answered (0)
+//   --user <username>     The username ("user")
+//   --password <pass>     The password ("password")
+//   --json                Prints a JSON object instead of the table
+//
+// Each connection authenticates once and then keeps sending actions on the same connection,
+// so the server needs KEEP_ALIVE_MS. The latency of the open loop is measured from the time
+// each request was scheduled, so that a server falling behind shows in the tail.
+
+#define _TEST_ENV
+
+#include "../../test/mocks.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include "SerialMap.h"
+#include "SerialMapView.h"
+#include "SerialFrame.h"
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    int port = 5000;
+    int connections = 8;
+    double duration = 10;
+    std::string mix = "echo:1";
+    size_t payload = 16;
+    double rate = 0;
+    std::string user = "user";
+    std::string password = "password";
+    bool json = false;
+};
+
+struct Action
+{
+    std::string name;
+    int weight;
+    std::string frame;
+    std::vector<double> latencies;
+    unsigned long errors = 0;
+};
+
+struct Connection
+{
+    int fd = -1;
+    // The send time of the requests awaiting their response, in order
+    std::deque<std::chrono::steady_clock::time_point> sent;
+    std::deque<Action *> actions;
+    std::string output;
+    char buffer[SerialFrame::BUFFER_SIZE];
+    SerialFrameParser parser{buffer, sizeof(buffer)};
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static std::string encode(const std::vector<std::pair<std::string, std::string>> &fields)
+{
+    SerialMap<String, 8> map;
+    for (auto &field : fields)
+    {
+        map.put(field.first, field.second);
+    }
+    char frame[SerialFrame::BUFFER_SIZE];
+    size_t len = map.serialize(frame, sizeof(frame));
+    return std::string(frame, len);
+}
+
+static bool parseOptions(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--json")
+        {
+            options.json = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            return false;
+        }
+        const char *value = argv[++i];
+        if (arg == "--host")
+            options.host = value;
+        else if (arg == "--port")
+            options.port = atoi(value);
+        else if (arg == "--connections")
+            options.connections = atoi(value);
+        else if (arg == "--duration")
+            options.duration = atof(value);
+        else if (arg == "--mix")
+            options.mix = value;
+        else if (arg == "--payload")
+            options.payload = strtoul(value, nullptr, 10);
+        else if (arg == "--rate")
+            options.rate = atof(value);
+        else if (arg == "--user")
+            options.user = value;
+        else if (arg == "--password")
+            options.password = value;
+        else
+            return false;
+    }
+    return options.connections > 0 && options.duration > 0 && options.payload <= 255;
+}
+
+static std::vector<Action> parseMix(const Options &options)
+{
+    std::vector<Action> actions;
+    size_t start = 0;
+    while (start < options.mix.size())
+    {
+        size_t end = options.mix.find(',', start);
+        std::string entry = options.mix.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t colon = entry.find(':');
+        Action action;
+        action.name = entry.substr(0, colon);
+        action.weight = colon == std::string::npos ? 1 : atoi(entry.c_str() + colon + 1);
+        action.frame = encode({{"action", action.name},
+                               {"payload", std::string(options.payload, 'x')},
+                               {"connection", "keep-alive"}});
+        if (action.weight > 0)
+        {
+            actions.push_back(action);
+        }
+        start = end == std::string::npos ? options.mix.size() : end + 1;
+    }
+    return actions;
+}
+
+/**
+ * @brief Connects and authenticates, waiting for the answer
+ */
+static int open(const Options &options)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    if (inet_pton(AF_INET, options.host.c_str(), &address.sin_addr) != 1 ||
+        connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    std::string authentication = encode({{"username", options.user}, {"password", options.password}});
+    send(fd, authentication.data(), authentication.size(), 0);
+
+    char buffer[SerialFrame::BUFFER_SIZE];
+    SerialFrameParser parser(buffer, sizeof(buffer));
+    char c;
+    while (parser.getResult() == PARSE_NEED_MORE && recv(fd, &c, 1, 0) == 1)
+    {
+        parser.feed(&c, 1);
+    }
+    SerialMapView<2> response(parser.data(), parser.getLength());
+    const SerialSlice *result = response.get("result");
+    if (parser.getResult() != PARSE_COMPLETE || result == nullptr || *result != "ok")
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void flush(Connection &connection)
+{
+    while (!connection.output.empty())
+    {
+        ssize_t n = send(connection.fd, connection.output.data(), connection.output.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return;
+        }
+        connection.output.erase(0, n);
+    }
+}
+
+static void request(Connection &connection, Action &action, Clock::time_point scheduled)
+{
+    connection.output += action.frame;
+    connection.sent.push_back(scheduled);
+    connection.actions.push_back(&action);
+    flush(connection);
+}
+
+/**
+ * @brief Reads the responses received, recording their latency
+ *
+ * @return false If the connection is broken
+ */
+static bool receive(Connection &connection, unsigned long &unexpected)
+{
+    char data[4096];
+    ssize_t n = recv(connection.fd, data, sizeof(data), MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+        return false;
+    }
+    Clock::time_point now = Clock::now();
+    size_t used = 0;
+    while (n > 0 && used < (size_t)n)
+    {
+        size_t consumed = 0;
+        PARSE_RESULT result = connection.parser.feed(data + used, n - used, &consumed);
+        used += consumed;
+        if (result == PARSE_ERROR)
+        {
+            return false;
+        }
+        if (result != PARSE_COMPLETE)
+        {
+            break;
+        }
+        if (connection.sent.empty())
+        {
+            unexpected++;
+        }
+        else
+        {
+            Action *action = connection.actions.front();
+            SerialMapView<10> response(connection.parser.data(), connection.parser.getLength());
+            const SerialSlice *status = response.get("result");
+            if (status != nullptr && *status == "error")
+            {
+                action->errors++;
+            }
+            else
+            {
+                action->latencies.push_back(std::chrono::duration<double, std::micro>(now - connection.sent.front()).count());
+            }
+            connection.sent.pop_front();
+            connection.actions.pop_front();
+        }
+        connection.parser.reset();
+    }
+    return true;
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        fprintf(stderr, "Usage: %s [--host h] [--port p] [--connections n] [--duration s] [--mix a:w,b:w] "
+                        "[--payload bytes] [--rate rps] [--user u] [--password p] [--json]\n",
+                argv[0]);
+        return 1;
+    }
+    std::vector<Action> actions = parseMix(options);
+    if (actions.empty())
+    {
+        fprintf(stderr, "No action in the mix\n");
+        return 1;
+    }
+    int totalWeight = 0;
+    for (Action &action : actions)
+    {
+        totalWeight += action.weight;
+    }
+    std::mt19937 random(42);
+    auto pick = [&]() -> Action &
+    {
+        int r = random() % totalWeight;
+        for (Action &action : actions)
+        {
+            r -= action.weight;
+            if (r < 0)
+            {
+                return action;
+            }
+        }
+        return actions.back();
+    };
+
+    std::vector<Connection> connections(options.connections);
+    for (Connection &connection : connections)
+    {
+        connection.fd = open(options);
+        if (connection.fd < 0)
+        {
+            fprintf(stderr, "Could not connect and authenticate to %s:%d\n", options.host.c_str(), options.port);
+            return 1;
+        }
+    }
+
+    bool openLoop = options.rate > 0;
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::microseconds((long long)(options.duration * 1e6));
+    Clock::duration interval = openLoop ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options.rate)) : Clock::duration();
+    Clock::time_point next = start;
+    size_t turn = 0;
+    unsigned long unexpected = 0, broken = 0;
+    std::vector<pollfd> descriptors(connections.size());
+
+    // Keeps going after the end until the requests sent are answered, for a second at most
+    Clock::time_point drain = end + std::chrono::seconds(1);
+    while (true)
+    {
+        Clock::time_point now = Clock::now();
+        bool sending = now < end;
+        size_t outstanding = 0;
+        for (Connection &connection : connections)
+        {
+            outstanding += connection.sent.size();
+        }
+        if ((!sending && outstanding == 0) || now >= drain)
+        {
+            break;
+        }
+
+        if (sending && openLoop)
+        {
+            while (next <= now)
+            {
+                Connection &connection = connections[turn++ % connections.size()];
+                if (connection.fd >= 0)
+                {
+                    request(connection, pick(), next);
+                }
+                next += interval;
+            }
+        }
+        else if (sending)
+        {
+            for (Connection &connection : connections)
+            {
+                if (connection.fd >= 0 && connection.sent.empty())
+                {
+                    request(connection, pick(), now);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < connections.size(); i++)
+        {
+            descriptors[i].fd = connections[i].fd;
+            descriptors[i].events = POLLIN | (connections[i].output.empty() ? 0 : POLLOUT);
+            descriptors[i].revents = 0;
+        }
+        int timeout = 1;
+        if (openLoop && sending)
+        {
+            timeout = (int)std::chrono::duration_cast<std::chrono::milliseconds>(next - Clock::now()).count();
+            timeout = std::max(0, std::min(timeout, 10));
+        }
+        poll(descriptors.data(), descriptors.size(), timeout);
+
+        for (size_t i = 0; i < connections.size(); i++)
+        {
+            Connection &connection = connections[i];
+            if (connection.fd < 0)
+            {
+                continue;
+            }
+            if (descriptors[i].revents & POLLOUT)
+            {
+                flush(connection);
+            }
+            if ((descriptors[i].revents & (POLLIN | POLLHUP | POLLERR)) && !receive(connection, unexpected))
+            {
+                close(connection.fd);
+                connection.fd = -1;
+                connection.sent.clear();
+                connection.actions.clear();
+                broken++;
+            }
+        }
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> all;
+    unsigned long errors = 0, lost = 0;
+    for (Action &action : actions)
+    {
+        std::sort(action.latencies.begin(), action.latencies.end());
+        all.insert(all.end(), action.latencies.begin(), action.latencies.end());
+        errors += action.errors;
+    }
+    for (Connection &connection : connections)
+    {
+        lost += connection.sent.size();
+        if (connection.fd >= 0)
+        {
+            close(connection.fd);
+        }
+    }
+    std::sort(all.begin(), all.end());
+    double throughput = all.size() / elapsed;
+
+    if (options.json)
+    {
+        printf("{\"connections\":%d,\"mode\":\"%s\",\"target_rps\":%.1f,\"payload\":%zu,\"duration_s\":%.3f,"
+               "\"requests\":%zu,\"errors\":%lu,\"lost\":%lu,\"broken_connections\":%lu,\"rps\":%.1f,"
+               "\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,\"actions\":{",
+               options.connections, openLoop ? "open" : "closed", options.rate, options.payload, elapsed,
+               all.size(), errors, lost, broken, throughput,
+               percentile(all, 0.5), percentile(all, 0.99), percentile(all, 0.999), all.empty() ? 0 : all.back());
+        for (size_t i = 0; i < actions.size(); i++)
+        {
+            printf("%s\"%s\":{\"requests\":%zu,\"errors\":%lu,\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f}",
+                   i > 0 ? "," : "", actions[i].name.c_str(), actions[i].latencies.size(), actions[i].errors,
+                   percentile(actions[i].latencies, 0.5), percentile(actions[i].latencies, 0.99),
+                   percentile(actions[i].latencies, 0.999));
+        }
+        printf("}}\n");
+        return 0;
+    }
+
+    printf("%d connections, %s loop%s, %zu bytes payload, %.1f s\n", options.connections,
+           openLoop ? "open" : "closed", openLoop ? (" at " + std::to_string((int)options.rate) + " rps").c_str() : "",
+           options.payload, elapsed);
+    printf("%-12s %10s %8s %12s %12s %12s %12s\n", "action", "requests", "errors", "p50 (us)", "p99 (us)", "p999 (us)", "max (us)");
+    for (Action &action : actions)
+    {
+        printf("%-12s %10zu %8lu %12.1f %12.1f %12.1f %12.1f\n", action.name.c_str(), action.latencies.size(), action.errors,
+               percentile(action.latencies, 0.5), percentile(action.latencies, 0.99), percentile(action.latencies, 0.999),
+               action.latencies.empty() ? 0 : action.latencies.back());
+    }
+    printf("%-12s %10zu %8lu %12.1f %12.1f %12.1f %12.1f\n", "total", all.size(), errors,
+           percentile(all, 0.5), percentile(all, 0.99), percentile(all, 0.999), all.empty() ? 0 : all.back());
+    printf("%.1f requests/s", throughput);
+    if (lost > 0 || broken > 0 || unexpected > 0)
+    {
+        printf(", %lu unanswered, %lu connections broken, %lu unexpected responses", lost, broken, unexpected);
+    }
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,162 @@
+// Runs the command server on the host over the POSIX transport, so that it can be driven with
+// real traffic from localhost and profiled with the usual Linux tools (perf, valgrind, strace).
+//
+// Usage: program [port] [certificate.pem private_key.pem]
+//
+// The credentials are "user"/"password". The actions are:
+//  - "echo", answering with every field of the action;
+//  - "ping", answering with the success response;
+//  - "sleep", answering with the success response after "ms" milliseconds, without holding
+//    back the other clients;
+//  - "upload", taking a payload of "length" bytes with the given "crc32" and answering with
+//    its size, the payload itself being dropped;
+//  - "shutdown", stopping the server.
+// The reserved "__stats" and "__memory" actions are answered too, the latter counting the
+// allocations of each request, and the footprint of the server is printed at startup.
+// The TLS needs the native_server environment, which builds with POSIX_TRANSPORT_TLS. The
+// environment also builds the device sources the server needs against the mocks.
+
+#define _TEST_ENV
+// The response buffer, a batch and the buffers of the 16 clients, all of them running asynchronous actions
+#define BUFFER_POOL_SIZE (512 + 256 + 16 * (512 + 128))
+
+#include "../../test/mocks.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <new>
+#include "CommandServer.h"
+
+// Counts the heap allocations, reported per request by the `__memory` action
+static unsigned long allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations++;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+// Counts the bytes of the uploads, as a stand-in for writing them to a file
+class CountingUpload : public UploadHandler
+{
+public:
+    bool begin(ActionView &action, size_t length) override
+    {
+        size = 0;
+        return true;
+    }
+    bool write(const uint8_t *data, size_t len) override
+    {
+        size += len;
+        return true;
+    }
+    bool commit(Stream &output) override
+    {
+        SerialMap<String, 2> response;
+        response.put("result", "ok");
+        response.put("size", std::to_string(size));
+        response.write(output);
+        return false;
+    }
+
+private:
+    size_t size = 0;
+};
+
+static std::string readFile(const char *path)
+{
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+int main(int argc, char **argv)
+{
+    std::string certificate, privateKey;
+    if (argc >= 4)
+    {
+        certificate = readFile(argv[2]);
+        privateKey = readFile(argv[3]);
+    }
+
+    CommandServerSettings settings;
+    settings.HOSTNAME = "localhost";
+    settings.PORT = argc >= 2 ? atoi(argv[1]) : 5000;
+    settings.AUTH_USERNAME = "user";
+    settings.AUTH_PASSWORD = "password";
+    settings.UDP_PORT = 5001;
+    settings.UDP_PACKET = "RCS";
+    settings.UDP_PACKET_SIZE = 3;
+    settings.UDP_RATE_MS = 1000;
+    settings.CERTIFICATE = certificate.empty() ? nullptr : certificate.c_str();
+    settings.PRIVATE_KEY = privateKey.empty() ? nullptr : privateKey.c_str();
+    settings.TLS_SESSION_CACHE_SIZE = 64;
+    settings.TIMEOUT_MS = 5000;
+    settings.WIFI_TIMEOUT_S = 0;
+    settings.KEEP_ALIVE_MS = 30000;
+    settings.STATS_ACTION_ENABLED = true;
+    settings.MEMORY_ACTION_ENABLED = true;
+    settings.INLINE_AUTH_ENABLED = true;
+
+    StateManager stateManager;
+    BufferPool pool;
+    CommandServer<8, 16, PosixTransport> server(stateManager, settings, pool);
+    server.getTransport().setBroadcastAddress("127.255.255.255");
+
+    server.registerAction("echo", [](ActionView &action, Stream &client)
+                          {
+                              SerialFrameWriter response(client);
+                              for (int i = 0; i < action.getSize(); i++)
+                              {
+                                  response.put(action.keyAt(i).toString().c_str(), action.valueAt(i).toString());
+                              }
+                              response.end();
+                              return false; });
+    server.registerAction("ping", [](ActionView &action, Stream &client)
+                          {
+                              Response::successResponse().write(client);
+                              return false; });
+    server.registerAction("sleep", [](ActionView &action, Stream &client, AsyncContext &context) -> Async
+                          {
+                              ASYNC_BEGIN(context);
+                              ASYNC_SLEEP(context, action.has("ms") ? atol(action.get("ms")->toString().c_str()) : 0);
+                              Response::successResponse().write(client);
+                              ASYNC_RETURN(context, false);
+                              ASYNC_END(context); });
+    CountingUpload upload;
+    server.registerAction("upload", upload);
+    server.registerAction("shutdown", [](ActionView &action, Stream &client)
+                          {
+                              Response::successResponse().write(client);
+                              return true; });
+
+    // The footprint of the server, to compare between two builds
+    MemoryStats &memory = server.getMemoryStats();
+    memory.addComponent("StateManager", sizeof(StateManager));
+    memory.addComponent("CommandServer", sizeof(server));
+    memory.addComponent("BufferPool", sizeof(BufferPool));
+    memory.setAllocationCounter([]
+                                { return allocations; });
+    OStreamProxy out(std::cout);
+    memory.printTo(out);
+
+    printf("Listening on port %d%s\n", settings.PORT, settings.CERTIFICATE != nullptr ? " (TLS)" : "");
+    fflush(stdout);
+    server.startServer();
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Measures the TLS handshake time of a running server, with full and resumed handshakes.
+// Flash the device once with an RSA-2048 certificate and once with a P-256 one to compare them.
+//
+// Usage: program <host> <port> [iterations]
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static int connectTo(const char *host, const char *port)
+{
+    addrinfo hints = {}, *result = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &result) != 0)
+    {
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo *ai = result; ai != nullptr && fd < 0; ai = ai->ai_next)
+    {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+/**
+ * @brief Runs a single handshake, resuming the given session if any
+ *
+ * @return double The handshake time in milliseconds, or a negative number on failure
+ */
+static double handshake(SSL_CTX *ctx, const char *host, const char *port, SSL_SESSION *resume,
+                        SSL_SESSION **session, bool *reused, std::string *keyType)
+{
+    int fd = connectTo(host, port);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    SSL *ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    if (resume != nullptr)
+    {
+        SSL_set_session(ssl, resume);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    int result = SSL_connect(ssl);
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (result == 1)
+    {
+        *reused = SSL_session_reused(ssl);
+        if (session != nullptr)
+        {
+            *session = SSL_get1_session(ssl);
+        }
+        X509 *cert = SSL_get1_peer_certificate(ssl);
+        if (cert != nullptr && keyType != nullptr)
+        {
+            EVP_PKEY *key = X509_get0_pubkey(cert);
+            char name[32];
+            snprintf(name, sizeof(name), "%s-%d", EVP_PKEY_base_id(key) == EVP_PKEY_EC ? "P" : "RSA", EVP_PKEY_bits(key));
+            *keyType = name;
+        }
+        X509_free(cert);
+        SSL_shutdown(ssl);
+    }
+    else
+    {
+        ERR_print_errors_fp(stderr);
+        elapsed = -1;
+    }
+    SSL_free(ssl);
+    close(fd);
+    return elapsed;
+}
+
+static void report(const char *name, std::vector<double> &times)
+{
+    if (times.empty())
+    {
+        printf("%-28s no successful handshake\n", name);
+        return;
+    }
+    std::sort(times.begin(), times.end());
+    double total = 0;
+    for (double t : times)
+    {
+        total += t;
+    }
+    printf("%-28s n=%-4zu avg=%8.2f ms  p50=%8.2f ms  min=%8.2f ms  max=%8.2f ms\n", name, times.size(),
+           total / times.size(), times[times.size() / 2], times.front(), times.back());
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <host> <port> [iterations]\n", argv[0]);
+        return 1;
+    }
+    const char *host = argv[1], *port = argv[2];
+    int iterations = argc > 3 ? atoi(argv[3]) : 10;
+
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    // BearSSL speaks up to TLS 1.2, where sessions are resumed through the session ID
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, nullptr);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT);
+
+    std::vector<double> full, resumed;
+    std::string keyType = "unknown key";
+    SSL_SESSION *session = nullptr;
+    int reusedCount = 0;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        bool reused = false;
+        SSL_SESSION *last = nullptr;
+        double t = handshake(ctx, host, port, nullptr, &last, &reused, &keyType);
+        if (t >= 0)
+        {
+            full.push_back(t);
+            SSL_SESSION_free(session);
+            session = last;
+        }
+    }
+
+    for (int i = 0; i < iterations && session != nullptr; i++)
+    {
+        bool reused = false;
+        double t = handshake(ctx, host, port, session, nullptr, &reused, nullptr);
+        if (t >= 0)
+        {
+            resumed.push_back(t);
+            reusedCount += reused;
+        }
+    }
+
+    std::string fullName = "full (" + keyType + ")";
+    report(fullName.c_str(), full);
+    report("resumed", resumed);
+    printf("%d of %zu resumption attempts reused the session\n", reusedCount, resumed.size());
+
+    SSL_SESSION_free(session);
+    SSL_CTX_free(ctx);
+    return 0;
+}